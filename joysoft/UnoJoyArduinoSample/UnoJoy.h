@@ -108,6 +108,16 @@
     //    myControllerData = getBlankDataForController();
     dataForController_t getBlankDataForController(void);
     
+    // If the Arduino's USB chip is left on its stock serial
+    //  firmware, a computer can talk to UnoJoy directly. It can ask
+    //  for bytes of the dataForController_t the same way the UnoJoy
+    //  firmware does, or it can send UNOJOY_PUSH, after which
+    //  setControllerData sends a packet whenever a button changes:
+    //    UNOJOY_SYNC, button byte 0, 1, 2, and a check byte
+    //  The check byte is the other four XORed together.
+    //  The sticks aren't sent this way, so moving them sends nothing.
+    #define UNOJOY_PUSH 'P'
+    #define UNOJOY_SYNC 0xA5
     
 //----- End of the interface code you should be using -----//
 //----- Below here is the actual implementation of
@@ -123,12 +133,51 @@
   //  The UnoJoy firmware on the ATmega8u2 regularly polls the
   //  Arduino chip for individual bytes of a dataForController_t.
   //  
+  // Set by the ISR when the computer asks for pushed changes,
+  //  and pushNow makes the next setControllerData send the buttons
+  //  whether they changed or not, so the computer starts out knowing them.
+  volatile bool pushChanges = false;
+  volatile bool pushNow = false;
+  // The button bytes as last pushed
+  uint8_t pushedButtons[3];
+
+  void pushButtons(void){
+    uint8_t *data = (uint8_t*)&controllerDataBuffer;
+    uint8_t packet[5];
+    int changed = pushNow;
+    int i;
+
+    for (i = 0; i < 3; i++){
+      // Only the lowest bit of the third byte is a button,
+      //  the rest is padding that might be anything
+      uint8_t buttons = i < 2 ? data[i] : data[i] & 1;
+      if (buttons != pushedButtons[i]){
+        changed = 1;
+      }
+      pushedButtons[i] = buttons;
+    }
+    if (!changed){
+      return;
+    }
+    pushNow = false;
+    packet[0] = UNOJOY_SYNC;
+    packet[4] = UNOJOY_SYNC;
+    for (i = 0; i < 3; i++){
+      packet[i + 1] = pushedButtons[i];
+      packet[4] ^= pushedButtons[i];
+    }
+    Serial.write(packet, sizeof(packet));
+  }
+
   void setControllerData(dataForController_t controllerData){
     // Probably unecessary, but this guarantees that the data
     //  gets copied to our buffer all at once.
     ATOMIC_BLOCK(ATOMIC_FORCEON){
       controllerDataBuffer = controllerData;
     }
+    if (pushChanges){
+      pushButtons();
+    }
   }
   
   // serialCheckInterval governs how many ms between
@@ -188,6 +237,12 @@
         //digitalWrite(13, HIGH);
         // Get incoming byte from the ATmega8u2
         byte inByte = Serial.read();
+        // The computer wants changes sent as they happen instead
+        if (inByte == UNOJOY_PUSH){
+          pushChanges = true;
+          pushNow = true;
+          continue;
+        }
         // That number tells us which byte of the dataForController_t struct
         //  to send out.
         Serial.write(((uint8_t*)&controllerDataBuffer)[inByte]);
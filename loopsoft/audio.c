@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "audio.h"
+#include "calib.h"
+
+#define STACK_PREFAULT_BYTES (64 * 1024)
+// how long past the end of the calibration signal to wait for it to finish
+#define CALIB_TIMEOUT_SEC 5
+
+static const struct audio_backend *backends[] = {
+    &audio_alsa,
+#ifdef HAVE_PULSE
+    &audio_pulse,
+#endif
+#ifdef HAVE_JACK
+    &audio_jack,
+#endif
+    &audio_null,
+};
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+const struct audio_backend *audio_find_backend(const char *name){
+    size_t i;
+    for (i=0; i<NUM_BACKENDS; i++){
+        if (strcmp(backends[i]->name, name) == 0) {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
+
+const char *audio_backend_names(void){
+    static char names[64];
+    size_t i;
+
+    if (!names[0]) {
+        for (i=0; i<NUM_BACKENDS; i++){
+            if (i) {
+                strcat(names, " ");
+            }
+            strcat(names, backends[i]->name);
+        }
+    }
+    return names;
+}
+
+long long audio_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// calibrations are kept per backend and device, the same card reads
+// differently through pulse than straight through alsa
+static void calibKey(struct audio *a, char *key, size_t size){
+    snprintf(key, size, "%s:%s", a->backend->name, a->device);
+}
+
+int audio_open(struct audio *a, const struct audio_backend *backend,
+                const char *device, unsigned int rate, int period, int channels){
+    int err;
+
+    memset(a, 0, sizeof(*a));
+    if (channels < 1 || channels > MAX_DEVICE_CHANNELS) {
+        fprintf(stderr, "can't have %d channels, 1 to %d\n", channels, MAX_DEVICE_CHANNELS);
+        return -EINVAL;
+    }
+    a->backend = backend;
+    a->device = device;
+    a->rate = rate;
+    a->period = (period + FRAMESIZE - 1) / FRAMESIZE * FRAMESIZE;
+    a->channels = channels;
+    atomic_init(&a->running, 0);
+
+    if ((err = backend->open(a, device)) < 0) {
+        a->backend = NULL;
+        return err;
+    }
+    if (a->period % FRAMESIZE) {
+        fprintf(stderr, "%s: period of %d frames is not a multiple of %d\n",
+            backend->name, a->period, FRAMESIZE);
+        audio_close(a);
+        return -EINVAL;
+    }
+    if (a->channels < 1 || a->channels > MAX_DEVICE_CHANNELS) {
+        fprintf(stderr, "%s: device has %d channels, 1 to %d will do\n",
+            backend->name, a->channels, MAX_DEVICE_CHANNELS);
+        audio_close(a);
+        return -EINVAL;
+    }
+    if (a->rate != rate) {
+        fprintf(stderr, "warning: device runs at %u Hz instead of %u Hz\n",
+            a->rate, rate);
+    }
+    if (a->channels != channels) {
+        fprintf(stderr, "warning: device has %d channels instead of %d\n",
+            a->channels, channels);
+    }
+
+    if (a->channels != CHANNELS) {
+        a->conv_in = calloc(FRAMES_TO_SAMPLES(a->period), sizeof(sample_t));
+        a->conv_out = calloc(FRAMES_TO_SAMPLES(a->period), sizeof(sample_t));
+        if (!a->conv_in || !a->conv_out) {
+            audio_close(a);
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+void audio_attach(struct audio *a, struct engine *e){
+    char key[256];
+
+    a->engine = e;
+    e->pin_storage = 1;
+    calibKey(a, key, sizeof(key));
+    e->latency = calib_load(key, a->rate);
+    if (e->latency < 0) {
+        e->latency = a->latency;
+        fprintf(stderr, "warning: %s is not calibrated, estimating latency\n", key);
+    }
+}
+
+void audio_close(struct audio *a){
+    if (a->backend) {
+        a->backend->close(a);
+    }
+    a->backend = NULL;
+    free(a->conv_in);
+    free(a->conv_out);
+    a->conv_in = a->conv_out = NULL;
+}
+
+int audio_start(struct audio *a){
+    int err;
+
+    stats_init(&a->stats);
+    atomic_store(&a->stats.budget, (long long)a->period * 1000000000LL / a->rate);
+    a->last_in = 0;
+    a->resync = 0;
+    a->skip_carry = 0;
+    atomic_store(&a->running, 1);
+    if ((err = a->backend->start(a)) < 0) {
+        atomic_store(&a->running, 0);
+    }
+    return err;
+}
+
+void audio_stop(struct audio *a){
+    if (atomic_exchange(&a->running, 0)) {
+        a->backend->stop(a);
+    }
+}
+
+// records what came in and plays the test signal out, in the same
+// read-then-write order as the engine, so the lag between the two comes
+// out exactly as the engine sees it
+static void calibProcess(struct audio_calib *c, const sample_t *in, sample_t *out, int frames){
+    int n = c->frames - c->pos;
+
+    if (n > frames) {
+        n = frames;
+    }
+    if (n > 0) {
+        memcpy(c->got + FRAMES_TO_SAMPLES(c->pos), in, sizeof(sample_t) * FRAMES_TO_SAMPLES(n));
+        memcpy(out, c->sent + FRAMES_TO_SAMPLES(c->pos), sizeof(sample_t) * FRAMES_TO_SAMPLES(n));
+        c->pos += n;
+    }
+    memset(out + FRAMES_TO_SAMPLES(n), 0, sizeof(sample_t) * FRAMES_TO_SAMPLES(frames - n));
+    if (c->pos == c->frames) {
+        atomic_store_explicit(&c->done, 1, memory_order_release);
+    }
+}
+
+void audio_xrun(struct audio *a, int err){
+    stats_count(&a->stats, STAT_XRUNS, 1);
+    //calibration goes by what it captured, not the clock, and a device
+    //just opened has no engine yet
+    if (a->calib || !a->engine) {
+        return;
+    }
+    engine_notify(a->engine, NOTE_XRUN, -1, err);
+    a->resync = 1;
+}
+
+// the input lost between the last period and this one, whose last frame
+// came in at now. the device's clock and the monotonic one drift apart
+// by a few ppm, nothing over the length of an xrun.
+static void resync(struct audio *a, int frames, long long now){
+    long long gap = now - a->last_in - (long long)frames * 1000000000LL / a->rate;
+    long long lost;
+
+    a->resync = 0;
+    if (gap <= 0 || gap > XRUN_MAX_SKIP_MS * 1000000LL) {
+        return;
+    }
+    lost = gap * a->rate / 1000000000LL + a->skip_carry;
+    a->skip_carry = lost % FRAMESIZE;
+    lost -= a->skip_carry;
+    if (lost > 0) {
+        engine_skip(a->engine, lost);
+        engine_notify(a->engine, NOTE_SKIPPED, -1, lost);
+    }
+}
+
+// a device's frames into the engine's channels. one channel goes to
+// all of them, past that each takes its own and the rest are dropped.
+static void fromDevice(sample_t *dst, const sample_t *src, int frames, int channels){
+    int i, c;
+
+    for (i=0; i<frames; i++){
+        for (c=0; c<CHANNELS; c++){
+            dst[c] = src[c < channels ? c : channels - 1];
+        }
+        dst += CHANNELS;
+        src += channels;
+    }
+}
+
+// and back: a single channel gets the mix of them all, extra ones silence
+static void toDevice(sample_t *dst, const sample_t *src, int frames, int channels){
+    int i, c;
+
+    for (i=0; i<frames; i++){
+        if (channels == 1) {
+            accum_t sum = 0;
+            for (c=0; c<CHANNELS; c++){
+                sum += src[c];
+            }
+            dst[0] = sum / CHANNELS;
+        } else {
+            for (c=0; c<channels; c++){
+                dst[c] = c < CHANNELS ? src[c] : 0;
+            }
+        }
+        dst += channels;
+        src += CHANNELS;
+    }
+}
+
+static void runEngine(struct audio *a, const sample_t *in, sample_t *out,
+                int frames, long long now){
+    struct engine *e = a->engine;
+    int n;
+
+    if (a->resync && a->last_in) {
+        resync(a, frames, now);
+    }
+    a->last_in = now;
+
+    for (n=FRAMESIZE; n<=frames; n+=FRAMESIZE){
+        //each engine period ends that much before the last frame came in
+        engine_clock(e, now - (long long)(frames - n) * 1000000000LL / a->rate);
+        engine_process(e, in, out);
+        in += PERIOD_SAMPLES;
+        out += PERIOD_SAMPLES;
+    }
+}
+
+void audio_process(struct audio *a, const sample_t *in, sample_t *out,
+                int frames, long long now){
+    struct audio_stats *s = &a->stats;
+    sample_t *dev_out = out;
+    long long start = audio_now();
+    long long took;
+
+    if (s->last_start) {
+        stats_time(s, STAT_CYCLE, start - s->last_start);
+    }
+    s->last_start = start;
+
+    //the engine only ever sees its own channels, so a device's count costs
+    //nothing past this copy and none at all when it matches
+    if (a->conv_in) {
+        fromDevice(a->conv_in, in, frames, a->channels);
+        in = a->conv_in;
+        out = a->conv_out;
+    }
+    if (a->calib) {
+        calibProcess(a->calib, in, out, frames);
+    } else {
+        runEngine(a, in, out, frames, now);
+    }
+    if (a->conv_out) {
+        toDevice(dev_out, out, frames, a->channels);
+    }
+    if (a->calib) {
+        return;
+    }
+
+    took = audio_now() - start;
+    stats_time(s, STAT_DSP, took);
+    stats_count(s, STAT_PERIODS, 1);
+    if (took > (long long)frames * 1000000000LL / a->rate) {
+        stats_count(s, STAT_OVER_BUDGET, 1);
+    }
+}
+
+int audio_calibrate(struct audio *a){
+    struct audio_calib c;
+    char key[256];
+    double quality;
+    long long deadline;
+    int latency;
+    int err;
+
+    memset(&c, 0, sizeof(c));
+    c.frames = (1 << CALIB_ORDER) - 1 + CALIB_TAIL_FRAMES;
+    c.sent = malloc(sizeof(sample_t) * FRAMES_TO_SAMPLES(c.frames));
+    c.got = malloc(sizeof(sample_t) * FRAMES_TO_SAMPLES(c.frames));
+    atomic_init(&c.done, 0);
+    if (!c.sent || !c.got) {
+        err = -ENOMEM;
+        goto out;
+    }
+    calib_mls(c.sent, c.frames, CALIB_AMPLITUDE);
+
+    a->calib = &c;
+    if ((err = audio_start(a)) < 0) {
+        fprintf(stderr, "calibration failed, cannot start audio\n");
+        goto out;
+    }
+    deadline = audio_now() +
+        ((long long)c.frames * 1000000000LL / a->rate) + CALIB_TIMEOUT_SEC * 1000000000LL;
+    while (!atomic_load_explicit(&c.done, memory_order_acquire) && audio_now() < deadline) {
+        usleep(10000);
+    }
+    audio_stop(a);
+
+    if (!atomic_load(&c.done)) {
+        fprintf(stderr, "calibration failed, audio stopped running\n");
+        err = -EIO;
+        goto out;
+    }
+
+    latency = calib_lag(c.sent, c.frames, c.got, c.frames, CALIB_TAIL_FRAMES, &quality);
+    if (latency < 0) {
+        fprintf(stderr, "calibration failed: no clear echo of the test signal "
+            "(quality %.1f), is output looped back to input?\n", quality);
+        err = -EIO;
+        goto out;
+    }
+    printf("round trip latency %d frames (%.2f ms), quality %.1f\n",
+        latency, latency * 1000.0 / a->rate, quality);
+    a->engine->latency = latency;
+    calibKey(a, key, sizeof(key));
+    calib_save(key, a->rate, latency);
+    err = 0;
+
+out:
+    a->calib = NULL;
+    free(c.sent);
+    free(c.got);
+    return err;
+}
+
+void audio_prefault_stack(void){
+    volatile char stack[STACK_PREFAULT_BYTES];
+    size_t i;
+    for (i=0; i<sizeof(stack); i+=4096){
+        stack[i] = 0;
+    }
+}
+
+int audio_spawn(pthread_t *thread, void *(*fn)(void *), void *arg){
+    pthread_attr_t attr;
+    struct sched_param param;
+    int err;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = AUDIO_THREAD_PRIORITY;
+    pthread_attr_setschedparam(&attr, &param);
+
+    err = pthread_create(thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+
+    //no rights to real time scheduling, run with normal priority instead
+    if (err == EPERM) {
+        fprintf(stderr, "warning: cannot use real time scheduling for audio\n");
+        err = pthread_create(thread, NULL, fn, arg);
+    }
+    return -err;
+}
@@ -0,0 +1,131 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "engine.h"
+#include "stats.h"
+
+// periods of silence queued on the playback side before starting
+#define PREFILL_PERIODS 2
+// fudge on top of the buffer sizes for the latency estimate, only used
+// until the device has been calibrated
+#define ADDTL_LATENCY_USEC 18000
+// level of the calibration sequence
+#define CALIB_AMPLITUDE 8000
+// priority of whichever thread runs the engine, where the backend owns it
+#define AUDIO_THREAD_PRIORITY 80
+// the most input an xrun may lose and still be caught up on. anything
+// longer (a suspend, a debugger) just leaves the loop that much late.
+#define XRUN_MAX_SKIP_MS 2000
+// devices may have any number of channels up to this. the engine is
+// always CHANNELS wide: a mono device feeds both sides and is sent their
+// mix, a wider one only has its first CHANNELS used.
+#define MAX_DEVICE_CHANNELS 8
+
+// frames of a device's audio in samples, like FRAMES_TO_SAMPLES for the
+// engine's
+#define DEVICE_SAMPLES(a, n) ((n) * (a)->channels)
+
+struct audio;
+
+// one way of getting audio in and out. open settles rate, period and
+// channels with the device, and guesses the round trip into latency.
+// start and stop run audio_process from the backend's own real time
+// context; start must work again after a stop.
+struct audio_backend {
+    const char *name;
+    int (*open)(struct audio *a, const char *device);
+    void (*close)(struct audio *a);
+    int (*start)(struct audio *a);
+    void (*stop)(struct audio *a);
+};
+
+extern const struct audio_backend audio_alsa;
+extern const struct audio_backend audio_pulse;
+extern const struct audio_backend audio_jack;
+extern const struct audio_backend audio_null;
+
+// a calibration run in progress, see audio_calibrate
+struct audio_calib {
+    sample_t *sent;
+    sample_t *got;
+    int frames;
+    int pos;
+    atomic_int done;
+};
+
+// an audio device and the engine it drives
+struct audio {
+    const struct audio_backend *backend;
+    struct engine *engine;
+    const char *device;
+    //asked for on open, what the device gave after
+    unsigned int rate;
+    int period;
+    int channels;
+    //the backend's guess at the round trip, frames
+    int latency;
+    //backend state
+    void *priv;
+
+    atomic_int running;
+    struct audio_calib *calib;
+    //since the last audio_start, see stats.h. backends add their waits,
+    //xruns and short reads, audio_process the rest.
+    struct audio_stats stats;
+    //when the last input frame processed came in, and whether an xrun
+    //came after it
+    long long last_in;
+    int resync;
+    //lost frames short of a whole engine period, kept for the next xrun
+    int skip_carry;
+    //a period in the engine's channels, when the device's are different
+    sample_t *conv_in;
+    sample_t *conv_out;
+};
+
+// NULL if no backend by that name was built in
+const struct audio_backend *audio_find_backend(const char *name);
+// space separated names of the backends built in
+const char *audio_backend_names(void);
+
+// opens the device at rate, period (frames, rounded up to whole engine
+// periods) and channels. the device may settle on another rate, which
+// is in a->rate after, so the engine is sized from it.
+int audio_open(struct audio *a, const struct audio_backend *backend,
+                const char *device, unsigned int rate, int period, int channels);
+// hands the device the engine to run, set up at a->rate, and sets the
+// engine's latency to match. the latency is the stored calibration for
+// the backend and device if there is one, the backend's estimate if not.
+void audio_attach(struct audio *a, struct engine *e);
+void audio_close(struct audio *a);
+
+// starts the engine running off the device
+int audio_start(struct audio *a);
+void audio_stop(struct audio *a);
+
+// measures the round trip latency through whatever loops output back to
+// input, stores it for the device and hands it to the engine. blocks for
+// a couple of seconds; call before audio_start.
+int audio_calibrate(struct audio *a);
+
+// for backends, from their real time context: runs frames (a multiple of
+// FRAMESIZE) of interleaved input through the engine into out, both in
+// the device's channels. now is
+// when the last input frame came in, on CLOCK_MONOTONIC.
+void audio_process(struct audio *a, const sample_t *in, sample_t *out,
+                int frames, long long now);
+// for backends, from their real time context: input or output was lost.
+// the next audio_process works out from its timestamp how much input went
+// missing and runs the engine on past it, see engine_skip. the backend
+// should have both directions lined up again by then.
+void audio_xrun(struct audio *a, int err);
+// for backends that run their own thread: spawns fn at real time priority,
+// falling back to normal priority without the rights
+int audio_spawn(pthread_t *thread, void *(*fn)(void *), void *arg);
+// touch the stack the audio thread will use so it never faults it in later
+void audio_prefault_stack(void);
+long long audio_now(void);
+
+#endif
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <alsa/asoundlib.h>
+#include "audio.h"
+
+// straight to the card through ALSA's mmap interface: the engine reads
+// the capture buffer and writes the playback buffer in place, with no
+// sound server and no copies in between
+
+struct alsa {
+    snd_pcm_t *capture;
+    snd_pcm_t *playback;
+    //for when a period straddles the end of a device buffer
+    sample_t *inbuf;
+    sample_t *outbuf;
+    pthread_t thread;
+};
+
+static int setup_channel(snd_pcm_t *handle, unsigned int *rate, unsigned int *channels,
+                snd_pcm_uframes_t *period, snd_pcm_uframes_t *buffer){
+    snd_pcm_hw_params_t *hw_params;
+    unsigned int periods = PREFILL_PERIODS + 1;
+    int dir = 0;
+    int err;
+
+    if ((err = snd_pcm_hw_params_malloc (&hw_params)) < 0) {
+        fprintf (stderr, "cannot allocate hardware parameter structure (%s)\n",
+             snd_strerror (err));
+        return err;
+    }
+
+    if ((err = snd_pcm_hw_params_any (handle, hw_params)) < 0) {
+        fprintf (stderr, "cannot initialize hardware parameter structure (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    if ((err = snd_pcm_hw_params_set_access (handle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) {
+        fprintf (stderr, "cannot set mmap access (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    if ((err = snd_pcm_hw_params_set_format (handle, hw_params, SND_PCM_FORMAT_S16_LE)) < 0) {
+        fprintf (stderr, "cannot set sample format (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    if ((err = snd_pcm_hw_params_set_rate_near (handle, hw_params, rate, &dir)) < 0) {
+        fprintf (stderr, "cannot set sample rate (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    if ((err = snd_pcm_hw_params_set_channels_near (handle, hw_params, channels)) < 0) {
+        fprintf (stderr, "cannot set channel count (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    dir = 0;
+    if ((err = snd_pcm_hw_params_set_period_size_near (handle, hw_params, period, &dir)) < 0) {
+        fprintf (stderr, "cannot set period size (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    dir = 0;
+    if ((err = snd_pcm_hw_params_set_periods_near (handle, hw_params, &periods, &dir)) < 0) {
+        fprintf (stderr, "cannot set period count (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    if ((err = snd_pcm_hw_params (handle, hw_params)) < 0) {
+        fprintf (stderr, "cannot set parameters (%s)\n",
+             snd_strerror (err));
+        goto out;
+    }
+
+    snd_pcm_hw_params_get_period_size(hw_params, period, &dir);
+    snd_pcm_hw_params_get_buffer_size(hw_params, buffer);
+
+out:
+    snd_pcm_hw_params_free (hw_params);
+    return err;
+}
+
+static void alsaClose(struct audio *a){
+    struct alsa *s = a->priv;
+
+    if (!s) {
+        return;
+    }
+    if (s->capture) {
+        snd_pcm_close(s->capture);
+    }
+    if (s->playback) {
+        snd_pcm_close(s->playback);
+    }
+    free(s->inbuf);
+    free(s->outbuf);
+    free(s);
+    a->priv = NULL;
+}
+
+static int alsaOpen(struct audio *a, const char *device){
+    snd_pcm_uframes_t cap_period, cap_buffer;
+    snd_pcm_uframes_t play_period, play_buffer;
+    unsigned int cap_channels, play_channels;
+    struct alsa *s;
+    int err;
+
+    if (!(s = calloc(1, sizeof(*s)))) {
+        return -ENOMEM;
+    }
+    a->priv = s;
+
+    if ((err = snd_pcm_open (&s->capture, device, SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+        fprintf (stderr, "cannot open audio device %s (%s)\n",
+             device,
+             snd_strerror (err));
+        s->capture = NULL;
+        goto fail;
+    }
+    if ((err = snd_pcm_open (&s->playback, device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+        fprintf (stderr, "cannot open audio device %s (%s)\n",
+             device,
+             snd_strerror (err));
+        s->playback = NULL;
+        goto fail;
+    }
+
+    cap_period = play_period = a->period;
+    cap_channels = play_channels = a->channels;
+    if ((err = setup_channel(s->capture, &a->rate, &cap_channels, &cap_period, &cap_buffer)) < 0 ||
+        (err = setup_channel(s->playback, &a->rate, &play_channels, &play_period, &play_buffer)) < 0) {
+        goto fail;
+    }
+    a->period = cap_period;
+    //frames are converted to and from the engine's channels as they are,
+    //so both ways have to agree
+    if (cap_channels != play_channels) {
+        fprintf(stderr, "%s has %u channels in and %u out, ask for one of them\n",
+            device, cap_channels, play_channels);
+        err = -EINVAL;
+        goto fail;
+    }
+    a->channels = cap_channels;
+
+    //capture and playback start, stop and prepare together
+    if ((err = snd_pcm_link(s->capture, s->playback)) < 0) {
+        fprintf (stderr, "cannot link capture and playback (%s)\n",
+             snd_strerror (err));
+        goto fail;
+    }
+
+    //round trip is one capture period plus everything queued for playback
+    a->latency = (int)(cap_period + play_buffer) +
+        (int)((long long)ADDTL_LATENCY_USEC * a->rate / 1000000);
+
+    s->inbuf = calloc(DEVICE_SAMPLES(a, FRAMESIZE), sizeof(sample_t));
+    s->outbuf = calloc(DEVICE_SAMPLES(a, FRAMESIZE), sizeof(sample_t));
+    if (!s->inbuf || !s->outbuf) {
+        err = -ENOMEM;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    alsaClose(a);
+    return err;
+}
+
+// queue silence on the playback side and start both linked streams
+static int startStreams(struct audio *a){
+    struct alsa *s = a->priv;
+    int i;
+    int err;
+
+    memset(s->outbuf, 0, sizeof(sample_t) * DEVICE_SAMPLES(a, FRAMESIZE));
+    for (i=0; i<PREFILL_PERIODS * a->period / FRAMESIZE; i++){
+        if ((err = snd_pcm_mmap_writei(s->playback, s->outbuf, FRAMESIZE)) < 0) {
+            return err;
+        }
+    }
+    return snd_pcm_start(s->capture);
+}
+
+static int recoverStreams(struct audio *a, int err){
+    struct alsa *s = a->priv;
+
+    //an xrun shifts the streams against each other, which would throw
+    //the measurement off
+    if (a->calib) {
+        fprintf(stderr, "xrun during calibration (%s)\n", snd_strerror(err));
+        return err;
+    }
+    //the streams are linked, so this drops and restarts both together and
+    //they come back lined up as they started
+    audio_xrun(a, err);
+    snd_pcm_drop(s->capture);
+    if ((err = snd_pcm_prepare(s->capture)) < 0) {
+        return err;
+    }
+    return startStreams(a);
+}
+
+static sample_t *areaFrames(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset){
+    return (sample_t *)((char *)areas[0].addr + areas[0].first / 8 + offset * areas[0].step / 8);
+}
+
+// one engine period from the capture buffer to the playback buffer. both
+// are normally contiguous right where they are mapped, if not the period
+// goes through the bounce buffers instead.
+static int transferPeriod(struct audio *a, long long now){
+    struct alsa *s = a->priv;
+    const snd_pcm_channel_area_t *in_areas, *out_areas;
+    snd_pcm_uframes_t in_off, out_off;
+    snd_pcm_uframes_t in_n = FRAMESIZE;
+    snd_pcm_uframes_t out_n = FRAMESIZE;
+    snd_pcm_sframes_t rc;
+    long long wrote;
+    int err;
+
+    if ((err = snd_pcm_mmap_begin(s->capture, &in_areas, &in_off, &in_n)) < 0 ||
+        (err = snd_pcm_mmap_begin(s->playback, &out_areas, &out_off, &out_n)) < 0) {
+        return err;
+    }
+
+    if (in_n == FRAMESIZE && out_n == FRAMESIZE) {
+        audio_process(a, areaFrames(in_areas, in_off), areaFrames(out_areas, out_off),
+            FRAMESIZE, now);
+        rc = snd_pcm_mmap_commit(s->capture, in_off, FRAMESIZE);
+        if (rc >= 0) {
+            wrote = audio_now();
+            rc = snd_pcm_mmap_commit(s->playback, out_off, FRAMESIZE);
+            stats_time(&a->stats, STAT_WRITE_WAIT, audio_now() - wrote);
+        }
+        return rc < 0 ? (int)rc : rc != FRAMESIZE ? -EPIPE : 0;
+    }
+
+    snd_pcm_mmap_commit(s->capture, in_off, 0);
+    snd_pcm_mmap_commit(s->playback, out_off, 0);
+    if ((rc = snd_pcm_mmap_readi(s->capture, s->inbuf, FRAMESIZE)) < 0) {
+        return rc;
+    }
+    if (rc < FRAMESIZE) {
+        memset(s->inbuf + DEVICE_SAMPLES(a, rc), 0,
+            sizeof(sample_t) * DEVICE_SAMPLES(a, FRAMESIZE - rc));
+        stats_count(&a->stats, STAT_SHORT_READS, 1);
+    }
+    audio_process(a, s->inbuf, s->outbuf, FRAMESIZE, now);
+    wrote = audio_now();
+    rc = snd_pcm_mmap_writei(s->playback, s->outbuf, FRAMESIZE);
+    stats_time(&a->stats, STAT_WRITE_WAIT, audio_now() - wrote);
+    return rc < 0 ? (int)rc : 0;
+}
+
+static void *alsaThread(void *arg){
+    struct audio *a = arg;
+    struct alsa *s = a->priv;
+    snd_pcm_sframes_t avail;
+    int err;
+
+    audio_prefault_stack();
+
+    if (startStreams(a) < 0) {
+        return NULL;
+    }
+
+    while (atomic_load_explicit(&a->running, memory_order_relaxed)) {
+        long long now = audio_now();
+        long long waited = now;
+
+        if ((err = snd_pcm_wait(s->capture, 1000)) < 0 ||
+            (avail = snd_pcm_avail_update(s->capture)) < 0) {
+            if (recoverStreams(a, err < 0 ? err : (int)avail) < 0) {
+                break;
+            }
+            continue;
+        }
+
+        //the wait returns as the last frame comes in, which is what pedal
+        //timestamps are measured against
+        now = audio_now();
+        stats_time(&a->stats, STAT_READ_WAIT, now - waited);
+        for (; avail >= FRAMESIZE; avail -= FRAMESIZE){
+            if ((err = transferPeriod(a, now - (avail - FRAMESIZE) * 1000000000LL / a->rate)) < 0) {
+                break;
+            }
+        }
+        if (err < 0 && recoverStreams(a, err) < 0) {
+            break;
+        }
+    }
+
+    snd_pcm_drop(s->capture);
+    snd_pcm_prepare(s->capture);
+    return NULL;
+}
+
+static int alsaStart(struct audio *a){
+    struct alsa *s = a->priv;
+    return audio_spawn(&s->thread, alsaThread, a);
+}
+
+static void alsaStop(struct audio *a){
+    struct alsa *s = a->priv;
+    pthread_join(s->thread, NULL);
+}
+
+const struct audio_backend audio_alsa = {
+    .name = "alsa",
+    .open = alsaOpen,
+    .close = alsaClose,
+    .start = alsaStart,
+    .stop = alsaStop,
+};
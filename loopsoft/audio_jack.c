@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <jack/jack.h>
+#include "audio.h"
+
+// a JACK client with a port per channel each way. JACK owns the period
+// and rate and runs us from its own real time thread; the device names
+// the JACK server, default for the usual one.
+
+struct jack {
+    jack_client_t *client;
+    jack_port_t *in[MAX_DEVICE_CHANNELS];
+    jack_port_t *out[MAX_DEVICE_CHANNELS];
+    sample_t *inbuf;
+    sample_t *outbuf;
+    //one channel on its way between a port and the interleaved buffers
+    sample_t *scratch;
+    //set from the xrun callback, reported from the process one
+    atomic_int xruns;
+};
+
+static int jackProcess(jack_nframes_t nframes, void *arg){
+    struct audio *a = arg;
+    struct jack *s = a->priv;
+    jack_default_audio_sample_t *buf;
+    long long now = audio_now();
+    int i;
+    int c;
+
+    //the server changed its period under us; stay quiet rather than split it
+    if ((int)nframes != a->period || !atomic_load_explicit(&a->running, memory_order_relaxed)) {
+        for (c=0; c<a->channels; c++){
+            memset(jack_port_get_buffer(s->out[c], nframes), 0,
+                sizeof(jack_default_audio_sample_t) * nframes);
+        }
+        return 0;
+    }
+
+    //several in a row show up as one
+    if (atomic_exchange_explicit(&s->xruns, 0, memory_order_relaxed)) {
+        audio_xrun(a, -EPIPE);
+    }
+
+    for (c=0; c<a->channels; c++){
+        buf = jack_port_get_buffer(s->in[c], nframes);
+        float_to_sample(s->scratch, buf, nframes);
+        for (i=0; i<(int)nframes; i++){
+            s->inbuf[i * a->channels + c] = s->scratch[i];
+        }
+    }
+
+    audio_process(a, s->inbuf, s->outbuf, nframes, now);
+
+    for (c=0; c<a->channels; c++){
+        buf = jack_port_get_buffer(s->out[c], nframes);
+        for (i=0; i<(int)nframes; i++){
+            s->scratch[i] = s->outbuf[i * a->channels + c];
+        }
+        sample_to_float(buf, s->scratch, nframes);
+    }
+    return 0;
+}
+
+static int jackXrun(void *arg){
+    struct audio *a = arg;
+    struct jack *s = a->priv;
+    atomic_fetch_add_explicit(&s->xruns, 1, memory_order_relaxed);
+    return 0;
+}
+
+// worst case latency of the first physical port going the given way
+static int physicalLatency(jack_client_t *client, unsigned long flags, jack_latency_callback_mode_t mode){
+    const char **ports = jack_get_ports(client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | flags);
+    jack_latency_range_t range = { 0, 0 };
+
+    if (ports && ports[0]) {
+        jack_port_get_latency_range(jack_port_by_name(client, ports[0]), mode, &range);
+    }
+    jack_free(ports);
+    return range.max;
+}
+
+static void jackClose(struct audio *a){
+    struct jack *s = a->priv;
+
+    if (!s) {
+        return;
+    }
+    if (s->client) {
+        jack_client_close(s->client);
+    }
+    free(s->inbuf);
+    free(s->outbuf);
+    free(s->scratch);
+    free(s);
+    a->priv = NULL;
+}
+
+static int jackOpen(struct audio *a, const char *device){
+    jack_options_t options = JackNoStartServer;
+    jack_status_t status;
+    char name[32];
+    struct jack *s;
+    int c;
+
+    if (!(s = calloc(1, sizeof(*s)))) {
+        return -ENOMEM;
+    }
+    a->priv = s;
+    atomic_init(&s->xruns, 0);
+
+    if (strcmp(device, "default") != 0) {
+        options |= JackServerName;
+    }
+    if (!(s->client = jack_client_open("looper", options, &status, device))) {
+        fprintf(stderr, "cannot connect to jack server %s (status 0x%x)\n", device, status);
+        goto fail;
+    }
+
+    for (c=0; c<a->channels; c++){
+        snprintf(name, sizeof(name), "in_%d", c + 1);
+        s->in[c] = jack_port_register(s->client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+        snprintf(name, sizeof(name), "out_%d", c + 1);
+        s->out[c] = jack_port_register(s->client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (!s->in[c] || !s->out[c]) {
+            fprintf(stderr, "cannot register jack ports\n");
+            goto fail;
+        }
+    }
+
+    //jack decides these, not us
+    if ((int)jack_get_buffer_size(s->client) != a->period) {
+        fprintf(stderr, "warning: jack runs a period of %u frames instead of %d\n",
+            jack_get_buffer_size(s->client), a->period);
+    }
+    a->period = jack_get_buffer_size(s->client);
+    a->rate = jack_get_sample_rate(s->client);
+
+    //the cycle that reads a period writes the one played next
+    a->latency = a->period +
+        physicalLatency(s->client, JackPortIsOutput, JackCaptureLatency) +
+        physicalLatency(s->client, JackPortIsInput, JackPlaybackLatency);
+
+    s->inbuf = calloc(DEVICE_SAMPLES(a, a->period), sizeof(sample_t));
+    s->outbuf = calloc(DEVICE_SAMPLES(a, a->period), sizeof(sample_t));
+    s->scratch = calloc(a->period, sizeof(sample_t));
+    if (!s->inbuf || !s->outbuf || !s->scratch) {
+        goto fail;
+    }
+
+    jack_set_process_callback(s->client, jackProcess, a);
+    jack_set_xrun_callback(s->client, jackXrun, a);
+    return 0;
+
+fail:
+    jackClose(a);
+    return -EIO;
+}
+
+// hooks our ports up to the first physical ones, if nobody else has
+static void connectPorts(struct jack *s, int channels){
+    const char **capture = jack_get_ports(s->client, NULL, JACK_DEFAULT_AUDIO_TYPE,
+        JackPortIsPhysical | JackPortIsOutput);
+    const char **playback = jack_get_ports(s->client, NULL, JACK_DEFAULT_AUDIO_TYPE,
+        JackPortIsPhysical | JackPortIsInput);
+    int c;
+
+    for (c=0; c<channels && capture && capture[c]; c++){
+        jack_connect(s->client, capture[c], jack_port_name(s->in[c]));
+    }
+    for (c=0; c<channels && playback && playback[c]; c++){
+        jack_connect(s->client, jack_port_name(s->out[c]), playback[c]);
+    }
+    jack_free(capture);
+    jack_free(playback);
+}
+
+static int jackStart(struct audio *a){
+    struct jack *s = a->priv;
+
+    if (jack_activate(s->client)) {
+        fprintf(stderr, "cannot activate jack client\n");
+        return -EIO;
+    }
+    connectPorts(s, a->channels);
+    return 0;
+}
+
+static void jackStop(struct audio *a){
+    struct jack *s = a->priv;
+    jack_deactivate(s->client);
+}
+
+const struct audio_backend audio_jack = {
+    .name = "jack",
+    .open = jackOpen,
+    .close = jackClose,
+    .start = jackStart,
+    .stop = jackStop,
+};
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "audio.h"
+#include "wavfile.h"
+
+// no sound card: a thread ticks through periods in real time against the
+// monotonic clock, for CI and for trying things out on a laptop. the
+// device picks what comes in:
+//   null              silence, output thrown away
+//   loop[:frames]     output comes back as input that many frames later,
+//                     at least a period, which is also the default;
+//                     something to calibrate against
+//   in.wav[,out.wav]  input from a file then silence, output optionally to
+//                     another file
+// like a card, it holds PREFILL_PERIODS of output. if the thread falls
+// further behind than that, whatever came in meanwhile is lost and it
+// reports an xrun. any of the above can end in @every:ms to stall the
+// thread for ms about every so many ms, to make that happen.
+
+// the stalls are random, but the same every run
+#define STALL_SEED 1
+
+struct null {
+    struct wavfile in;
+    struct wavfile out;
+    int has_in;
+    int has_out;
+    //loopback delay line, delay + one period of frames
+    sample_t *delay;
+    int delay_frames;
+    int delay_pos;
+    sample_t *inbuf;
+    sample_t *outbuf;
+    pthread_t thread;
+    //stalls asked for with @every:ms
+    int stall_every;
+    int stall_ms;
+    unsigned seed;
+};
+
+static void nullClose(struct audio *a){
+    struct null *s = a->priv;
+
+    if (!s) {
+        return;
+    }
+    if (s->has_in) {
+        wav_close(&s->in);
+    }
+    if (s->has_out) {
+        wav_close(&s->out);
+    }
+    free(s->delay);
+    free(s->inbuf);
+    free(s->outbuf);
+    free(s);
+    a->priv = NULL;
+}
+
+static int nullOpen(struct audio *a, const char *device){
+    struct null *s;
+    char name[512];
+    char path[512];
+    char *out;
+    char *stall;
+
+    if (!(s = calloc(1, sizeof(*s)))) {
+        return -ENOMEM;
+    }
+    a->priv = s;
+
+    snprintf(name, sizeof(name), "%s", device);
+    if ((stall = strrchr(name, '@'))) {
+        *stall++ = '\0';
+        if (sscanf(stall, "%d:%d", &s->stall_every, &s->stall_ms) != 2 ||
+                s->stall_every <= 0 || s->stall_ms < 0) {
+            goto fail;
+        }
+        s->seed = STALL_SEED;
+    }
+
+    if (strncmp(name, "loop", 4) == 0 && (name[4] == '\0' || name[4] == ':')) {
+        int delay = name[4] ? atoi(name + 5) : a->period;
+        s->delay_frames = delay + a->period;
+        if (delay < a->period || !(s->delay = calloc(DEVICE_SAMPLES(a, s->delay_frames), sizeof(sample_t)))) {
+            goto fail;
+        }
+    } else if (name[0] && strcmp(name, "null") != 0 && strcmp(name, "default") != 0) {
+        snprintf(path, sizeof(path), "%s", name);
+        if ((out = strchr(path, ','))) {
+            *out++ = '\0';
+        }
+        if (wav_open_read(&s->in, path) < 0) {
+            goto fail;
+        }
+        s->has_in = 1;
+        //the files are in the engine's own format
+        a->channels = CHANNELS;
+        if (s->in.rate) {
+            a->rate = s->in.rate;
+        }
+        if (out) {
+            if (wav_open_write(&s->out, out, a->rate) < 0) {
+                goto fail;
+            }
+            s->has_out = 1;
+        }
+    }
+
+    s->inbuf = calloc(DEVICE_SAMPLES(a, a->period), sizeof(sample_t));
+    s->outbuf = calloc(DEVICE_SAMPLES(a, a->period), sizeof(sample_t));
+    if (!s->inbuf || !s->outbuf) {
+        goto fail;
+    }
+    //nothing between output and input but the delay line
+    a->latency = s->delay_frames ? s->delay_frames - a->period : 0;
+    return 0;
+
+fail:
+    fprintf(stderr, "null: cannot open '%s'\n", device);
+    nullClose(a);
+    return -EINVAL;
+}
+
+// the input for the next period, from the file or the delay line
+static void nullInput(struct audio *a, struct null *s){
+    long got = 0;
+    int i;
+
+    if (s->has_in) {
+        got = wav_read(&s->in, s->inbuf, a->period);
+    }
+    if (s->delay) {
+        for (i=0; i<a->period; i++){
+            int at = (s->delay_pos + i) % s->delay_frames;
+            memcpy(s->inbuf + DEVICE_SAMPLES(a, i), s->delay + DEVICE_SAMPLES(a, at),
+                sizeof(sample_t) * a->channels);
+        }
+        return;
+    }
+    memset(s->inbuf + DEVICE_SAMPLES(a, got), 0,
+        sizeof(sample_t) * DEVICE_SAMPLES(a, a->period - got));
+}
+
+static void nullOutput(struct audio *a, struct null *s){
+    int i;
+
+    if (s->has_out) {
+        wav_write(&s->out, s->outbuf, a->period);
+    }
+    if (s->delay) {
+        //written a whole delay ahead of where the next read starts
+        for (i=0; i<a->period; i++){
+            int at = (s->delay_pos + i + s->delay_frames - a->period) % s->delay_frames;
+            memcpy(s->delay + DEVICE_SAMPLES(a, at), s->outbuf + DEVICE_SAMPLES(a, i),
+                sizeof(sample_t) * a->channels);
+        }
+        s->delay_pos = (s->delay_pos + a->period) % s->delay_frames;
+    }
+}
+
+// periods the device went through without the thread: input that came
+// in is gone and the output it had ran out, so silence went out
+static void nullLose(struct audio *a, struct null *s, long long periods){
+    memset(s->outbuf, 0, sizeof(sample_t) * DEVICE_SAMPLES(a, a->period));
+    for (; periods > 0; periods--){
+        if (s->has_in) {
+            wav_read(&s->in, s->inbuf, a->period);
+        }
+        nullOutput(a, s);
+    }
+}
+
+static void sleepUntil(long long ns){
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+// somewhere between half and one and a half times every ms from now
+static long long nextStall(struct null *s, long long now){
+    return now + (s->stall_every / 2 + rand_r(&s->seed) % (s->stall_every + 1)) * 1000000LL;
+}
+
+static void *nullThread(void *arg){
+    struct audio *a = arg;
+    struct null *s = a->priv;
+    long long period_ns = (long long)a->period * 1000000000LL / a->rate;
+    long long stall_at;
+    long long now;
+    long long mark;
+    long long behind;
+
+    audio_prefault_stack();
+    now = audio_now();
+    stall_at = s->stall_every ? nextStall(s, now) : -1;
+
+    while (atomic_load_explicit(&a->running, memory_order_relaxed)) {
+        //the period has come in once its last frame is due
+        now += period_ns;
+        mark = audio_now();
+        if (stall_at >= 0 && mark >= stall_at) {
+            sleepUntil(mark + s->stall_ms * 1000000LL);
+            stall_at = nextStall(s, now);
+        }
+        sleepUntil(now);
+        stats_time(&a->stats, STAT_READ_WAIT, audio_now() - mark);
+
+        //behind by more than the output held: an xrun, and the periods in
+        //between never happened as far as the engine can tell
+        behind = audio_now() - now;
+        if (behind > PREFILL_PERIODS * period_ns) {
+            nullLose(a, s, behind / period_ns);
+            now += behind / period_ns * period_ns;
+            audio_xrun(a, -EPIPE);
+        }
+
+        nullInput(a, s);
+        audio_process(a, s->inbuf, s->outbuf, a->period, now);
+        mark = audio_now();
+        nullOutput(a, s);
+        stats_time(&a->stats, STAT_WRITE_WAIT, audio_now() - mark);
+    }
+    return NULL;
+}
+
+static int nullStart(struct audio *a){
+    struct null *s = a->priv;
+    return audio_spawn(&s->thread, nullThread, a);
+}
+
+static void nullStop(struct audio *a){
+    struct null *s = a->priv;
+    pthread_join(s->thread, NULL);
+}
+
+const struct audio_backend audio_null = {
+    .name = "null",
+    .open = nullOpen,
+    .close = nullClose,
+    .start = nullStart,
+    .stop = nullStop,
+};
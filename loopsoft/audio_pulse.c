@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pulse/pulseaudio.h>
+#include "audio.h"
+
+// PulseAudio through the asynchronous API. the engine runs from the record
+// stream's read callback on pulse's mainloop thread, which raises itself
+// to real time priority on the first callback. the device is default, or
+// "source,sink" to pick both ends.
+
+struct pulse {
+    pa_threaded_mainloop *loop;
+    pa_context *context;
+    pa_stream *record;
+    pa_stream *playback;
+    pa_sample_spec spec;
+    //capture piles up here until there is a whole period of it
+    sample_t *inbuf;
+    sample_t *outbuf;
+    int fill;
+    int raised;
+    //when the last read callback returned, 0 before the first
+    long long idle_since;
+    //playback ran dry, the next write goes prefill ahead of the server
+    int realign;
+};
+
+static void contextState(pa_context *c, void *arg){
+    struct pulse *s = arg;
+    pa_threaded_mainloop_signal(s->loop, 0);
+}
+
+static void streamState(pa_stream *st, void *arg){
+    struct pulse *s = arg;
+    pa_threaded_mainloop_signal(s->loop, 0);
+}
+
+static void raisePriority(void){
+    struct sched_param param;
+    param.sched_priority = AUDIO_THREAD_PRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+        fprintf(stderr, "warning: cannot use real time scheduling for audio\n");
+    }
+}
+
+// both run on the mainloop thread, like the read callback
+static void underflow(pa_stream *st, void *arg){
+    struct audio *a = arg;
+    struct pulse *s = a->priv;
+
+    s->realign = 1;
+    audio_xrun(a, -EPIPE);
+}
+
+static void overflow(pa_stream *st, void *arg){
+    audio_xrun(arg, -EOVERFLOW);
+}
+
+static void readCallback(pa_stream *st, size_t bytes, void *arg){
+    struct audio *a = arg;
+    struct pulse *s = a->priv;
+    size_t frame = sizeof(sample_t) * a->channels;
+    const void *data;
+    long long wrote;
+
+    if (!s->raised) {
+        audio_prefault_stack();
+        raisePriority();
+        s->raised = 1;
+    }
+    //the mainloop waits on the server in between, so the time since the
+    //last callback is the read wait
+    if (s->idle_since) {
+        stats_time(&a->stats, STAT_READ_WAIT, audio_now() - s->idle_since);
+    }
+
+    while (pa_stream_readable_size(st) > 0) {
+        size_t off = 0;
+
+        if (pa_stream_peek(st, &data, &bytes) < 0 || !bytes) {
+            break;
+        }
+        while (off < bytes) {
+            int n = a->period - s->fill;
+            if ((size_t)n * frame > bytes - off) {
+                n = (bytes - off) / frame;
+            }
+            //a hole in the stream reads as silence
+            if (data) {
+                memcpy(s->inbuf + DEVICE_SAMPLES(a, s->fill), (const char *)data + off, n * frame);
+            } else {
+                memset(s->inbuf + DEVICE_SAMPLES(a, s->fill), 0, n * frame);
+                stats_count(&a->stats, STAT_SHORT_READS, 1);
+            }
+            s->fill += n;
+            off += n * frame;
+
+            if (s->fill == a->period) {
+                s->fill = 0;
+                if (atomic_load_explicit(&a->running, memory_order_relaxed)) {
+                    audio_process(a, s->inbuf, s->outbuf, a->period, audio_now());
+                    wrote = audio_now();
+                    if (s->realign) {
+                        //the server kept playing silence through the gap,
+                        //so counting on from the read index puts output
+                        //back where it was against the input
+                        pa_stream_write(s->playback, s->outbuf, a->period * frame, NULL,
+                            (int64_t)PREFILL_PERIODS * a->period * frame,
+                            PA_SEEK_RELATIVE_ON_READ);
+                        s->realign = 0;
+                    } else {
+                        pa_stream_write(s->playback, s->outbuf, a->period * frame,
+                            NULL, 0, PA_SEEK_RELATIVE);
+                    }
+                    stats_time(&a->stats, STAT_WRITE_WAIT, audio_now() - wrote);
+                }
+            }
+            if (!n) {
+                break;
+            }
+        }
+        pa_stream_drop(st);
+    }
+    s->idle_since = audio_now();
+}
+
+// waits on the mainloop until the stream is ready or has failed
+static int waitStream(struct pulse *s, pa_stream *st){
+    pa_stream_state_t state;
+
+    while ((state = pa_stream_get_state(st)) != PA_STREAM_READY) {
+        if (!PA_STREAM_IS_GOOD(state)) {
+            fprintf(stderr, "pulse stream failed (%s)\n",
+                pa_strerror(pa_context_errno(s->context)));
+            return -EIO;
+        }
+        pa_threaded_mainloop_wait(s->loop);
+    }
+    return 0;
+}
+
+static void pulseClose(struct audio *a){
+    struct pulse *s = a->priv;
+
+    if (!s) {
+        return;
+    }
+    if (s->loop) {
+        pa_threaded_mainloop_stop(s->loop);
+    }
+    if (s->record) {
+        pa_stream_disconnect(s->record);
+        pa_stream_unref(s->record);
+    }
+    if (s->playback) {
+        pa_stream_disconnect(s->playback);
+        pa_stream_unref(s->playback);
+    }
+    if (s->context) {
+        pa_context_disconnect(s->context);
+        pa_context_unref(s->context);
+    }
+    if (s->loop) {
+        pa_threaded_mainloop_free(s->loop);
+    }
+    free(s->inbuf);
+    free(s->outbuf);
+    free(s);
+    a->priv = NULL;
+}
+
+static int pulseOpen(struct audio *a, const char *device){
+    pa_stream_flags_t flags = PA_STREAM_START_CORKED | PA_STREAM_ADJUST_LATENCY;
+    pa_context_state_t state;
+    pa_buffer_attr attr;
+    char names[256];
+    const char *source = NULL;
+    const char *sink = NULL;
+    size_t period_bytes;
+    struct pulse *s;
+    int err = -EIO;
+
+    if (!(s = calloc(1, sizeof(*s)))) {
+        return -ENOMEM;
+    }
+    a->priv = s;
+
+    if (strcmp(device, "default") != 0) {
+        char *comma;
+        snprintf(names, sizeof(names), "%s", device);
+        if (!(comma = strchr(names, ','))) {
+            fprintf(stderr, "pulse: device is default or source,sink\n");
+            goto fail;
+        }
+        *comma = '\0';
+        source = names;
+        sink = comma + 1;
+    }
+
+    s->spec.format = PA_SAMPLE_S16LE;
+    s->spec.rate = a->rate;
+    s->spec.channels = a->channels;
+    period_bytes = sizeof(sample_t) * DEVICE_SAMPLES(a, a->period);
+
+    s->inbuf = calloc(DEVICE_SAMPLES(a, a->period), sizeof(sample_t));
+    s->outbuf = calloc(DEVICE_SAMPLES(a, a->period), sizeof(sample_t));
+    if (!s->inbuf || !s->outbuf ||
+        !(s->loop = pa_threaded_mainloop_new()) ||
+        !(s->context = pa_context_new(pa_threaded_mainloop_get_api(s->loop), "looper"))) {
+        err = -ENOMEM;
+        goto fail;
+    }
+
+    pa_context_set_state_callback(s->context, contextState, s);
+    if (pa_context_connect(s->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0 ||
+        pa_threaded_mainloop_start(s->loop) < 0) {
+        fprintf(stderr, "cannot connect to pulse (%s)\n",
+            pa_strerror(pa_context_errno(s->context)));
+        goto fail;
+    }
+
+    pa_threaded_mainloop_lock(s->loop);
+    while ((state = pa_context_get_state(s->context)) != PA_CONTEXT_READY) {
+        if (!PA_CONTEXT_IS_GOOD(state)) {
+            fprintf(stderr, "cannot connect to pulse (%s)\n",
+                pa_strerror(pa_context_errno(s->context)));
+            pa_threaded_mainloop_unlock(s->loop);
+            goto fail;
+        }
+        pa_threaded_mainloop_wait(s->loop);
+    }
+
+    //ask for a period per fragment and as little queued as prefill needs
+    attr.maxlength = (uint32_t)-1;
+    attr.fragsize = period_bytes;
+    attr.tlength = period_bytes * (PREFILL_PERIODS + 1);
+    //never stop for an underrun and wait to fill up again, that would
+    //leave playback later against capture than it started
+    attr.prebuf = 0;
+    attr.minreq = period_bytes;
+
+    s->record = pa_stream_new(s->context, "looper in", &s->spec, NULL);
+    s->playback = pa_stream_new(s->context, "looper out", &s->spec, NULL);
+    if (!s->record || !s->playback) {
+        pa_threaded_mainloop_unlock(s->loop);
+        goto fail;
+    }
+    pa_stream_set_state_callback(s->record, streamState, s);
+    pa_stream_set_state_callback(s->playback, streamState, s);
+    pa_stream_set_read_callback(s->record, readCallback, a);
+    pa_stream_set_underflow_callback(s->playback, underflow, a);
+    pa_stream_set_overflow_callback(s->record, overflow, a);
+
+    if (pa_stream_connect_record(s->record, source, &attr, flags) < 0 ||
+        pa_stream_connect_playback(s->playback, sink, &attr, flags, NULL, NULL) < 0 ||
+        waitStream(s, s->record) < 0 ||
+        waitStream(s, s->playback) < 0) {
+        pa_threaded_mainloop_unlock(s->loop);
+        goto fail;
+    }
+
+    //the server may round the buffers, go by what it settled on
+    attr = *pa_stream_get_buffer_attr(s->playback);
+    a->latency = (attr.tlength + pa_stream_get_buffer_attr(s->record)->fragsize) /
+        (sizeof(sample_t) * a->channels) +
+        (int)((long long)ADDTL_LATENCY_USEC * a->rate / 1000000);
+    pa_threaded_mainloop_unlock(s->loop);
+    return 0;
+
+fail:
+    pulseClose(a);
+    return err;
+}
+
+static void cork(struct pulse *s, int corked){
+    pa_operation *op;
+
+    if ((op = pa_stream_cork(s->record, corked, NULL, NULL))) {
+        pa_operation_unref(op);
+    }
+    if ((op = pa_stream_cork(s->playback, corked, NULL, NULL))) {
+        pa_operation_unref(op);
+    }
+}
+
+static int pulseStart(struct audio *a){
+    struct pulse *s = a->priv;
+    size_t bytes = sizeof(sample_t) * DEVICE_SAMPLES(a, a->period);
+    pa_operation *op;
+    int i;
+
+    pa_threaded_mainloop_lock(s->loop);
+    s->fill = 0;
+    s->idle_since = 0;
+    s->realign = 0;
+    if ((op = pa_stream_flush(s->record, NULL, NULL))) {
+        pa_operation_unref(op);
+    }
+    memset(s->outbuf, 0, bytes);
+    for (i=0; i<PREFILL_PERIODS; i++){
+        pa_stream_write(s->playback, s->outbuf, bytes, NULL, 0, PA_SEEK_RELATIVE);
+    }
+    cork(s, 0);
+    pa_threaded_mainloop_unlock(s->loop);
+    return 0;
+}
+
+static void pulseStop(struct audio *a){
+    struct pulse *s = a->priv;
+    pa_operation *op;
+
+    pa_threaded_mainloop_lock(s->loop);
+    cork(s, 1);
+    if ((op = pa_stream_flush(s->playback, NULL, NULL))) {
+        pa_operation_unref(op);
+    }
+    pa_threaded_mainloop_unlock(s->loop);
+}
+
+const struct audio_backend audio_pulse = {
+    .name = "pulse",
+    .open = pulseOpen,
+    .close = pulseClose,
+    .start = pulseStart,
+    .stop = pulseStop,
+};
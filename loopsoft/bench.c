@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "engine.h"
+#include "mix.h"
+
+// times engine_process per period for increasing track counts, with every
+// track overdubbing, then with every track just playing back, and then
+// playing back packed, first all on one core and then with the tracks
+// mixed in groups on up to MAX_CORES.
+
+#define LOOP_SECONDS 2
+#define MEASURE_LOOPS 3
+#define MAX_CORES 4
+// longest to wait for every track to be packed
+#define PACK_LOOPS 20
+
+static const int track_counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+
+static long long nowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compareLong(const void *a, const void *b){
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void fillNoise(sample_t *buf, unsigned int *seed){
+    int i;
+    for (i=0; i<PERIOD_SAMPLES; i++){
+        *seed = *seed * 1103515245 + 12345;
+        buf[i] = (sample_t)(*seed >> 16) >> 2;
+    }
+}
+
+// sends a command, running silent periods until the ring has room
+static void send(struct engine *e, int type, int track, int value){
+    sample_t silence[PERIOD_SAMPLES] = { 0 };
+    sample_t out[PERIOD_SAMPLES];
+
+    while (!engine_send(e, type, track, value)) {
+        engine_process(e, silence, out);
+    }
+}
+
+static void report(int tracks, int cores, const char *mode, long long *times, int periods){
+    long long total = 0;
+    int i;
+
+    for (i=0; i<periods; i++){
+        total += times[i];
+    }
+    qsort(times, periods, sizeof(long long), compareLong);
+
+    double secs = total / 1e9;
+    double frames = (double)periods * FRAMESIZE;
+    printf("%6d %5d  %-8s %12.0f %10.1f %8.2f %8.2f %8.2f %8.2f\n",
+        tracks, cores, mode,
+        frames * CHANNELS / secs,
+        frames / SAMPLE_HZ / secs,
+        times[periods / 2] / 1000.0,
+        times[(int)(periods * 0.99)] / 1000.0,
+        times[(int)(periods * 0.999)] / 1000.0,
+        times[periods - 1] / 1000.0);
+}
+
+static void run(int tracks, int cores){
+    struct engine e;
+    struct engine_note note;
+    sample_t in[PERIOD_SAMPLES];
+    sample_t out[PERIOD_SAMPLES];
+    unsigned int seed = 1;
+    int looplen = LOOP_SECONDS * SAMPLE_HZ / FRAMESIZE;
+    int periods = looplen * MEASURE_LOOPS;
+    long long *times = malloc(sizeof(long long) * periods);
+    int packed;
+    int x;
+    int i;
+
+    if (engine_init(&e, tracks, 0, 0) < 0 || engine_start_workers(&e, cores - 1, 0) < 0) {
+        exit(1);
+    }
+
+    //initial recording on every track in use
+    for (x=0; x<tracks; x++){
+        send(&e, CMD_RECORD, x, 1);
+    }
+    for (i=0; i<looplen; i++){
+        fillNoise(in, &seed);
+        engine_process(&e, in, out);
+        engine_service(&e);
+    }
+    for (x=0; x<tracks; x++){
+        send(&e, CMD_RECORD, x, 0);
+    }
+    for (x=0; x<tracks; x++){
+        send(&e, CMD_RECORD, x, 1);
+    }
+
+    //every track overdubbing
+    for (i=0; i<periods; i++){
+        long long t;
+        fillNoise(in, &seed);
+        t = nowNs();
+        engine_process(&e, in, out);
+        times[i] = nowNs() - t;
+        engine_service(&e);
+    }
+    report(tracks, cores, "overdub", times, periods);
+
+    for (x=0; x<tracks; x++){
+        send(&e, CMD_RECORD, x, 0);
+    }
+
+    //playback only
+    for (i=0; i<periods; i++){
+        long long t;
+        fillNoise(in, &seed);
+        t = nowNs();
+        engine_process(&e, in, out);
+        times[i] = nowNs() - t;
+        engine_service(&e);
+    }
+    report(tracks, cores, "play", times, periods);
+
+    //packing is the control side's and isn't timed. the noise is the
+    //hardest there is to decode, if it packs at all.
+    e.pack_idle = FRAMESIZE;
+    for (i=0, packed=0; packed < tracks && i < PACK_LOOPS * looplen; i++){
+        fillNoise(in, &seed);
+        engine_process(&e, in, out);
+        engine_service(&e);
+        while (engine_poll(&e, &note)) {
+            packed += note.type == NOTE_PACKED;
+        }
+    }
+    if (packed == tracks) {
+        for (i=0; i<periods; i++){
+            long long t;
+            fillNoise(in, &seed);
+            t = nowNs();
+            engine_process(&e, in, out);
+            times[i] = nowNs() - t;
+            engine_service(&e);
+        }
+        report(tracks, cores, "packed", times, periods);
+    }
+
+    while (engine_poll(&e, &note)) {
+    }
+    engine_free(&e);
+    free(times);
+}
+
+int main(int argc, char *argv[]){
+    int cores;
+    int i;
+
+    mix_init();
+    if (argc > 1 && mix_select(argv[1]) < 0) {
+        fprintf(stderr, "mixer '%s' is not available here\n", argv[1]);
+        return 1;
+    }
+
+    printf("%s mixer, %d frame periods, %d Hz, %d s loops\n",
+        mix_kernel_name(), FRAMESIZE, SAMPLE_HZ, LOOP_SECONDS);
+    printf("%6s %5s  %-8s %12s %10s %8s %8s %8s %8s\n",
+        "tracks", "cores", "mode", "samples/s", "x realtime", "p50 us", "p99 us", "p99.9 us", "max us");
+
+    for (cores=1; cores<=MAX_CORES; cores++){
+        for (i=0; i<(int)(sizeof(track_counts) / sizeof(track_counts[0])); i++){
+            //a group needs at least a track
+            if (track_counts[i] <= MAX_TRACKS && track_counts[i] >= cores) {
+                run(track_counts[i], cores);
+            }
+        }
+    }
+    return 0;
+}
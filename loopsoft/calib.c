@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <complex.h>
+#include "calib.h"
+
+#define CALIB_FILE ".looper_latency"
+
+int calib_mls(sample_t *out, int frames, int amplitude){
+    //15 bit fibonacci lfsr on x^15 + x^14 + 1, which is maximal
+    unsigned lfsr = 1;
+    int len = (1 << CALIB_ORDER) - 1;
+    int i;
+    int c;
+
+    for (i=0; i<frames; i++){
+        sample_t v = 0;
+        if (i < len) {
+            unsigned bit = (lfsr ^ (lfsr >> 1)) & 1;
+            v = (lfsr & 1) ? amplitude : -amplitude;
+            lfsr = (lfsr >> 1) | (bit << (CALIB_ORDER - 1));
+        }
+        for (c=0; c<CHANNELS; c++){
+            *out++ = v;
+        }
+    }
+    return len;
+}
+
+// in place radix 2, n a power of two
+static void fft(double complex *x, int n, int inverse){
+    int i, j, len;
+
+    for (i=1, j=0; i<n; i++){
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1){
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double complex t = x[i];
+            x[i] = x[j];
+            x[j] = t;
+        }
+    }
+
+    for (len=2; len<=n; len<<=1){
+        double a = (inverse ? 2 : -2) * M_PI / len;
+        double complex w = cos(a) + I * sin(a);
+        for (i=0; i<n; i+=len){
+            double complex wk = 1;
+            for (j=0; j<len/2; j++){
+                double complex u = x[i+j];
+                double complex v = x[i+j+len/2] * wk;
+                x[i+j] = u + v;
+                x[i+j+len/2] = u - v;
+                wk *= w;
+            }
+        }
+    }
+}
+
+// channels summed down to mono, zero padded to n
+static void toMono(double complex *dst, const sample_t *src, int frames, int n){
+    int i;
+    int c;
+
+    for (i=0; i<frames; i++){
+        double sum = 0;
+        for (c=0; c<CHANNELS; c++){
+            sum += src[i * CHANNELS + c];
+        }
+        dst[i] = sum;
+    }
+    for (; i<n; i++){
+        dst[i] = 0;
+    }
+}
+
+int calib_lag(const sample_t *sent, int nsent,
+                const sample_t *got, int ngot,
+                int maxlag, double *quality){
+    double complex *a, *b;
+    double peak = 0;
+    double energy = 0;
+    int lag = -1;
+    int n = 1;
+    int i;
+
+    while (n < nsent + ngot) {
+        n <<= 1;
+    }
+    if (maxlag >= ngot) {
+        maxlag = ngot - 1;
+    }
+
+    a = malloc(sizeof(*a) * n);
+    b = malloc(sizeof(*b) * n);
+    if (!a || !b) {
+        free(a);
+        free(b);
+        return -ENOMEM;
+    }
+
+    //correlation through the frequency domain, r[k] = sum got[m+k] sent[m]
+    toMono(a, got, ngot, n);
+    toMono(b, sent, nsent, n);
+    fft(a, n, 0);
+    fft(b, n, 0);
+    for (i=0; i<n; i++){
+        a[i] *= conj(b[i]);
+    }
+    fft(a, n, 1);
+
+    //the loop may well invert polarity, so go by magnitude
+    for (i=0; i<=maxlag; i++){
+        double r = fabs(creal(a[i]));
+        energy += r * r;
+        if (r > peak) {
+            peak = r;
+            lag = i;
+        }
+    }
+    free(a);
+    free(b);
+
+    *quality = energy > 0 ? peak / sqrt(energy / (maxlag + 1)) : 0;
+    return *quality < CALIB_MIN_QUALITY ? -1 : lag;
+}
+
+static int calibPath(char *path, size_t size){
+    const char *home = getenv("HOME");
+    if (!home) {
+        return -1;
+    }
+    return snprintf(path, size, "%s/" CALIB_FILE, home) < (int)size ? 0 : -1;
+}
+
+int calib_load(const char *device, unsigned rate){
+    char path[512];
+    char line[512];
+    char name[256];
+    unsigned r;
+    int latency;
+    int found = -1;
+    FILE *f;
+
+    if (calibPath(path, sizeof(path)) < 0 || !(f = fopen(path, "r"))) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%255s %u %d", name, &r, &latency) == 3 &&
+                strcmp(name, device) == 0 && r == rate) {
+            found = latency;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// rewrites the file with this device's line replaced
+int calib_save(const char *device, unsigned rate, int latency){
+    char path[512];
+    char tmp[520];
+    char line[512];
+    char name[256];
+    unsigned r;
+    FILE *in;
+    FILE *out;
+
+    if (calibPath(path, sizeof(path)) < 0) {
+        fprintf(stderr, "cannot store calibration, HOME is not set\n");
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(out = fopen(tmp, "w"))) {
+        perror(tmp);
+        return -1;
+    }
+    if ((in = fopen(path, "r"))) {
+        while (fgets(line, sizeof(line), in)) {
+            if (sscanf(line, "%255s %u", name, &r) == 2 &&
+                    strcmp(name, device) == 0 && r == rate) {
+                continue;
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s %u %d\n", device, rate, latency);
+    if (fclose(out) != 0 || rename(tmp, path) < 0) {
+        perror(path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef CALIB_H
+#define CALIB_H
+
+#include "sample.h"
+
+// round trip latency calibration. a maximum length sequence is played out,
+// captured back through a loopback cable (or speaker and mic), and
+// cross-correlated against what was sent; the peak is the round trip in
+// frames.
+
+// the test signal is 2^CALIB_ORDER - 1 frames long, about 0.74 s at 44.1k
+#define CALIB_ORDER 15
+// how long after the sequence ends to keep capturing, bounds the latency
+// that can be measured
+#define CALIB_TAIL_FRAMES 44100
+// peak over rms of the correlation below which the capture is taken to be
+// noise, e.g. nothing plugged in
+#define CALIB_MIN_QUALITY 8.0
+
+// fills frames of interleaved output with the sequence, +-amplitude on
+// every channel, returns the sequence length
+int calib_mls(sample_t *out, int frames, int amplitude);
+
+// finds how many frames late sent shows up in got, both interleaved, up
+// to maxlag. quality is set to the peak over the rms of the correlation.
+// returns -1 if the peak is too weak to trust.
+int calib_lag(const sample_t *sent, int nsent,
+                const sample_t *got, int ngot,
+                int maxlag, double *quality);
+
+// stored results, one per device and rate, in $HOME/.looper_latency.
+// calib_load returns -1 if the device was never calibrated.
+int calib_load(const char *device, unsigned rate);
+int calib_save(const char *device, unsigned rate, int latency);
+
+#endif
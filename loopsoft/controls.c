@@ -0,0 +1,583 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include "controls.h"
+
+#define EVENT_RING_SIZE 256
+// evdev nodes looked through for a joystick
+#define JOY_SCAN 32
+// pedals pull their line low when pressed
+#define GPIO_PRESSED 0
+
+static const char *const source_names[] = { "gpio", "joy", "key", "uno" };
+static const char *const action_names[] = { "record", "reset", "undo", "redo", "shorter", "longer",
+    "quit" };
+#define NACTIONS (int)(sizeof(action_names) / sizeof(action_names[0]))
+
+static int lookup(const char *const *names, int n, const char *name){
+    int i;
+    for (i=0; i<n; i++){
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// actions that belong to a channel
+static int channelAction(int action){
+    return action != ACTION_QUIT;
+}
+
+void controls_map_init(struct control_map *m){
+    m->nbindings = 0;
+}
+
+int controls_bind(struct control_map *m, int source, int button, int action,
+                int channel, int flags){
+    struct control_binding *b;
+
+    if (source < 0 || source >= CONTROL_SOURCES || action < 0 || action >= NACTIONS ||
+            channel < 0 || channel >= MAX_TRACKS || button < 0) {
+        return -EINVAL;
+    }
+    if (m->nbindings == CONTROL_MAX_BINDINGS) {
+        return -ENOSPC;
+    }
+    b = &m->bindings[m->nbindings++];
+    memset(b, 0, sizeof(*b));
+    b->source = source;
+    b->button = button;
+    b->action = action;
+    b->channel = channel;
+    b->flags = flags;
+    return 0;
+}
+
+int controls_map_load(struct control_map *m, const char *path){
+    char line[256];
+    char source[16];
+    char button[16];
+    char action[16];
+    char toggle[16];
+    FILE *f;
+    int lineno = 0;
+    int err = 0;
+
+    if (!(f = fopen(path, "r"))) {
+        fprintf(stderr, "cannot open %s (%s)\n", path, strerror(errno));
+        return -errno;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        int channel = 0;
+        int s, a, b, n;
+        char *end;
+
+        lineno++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') {
+            continue;
+        }
+        n = sscanf(line, "%15s %15s %15s %d %15s", source, button, action, &channel, toggle);
+        s = lookup(source_names, CONTROL_SOURCES, source);
+        a = lookup(action_names, NACTIONS, action);
+        if (n < 3 || s < 0 || a < 0 || (n == 5 && strcmp(toggle, "toggle") != 0) ||
+                (n == 3 && channelAction(a))) {
+            fprintf(stderr, "%s:%d: expected <gpio|joy|key|uno> <button> "
+                "<record|reset|undo|redo|shorter|longer|quit> [channel] [toggle]\n", path, lineno);
+            err = -EINVAL;
+            break;
+        }
+        if (s == CONTROL_KEYBOARD) {
+            b = button[1] ? -1 : (unsigned char)button[0];
+        } else {
+            b = strtol(button, &end, 0);
+            if (*end) {
+                b = -1;
+            }
+        }
+        if ((err = controls_bind(m, s, b, a, channel, n == 5 ? CONTROL_TOGGLE : 0)) < 0) {
+            fprintf(stderr, "%s:%d: can't bind that (%s)\n", path, lineno, strerror(-err));
+            break;
+        }
+    }
+    fclose(f);
+    return err;
+}
+
+/* joystick */
+
+static int testBit(const unsigned long *bits, int bit){
+    return (bits[bit / (8 * sizeof(long))] >> (bit % (8 * sizeof(long)))) & 1;
+}
+
+static int keyBits(int fd, unsigned long *bits, size_t size){
+    memset(bits, 0, size);
+    return ioctl(fd, EVIOCGBIT(EV_KEY, size), bits) < 0 ? -errno : 0;
+}
+
+// the first evdev node with joystick or gamepad buttons
+static int findJoystick(void){
+    unsigned long keys[CONTROL_JOY_CODES / (8 * sizeof(long))];
+    char path[32];
+    int fd;
+    int i;
+
+    for (i=0; i<JOY_SCAN; i++){
+        snprintf(path, sizeof(path), "/dev/input/event%d", i);
+        if ((fd = open(path, O_RDONLY | O_NONBLOCK)) < 0) {
+            continue;
+        }
+        if (keyBits(fd, keys, sizeof(keys)) == 0 &&
+                (testBit(keys, BTN_JOYSTICK) || testBit(keys, BTN_GAMEPAD))) {
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static void openJoystick(struct controls *c, const char *path){
+    unsigned long keys[CONTROL_JOY_CODES / (8 * sizeof(long))];
+    int clock = CLOCK_MONOTONIC;
+    char name[64] = "";
+    int n = 0;
+    int i;
+
+    if (path) {
+        if ((c->joy_fd = open(path, O_RDONLY | O_NONBLOCK)) < 0) {
+            fprintf(stderr, "warning: cannot open joystick %s (%s)\n", path, strerror(errno));
+            return;
+        }
+    } else if ((c->joy_fd = findJoystick()) < 0) {
+        printf("no joystick found\n");
+        return;
+    }
+
+    //stamped on the clock engine_frame_at goes by
+    if (ioctl(c->joy_fd, EVIOCSCLOCKID, &clock) < 0) {
+        fprintf(stderr, "warning: joystick events are stamped on the wrong clock\n");
+    }
+    //buttons are numbered in key code order
+    keyBits(c->joy_fd, keys, sizeof(keys));
+    for (i=0; i<CONTROL_JOY_CODES; i++){
+        c->joy_button[i] = i >= BTN_MISC && testBit(keys, i) ? n++ : -1;
+    }
+    ioctl(c->joy_fd, EVIOCGNAME(sizeof(name)), name);
+    printf("using joystick '%s', %d buttons\n", name, n);
+}
+
+/* the joystick, UnoJoy and keyboard reader */
+
+static void push(struct controls *c, int source, int button, int value, long long when){
+    struct control_event ev;
+
+    ev.source = source;
+    ev.button = button;
+    ev.value = value;
+    ev.when = when;
+    ring_push(&c->events, &ev);
+}
+
+static void readJoystick(struct controls *c){
+    struct input_event evs[16];
+    ssize_t n = read(c->joy_fd, evs, sizeof(evs));
+    int i;
+
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            fprintf(stderr, "joystick went away (%s)\n", strerror(errno));
+            close(c->joy_fd);
+            c->joy_fd = -1;
+        }
+        return;
+    }
+    for (i=0; i<n / (int)sizeof(evs[0]); i++){
+        const struct input_event *ev = &evs[i];
+        //2 is autorepeat
+        if (ev->type != EV_KEY || ev->code >= CONTROL_JOY_CODES ||
+                c->joy_button[ev->code] < 0 || ev->value > 1) {
+            continue;
+        }
+        push(c, CONTROL_JOYSTICK, c->joy_button[ev->code], ev->value,
+            ev->input_event_sec * 1000000000LL + ev->input_event_usec * 1000LL);
+    }
+}
+
+// a terminal only has presses, so every key comes back up straight away
+static void readKeys(struct controls *c){
+    unsigned char buf[16];
+    ssize_t n = read(c->key_fd, buf, sizeof(buf));
+    long long now = gpio_now();
+    int i;
+
+    //stdin closed, or not a terminal at all
+    if (n <= 0) {
+        if (!n || (errno != EAGAIN && errno != EINTR)) {
+            c->key_fd = -1;
+        }
+        return;
+    }
+    for (i=0; i<n; i++){
+        push(c, CONTROL_KEYBOARD, buf[i], 1, now);
+        push(c, CONTROL_KEYBOARD, buf[i], 0, now);
+    }
+}
+
+static void unojoyEdge(void *arg, int button, int value, long long when){
+    push(arg, CONTROL_UNOJOY, button, value, when);
+}
+
+static void readUnojoy(struct controls *c){
+    int err = unojoy_read(&c->uno, unojoyEdge, c);
+
+    if (err < 0) {
+        fprintf(stderr, "UnoJoy went away (%s)\n", strerror(-err));
+        unojoy_close(&c->uno);
+        c->has_uno = 0;
+    }
+}
+
+static void *readerThread(void *arg){
+    struct controls *c = arg;
+    struct pollfd fds[4];
+    struct timespec wait;
+    char byte;
+
+    while (atomic_load(&c->running)) {
+        long long deadline = -1;
+        int n = 1;
+        int joy = -1;
+        int key = -1;
+        int uno = -1;
+
+        fds[0].fd = c->wake[0];
+        fds[0].events = POLLIN;
+        if (c->joy_fd >= 0) {
+            joy = n++;
+            fds[joy].fd = c->joy_fd;
+            fds[joy].events = POLLIN;
+        }
+        if (c->key_fd >= 0) {
+            key = n++;
+            fds[key].fd = c->key_fd;
+            fds[key].events = POLLIN;
+        }
+        //a polled board also wakes us when its next request is due
+        if (c->has_uno) {
+            uno = n++;
+            fds[uno].fd = c->uno.fd;
+            fds[uno].events = POLLIN;
+            if ((deadline = unojoy_deadline(&c->uno)) >= 0) {
+                deadline -= gpio_now();
+                if (deadline < 0) {
+                    deadline = 0;
+                }
+                wait.tv_sec = deadline / 1000000000LL;
+                wait.tv_nsec = deadline % 1000000000LL;
+            }
+        }
+
+        if (ppoll(fds, n, deadline >= 0 ? &wait : NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "controls: poll failed (%s)\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (read(c->wake[0], &byte, 1) < 0) {
+                break;
+            }
+            continue;
+        }
+        if (joy >= 0 && fds[joy].revents) {
+            readJoystick(c);
+        }
+        if (key >= 0 && fds[key].revents) {
+            readKeys(c);
+        }
+        if (uno >= 0 && fds[uno].revents) {
+            readUnojoy(c);
+        }
+        if (c->has_uno && unojoy_send(&c->uno, gpio_now()) < 0) {
+            readUnojoy(c);
+        }
+    }
+    return NULL;
+}
+
+/* the map */
+
+// the next length along from the one track x has, as a CMD_LENGTH ratio,
+// or 0 past the end. before the loop closes every track is the loop.
+static int stepLength(struct engine *e, int x, int longer){
+    int looplen = atomic_load_explicit(&e->closed_len, memory_order_acquire);
+    int len = engine_track_length(e, x);
+    int ratio = !looplen ? 1 : len >= looplen ? len / looplen : -(looplen / len);
+
+    if (longer) {
+        ratio = ratio == -2 ? 1 : ratio + 1;
+    } else {
+        ratio = ratio == 1 ? -2 : ratio - 1;
+    }
+    return ratio > TRACK_MAX_RATIO || ratio < -TRACK_MAX_RATIO ? 0 : ratio;
+}
+
+// a button went down or up, and every binding on it follows. returns 1 if
+// it was quit.
+static int apply(struct controls *c, struct engine *e, const struct control_event *ev){
+    int quit = 0;
+    int ratio;
+    int i;
+
+    for (i=0; i<c->map.nbindings; i++){
+        struct control_binding *b = &c->map.bindings[i];
+
+        if (b->source != ev->source || b->button != ev->button) {
+            continue;
+        }
+        if (b->flags & CONTROL_TOGGLE) {
+            if (!ev->value) {
+                continue;
+            }
+            b->held = !b->held;
+        } else {
+            b->held = ev->value;
+        }
+        b->when = ev->when;
+        if (!ev->value) {
+            continue;
+        }
+        switch (b->action) {
+        case ACTION_UNDO:
+            engine_send(e, CMD_UNDO, b->channel, 0);
+            break;
+        case ACTION_REDO:
+            engine_send(e, CMD_REDO, b->channel, 0);
+            break;
+        case ACTION_SHORTER:
+        case ACTION_LONGER:
+            ratio = stepLength(e, b->channel, b->action == ACTION_LONGER);
+            if (ratio) {
+                engine_send(e, CMD_LENGTH, b->channel, ratio);
+            }
+            break;
+        case ACTION_QUIT:
+            quit = 1;
+            break;
+        }
+    }
+    return quit;
+}
+
+// what the bindings say each channel should be doing, passed on where
+// it changed
+static void sendChannels(struct controls *c, struct engine *e){
+    short record[MAX_TRACKS] = { 0 };
+    short reset[MAX_TRACKS] = { 0 };
+    long long when[MAX_TRACKS] = { 0 };
+    int i;
+
+    for (i=0; i<c->map.nbindings; i++){
+        const struct control_binding *b = &c->map.bindings[i];
+
+        if (b->action != ACTION_RECORD && b->action != ACTION_RESET) {
+            continue;
+        }
+        if (b->held) {
+            if (b->action == ACTION_RECORD) {
+                record[b->channel] = 1;
+            } else {
+                reset[b->channel] = 1;
+            }
+        }
+        if (b->when > when[b->channel]) {
+            when[b->channel] = b->when;
+        }
+    }
+
+    for (i=0; i<c->channels; i++){
+        short recording = record[i] && !reset[i];
+
+        //recording changes on the sample the last button moved. if the
+        //command ring is full the change is picked up next time.
+        if (recording != c->recording[i] &&
+                engine_send_at(e, CMD_RECORD, i, recording,
+                    when[i] ? engine_frame_at(e, when[i]) : -1)) {
+            c->recording[i] = recording;
+        }
+        if (reset[i] != c->reset[i] &&
+                engine_send(e, CMD_RESET, i, reset[i])) {
+            c->reset[i] = reset[i];
+        }
+    }
+}
+
+int controls_dispatch(struct controls *c, struct engine *e){
+    struct control_event ev;
+    struct gpio_event edge;
+    int quit = 0;
+
+    while (c->has_gpio && gpio_poll(&c->gpio, &edge)) {
+        ev.source = CONTROL_GPIO;
+        ev.button = c->gpio_line[edge.pin];
+        ev.value = edge.value == GPIO_PRESSED;
+        ev.when = edge.when;
+        quit |= apply(c, e, &ev);
+    }
+    while (ring_pop(&c->events, &ev)) {
+        quit |= apply(c, e, &ev);
+    }
+    sendChannels(c, e);
+    return quit;
+}
+
+/* setup */
+
+// every line the map uses, once, and where each pedal is to begin with
+static int openPedals(struct controls *c, const struct gpio_backend *backend, const char *chip){
+    int npins = 0;
+    int err;
+    int i, j;
+
+    for (i=0; i<c->map.nbindings; i++){
+        const struct control_binding *b = &c->map.bindings[i];
+        if (b->source != CONTROL_GPIO) {
+            continue;
+        }
+        for (j=0; j<npins && c->gpio_line[j] != b->button; j++);
+        if (j < npins) {
+            continue;
+        }
+        if (npins == GPIO_MAX_PINS) {
+            fprintf(stderr, "can't watch more than %d gpio lines\n", GPIO_MAX_PINS);
+            return -EINVAL;
+        }
+        c->gpio_line[npins++] = b->button;
+    }
+    if (!npins) {
+        return 0;
+    }
+
+    if ((err = gpio_open(&c->gpio, backend, chip, c->gpio_line, npins)) < 0) {
+        return err;
+    }
+    c->has_gpio = 1;
+    for (i=0; i<c->map.nbindings; i++){
+        struct control_binding *b = &c->map.bindings[i];
+        if (b->source != CONTROL_GPIO || (b->flags & CONTROL_TOGGLE)) {
+            continue;
+        }
+        for (j=0; c->gpio_line[j] != b->button; j++);
+        b->held = gpio_level(&c->gpio, j) == GPIO_PRESSED;
+    }
+    return 0;
+}
+
+int controls_open(struct controls *c, const struct control_map *map, int channels,
+                const struct control_devices *dev){
+    int uses[CONTROL_SOURCES] = { 0 };
+    int err;
+    int i;
+
+    memset(c, 0, sizeof(*c));
+    c->joy_fd = c->key_fd = -1;
+    c->wake[0] = c->wake[1] = -1;
+    c->channels = channels;
+    atomic_init(&c->running, 0);
+
+    //no pedals, as with -k, drops their bindings too
+    for (i=0; i<map->nbindings; i++){
+        const struct control_binding *b = &map->bindings[i];
+        if (channelAction(b->action) && b->channel >= channels) {
+            fprintf(stderr, "warning: no channel %d to bind %s %d to\n",
+                b->channel, source_names[b->source], b->button);
+            continue;
+        }
+        if ((b->source == CONTROL_GPIO && !dev->gpio) ||
+                (b->source == CONTROL_UNOJOY && !dev->unojoy)) {
+            continue;
+        }
+        c->map.bindings[c->map.nbindings++] = *b;
+        uses[b->source] = 1;
+    }
+
+    if (pipe(c->wake) < 0) {
+        return -errno;
+    }
+    if (ring_init(&c->events, sizeof(struct control_event), EVENT_RING_SIZE) < 0) {
+        controls_close(c);
+        return -ENOMEM;
+    }
+    if (uses[CONTROL_GPIO] && (err = openPedals(c, dev->gpio, dev->chip)) < 0) {
+        controls_close(c);
+        return err;
+    }
+    if (uses[CONTROL_JOYSTICK]) {
+        openJoystick(c, dev->joystick);
+    }
+    if (uses[CONTROL_UNOJOY]) {
+        c->has_uno = unojoy_open(&c->uno, dev->unojoy, dev->unojoy_hz) == 0;
+        if (!c->has_uno) {
+            fprintf(stderr, "warning: carrying on without the UnoJoy\n");
+        }
+    }
+    if (uses[CONTROL_KEYBOARD]) {
+        c->key_fd = fileno(stdin);
+    }
+    return 0;
+}
+
+int controls_start(struct controls *c){
+    int err;
+
+    if (c->has_gpio && (err = gpio_start(&c->gpio)) < 0) {
+        return err;
+    }
+    if (c->joy_fd < 0 && c->key_fd < 0 && !c->has_uno) {
+        return 0;
+    }
+    atomic_store(&c->running, 1);
+    if ((err = pthread_create(&c->thread, NULL, readerThread, c))) {
+        atomic_store(&c->running, 0);
+        return -err;
+    }
+    return 0;
+}
+
+void controls_close(struct controls *c){
+    char byte = 0;
+
+    if (atomic_exchange(&c->running, 0)) {
+        if (write(c->wake[1], &byte, 1) < 0) {
+            perror("controls wakeup");
+        }
+        pthread_join(c->thread, NULL);
+    }
+    if (c->has_gpio) {
+        gpio_close(&c->gpio);
+        c->has_gpio = 0;
+    }
+    if (c->joy_fd >= 0) {
+        close(c->joy_fd);
+    }
+    c->joy_fd = c->key_fd = -1;
+    if (c->has_uno) {
+        unojoy_close(&c->uno);
+        c->has_uno = 0;
+    }
+    if (c->wake[0] >= 0) {
+        close(c->wake[0]);
+        close(c->wake[1]);
+    }
+    c->wake[0] = c->wake[1] = -1;
+    ring_free(&c->events);
+}
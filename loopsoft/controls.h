@@ -0,0 +1,128 @@
+#ifndef CONTROLS_H
+#define CONTROLS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "engine.h"
+#include "gpio.h"
+#include "ring.h"
+#include "unojoy.h"
+
+// every way of playing the looper behind one map. each source (pedals on
+// gpio, a joystick through evdev, an UnoJoy board on its serial port, the
+// keyboard) reports presses and releases of its buttons as they happen,
+// from a thread of its own, with the time they happened. the map turns
+// them into channel actions on the control thread. nothing is polled.
+
+enum control_source {
+    CONTROL_GPIO,       // button: line offset on the chip
+    CONTROL_JOYSTICK,   // button: index among the device's buttons
+    CONTROL_KEYBOARD,   // button: the character
+    CONTROL_UNOJOY,     // button: bit in dataForController_t, see unojoy.h
+    CONTROL_SOURCES,
+};
+
+enum control_action {
+    ACTION_RECORD,      // held: the channel records, unless its reset is held
+    ACTION_RESET,       // held: the channel resets
+    ACTION_UNDO,        // pressed: see CMD_UNDO
+    ACTION_REDO,
+    ACTION_SHORTER,     // pressed: the channel's length a step down or up,
+    ACTION_LONGER,      // ... 1/3, 1/2, 1, 2, 3 ... times the loop
+    ACTION_QUIT,
+};
+
+// each press flips the binding, for buttons that aren't held down
+#define CONTROL_TOGGLE 1
+
+#define CONTROL_MAX_BINDINGS 128
+// evdev key codes, KEY_CNT
+#define CONTROL_JOY_CODES 0x300
+
+struct control_event {
+    short source;
+    short button;
+    //1 pressed, 0 released
+    short value;
+    //CLOCK_MONOTONIC ns
+    long long when;
+};
+
+struct control_binding {
+    short source;
+    short button;
+    short action;
+    short channel;
+    short flags;
+    //held down right now, and since when
+    short held;
+    long long when;
+};
+
+struct control_map {
+    int nbindings;
+    struct control_binding bindings[CONTROL_MAX_BINDINGS];
+};
+
+void controls_map_init(struct control_map *m);
+int controls_bind(struct control_map *m, int source, int button, int action,
+                int channel, int flags);
+// adds the bindings in a file, one per line:
+//   <gpio|joy|key|uno> <button> <record|reset|undo|redo|shorter|longer|quit> [channel] [toggle]
+// blank lines and lines starting with # are skipped. returns a negative
+// errno.
+int controls_map_load(struct control_map *m, const char *path);
+
+struct controls {
+    struct control_map map;
+    int channels;
+
+    //pedals, if any map to gpio. gpio pin i is line gpio_line[i].
+    struct gpio_input gpio;
+    int has_gpio;
+    int gpio_line[GPIO_MAX_PINS];
+    //joystick and keyboard, -1 if not used
+    int joy_fd;
+    short joy_button[CONTROL_JOY_CODES];
+    int key_fd;
+    struct unojoy uno;
+    int has_uno;
+
+    //the joystick, UnoJoy and keyboard reader
+    int wake[2];
+    struct spsc_ring events;
+    pthread_t thread;
+    atomic_int running;
+
+    //last state sent to the engine for each channel
+    short recording[MAX_TRACKS];
+    short reset[MAX_TRACKS];
+};
+
+// where the sources are
+struct control_devices {
+    //NULL for no pedals
+    const struct gpio_backend *gpio;
+    const char *chip;
+    //an evdev node, NULL for the first joystick found
+    const char *joystick;
+    //the board's serial port, NULL for none, and how many times a second
+    //to ask it for its buttons. 0 has it push changes instead, which
+    //needs a sketch with UNOJOY_PUSH.
+    const char *unojoy;
+    int unojoy_hz;
+};
+
+// opens what the map needs from dev, and stdin for the keyboard. a missing
+// joystick or UnoJoy is only a warning. channels is how many tracks the
+// engine has; bindings past it are dropped.
+int controls_open(struct controls *c, const struct control_map *map, int channels,
+                const struct control_devices *dev);
+int controls_start(struct controls *c);
+void controls_close(struct controls *c);
+
+// control thread: passes on everything that happened since the last call.
+// returns 1 once quit has been pressed.
+int controls_dispatch(struct controls *c, struct engine *e);
+
+#endif
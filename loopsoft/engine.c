@@ -0,0 +1,1904 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "engine.h"
+#include "mix.h"
+#include "onset.h"
+#include "record.h"
+
+#define CMD_RING_SIZE 64
+#define NOTE_RING_SIZE 256
+
+#define WINDOW_FRAMES ((EVENT_WINDOW + 1) * FRAMESIZE)
+#define XFADE_STEP (RECORD_FULL / XFADE_FRAMES)
+
+// frames of storage kept committed ahead of the initial recording
+static int commitAhead(const struct engine *e){
+    return COMMIT_AHEAD_SECONDS * (int)e->rate;
+}
+
+int engine_init(struct engine *e, int ntracks, int max_frames, unsigned int rate){
+    struct tracks *t = &e->tracks;
+    int chunks;
+    int err;
+    int i;
+
+    memset(e, 0, sizeof(*e));
+    if (ntracks < 1 || ntracks > MAX_TRACKS) {
+        fprintf(stderr, "can't have %d tracks, 1 to %d\n", ntracks, MAX_TRACKS);
+        return -EINVAL;
+    }
+    if (!rate) {
+        rate = SAMPLE_HZ;
+    }
+    //every length in seconds has to come out as an int number of frames
+    if (rate > INT_MAX / MAX_LOOP_SECONDS) {
+        fprintf(stderr, "can't run at %u Hz\n", rate);
+        return -EINVAL;
+    }
+    e->rate = rate;
+    if (!max_frames) {
+        max_frames = MAX_LOOP_SECONDS * rate;
+    }
+    if (max_frames < FRAMESIZE || max_frames > INT_MAX - commitAhead(e)) {
+        fprintf(stderr, "can't have loops of %d frames\n", max_frames);
+        return -EINVAL;
+    }
+    e->max_frames = max_frames / FRAMESIZE * FRAMESIZE;
+    chunks = (e->max_frames + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+    for (i=0; i<MAX_TRACKS; i++){
+        e->stores[i].fd = -1;
+    }
+    undo_init(&e->undo);
+    pthread_mutex_init(&e->service_lock, NULL);
+    e->undo_bytes = (size_t)DEFAULT_UNDO_MB << 20;
+    t->count = ntracks;
+    t->all = ntracks == MAX_TRACKS ? ~(trackmask_t)0 : TRACK_BIT(ntracks) - 1;
+
+    if (ring_init(&e->cmds, sizeof(struct engine_cmd), CMD_RING_SIZE) < 0 ||
+        ring_init(&e->notes, sizeof(struct engine_note), NOTE_RING_SIZE) < 0) {
+        err = -ENOMEM;
+        goto fail;
+    }
+
+    for (i=0; i<t->count; i++){
+        int c;
+        if ((err = loopstore_reserve(&e->stores[i], e->max_frames, NULL)) < 0 ||
+            (err = loopstore_commit(&e->stores[i], e->max_frames < commitAhead(e) ?
+                e->max_frames : commitAhead(e))) < 0) {
+            goto fail;
+        }
+        t->body[i] = e->stores[i].body;
+        t->table[i] = malloc(sizeof(sample_t *) * chunks);
+        t->pass[i] = malloc(sizeof(sample_t *) * chunks);
+        t->peak[i] = calloc(chunks, sizeof(uint16_t));
+        t->pass_peak[i] = calloc(chunks, sizeof(uint16_t));
+        t->packed[i] = malloc(sizeof(struct pack *) * chunks);
+        t->ahead[i] = malloc(sizeof(sample_t) * FRAMES_TO_SAMPLES(AHEAD_BLOCKS * PACK_BLOCK_FRAMES));
+        if (!t->table[i] || !t->pass[i] || !t->peak[i] || !t->pass_peak[i] ||
+            !t->packed[i] || !t->ahead[i]) {
+            err = -ENOMEM;
+            goto fail;
+        }
+        for (c=0; c<chunks; c++){
+            t->table[i][c] = t->body[i] + (size_t)c * FRAMES_TO_SAMPLES(CHUNK_FRAMES);
+            t->pass[i][c] = NULL;
+            t->packed[i][c] = NULL;
+        }
+        memset(t->ahead[i], 0, sizeof(sample_t) * FRAMES_TO_SAMPLES(AHEAD_BLOCKS * PACK_BLOCK_FRAMES));
+        for (c=0; c<AHEAD_BLOCKS; c++){
+            t->ahead_at[i][c] = -1;
+        }
+        t->len[i] = e->max_frames;
+        t->gain[i] = MIX_UNITY_GAIN;
+        t->fade_gain[i] = 0;
+        t->resetpoint[i] = -1;
+        atomic_init(&e->generation[i], 0);
+        atomic_init(&e->stored[i], 0);
+    }
+
+    e->history_frames = WINDOW_FRAMES +
+        (int)((long long)MAX_LOOKBACK_MS * rate / 1000 / FRAMESIZE * FRAMESIZE);
+    e->history = calloc(FRAMES_TO_SAMPLES(e->history_frames), sizeof(sample_t));
+    if (!e->history) {
+        err = -ENOMEM;
+        goto fail;
+    }
+    //touched now so the audio thread doesn't fault it in as it fills
+    memset(e->history, 0, sizeof(sample_t) * FRAMES_TO_SAMPLES(e->history_frames));
+
+    e->job.track = -1;
+    e->job.chunk = malloc(sizeof(int) * chunks);
+    e->job.packed = malloc(sizeof(struct pack *) * chunks);
+    if (!e->job.chunk || !e->job.packed) {
+        err = -ENOMEM;
+        goto fail;
+    }
+    e->pack_idle = DEFAULT_PACK_IDLE_SECONDS * rate;
+    e->decode_share = 2 * ((ntracks * FRAMESIZE + PACK_BLOCK_FRAMES - 1) / PACK_BLOCK_FRAMES);
+
+    mix_init();
+
+    e->state = ENGINE_WAITING;
+    atomic_init(&e->committed, e->stores[0].committed);
+    atomic_init(&e->recorded, 0);
+    atomic_init(&e->closed_len, 0);
+    atomic_init(&e->clock_seq, 0);
+    atomic_init(&e->clock_frame, 0);
+    atomic_init(&e->clock_ns, 0);
+    atomic_init(&e->tap_lost, 0);
+    atomic_init(&e->idle, 0);
+    atomic_init(&e->pack_state, PACK_NONE);
+    atomic_init(&e->packed_chunks, 0);
+    atomic_init(&e->decode_budget, 0);
+    return 0;
+
+fail:
+    engine_free(e);
+    return err;
+}
+
+// lets go of the job's packs, unless they went into the table
+static void dropJob(struct engine *e){
+    struct pack_job *j = &e->job;
+    int i;
+
+    if (atomic_load_explicit(&e->pack_state, memory_order_acquire) != PACK_TAKEN) {
+        for (i=0; i<j->n; i++){
+            free(j->packed[i]);
+        }
+    }
+    j->n = 0;
+    j->track = -1;
+    atomic_store_explicit(&e->pack_state, PACK_NONE, memory_order_relaxed);
+}
+
+void engine_free(struct engine *e){
+    int chunks = (e->max_frames + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+    int i, c;
+
+    if (e->pool) {
+        if (e->batch) {
+            pool_sync(e->pool);
+        }
+        pool_free(e->pool);
+        free(e->pool);
+        e->pool = NULL;
+    }
+    free(e->submix);
+    e->submix = NULL;
+    for (i=0; i<e->tracks.count; i++){
+        loopstore_release(&e->stores[i]);
+        free(e->tracks.table[i]);
+        free(e->tracks.pass[i]);
+        free(e->tracks.peak[i]);
+        free(e->tracks.pass_peak[i]);
+        for (c=0; c<chunks && e->tracks.packed[i]; c++){
+            free(e->tracks.packed[i][c]);
+        }
+        free(e->tracks.packed[i]);
+        free(e->tracks.ahead[i]);
+        e->tracks.body[i] = NULL;
+        e->tracks.table[i] = NULL;
+        e->tracks.pass[i] = NULL;
+        e->tracks.peak[i] = NULL;
+        e->tracks.pass_peak[i] = NULL;
+        e->tracks.packed[i] = NULL;
+        e->tracks.ahead[i] = NULL;
+    }
+    dropJob(e);
+    free(e->job.chunk);
+    free(e->job.packed);
+    e->job.chunk = NULL;
+    e->job.packed = NULL;
+    undo_free(&e->undo);
+    pthread_mutex_destroy(&e->service_lock);
+    free(e->history);
+    e->history = NULL;
+    ring_free(&e->cmds);
+    ring_free(&e->notes);
+}
+
+int engine_start_workers(struct engine *e, int nworkers, int priority){
+    int lanes = nworkers + 1;
+    int err;
+    int g;
+
+    if (!nworkers) {
+        return 0;
+    }
+    e->pool = calloc(1, sizeof(*e->pool));
+    e->ngroups = GROUPS_PER_LANE * lanes;
+    if (e->ngroups > e->tracks.count) {
+        e->ngroups = e->tracks.count;
+    }
+    e->submix = malloc(sizeof(accum_t) * PERIOD_SAMPLES * e->ngroups);
+    if (!e->pool || !e->submix) {
+        free(e->pool);
+        e->pool = NULL;
+        return -ENOMEM;
+    }
+    if ((err = pool_init(e->pool, nworkers, priority)) < 0) {
+        free(e->pool);
+        e->pool = NULL;
+        return err;
+    }
+    //contiguous runs of tracks, as even as they come
+    for (g=0; g<=e->ngroups; g++){
+        e->group_start[g] = g * e->tracks.count / e->ngroups;
+    }
+    return 0;
+}
+
+int engine_send(struct engine *e, int type, int track, int value){
+    return engine_send_at(e, type, track, value, -1);
+}
+
+int engine_send_at(struct engine *e, int type, int track, int value, long long at){
+    struct engine_cmd cmd;
+    cmd.type = type;
+    cmd.track = track;
+    cmd.value = value;
+    cmd.at = at;
+    return ring_push(&e->cmds, &cmd);
+}
+
+int engine_poll(struct engine *e, struct engine_note *note){
+    return ring_pop(&e->notes, note);
+}
+
+// whether the pool has n chunks to keep back for more packs, over what it
+// keeps already and its low water mark
+static int poolKeeps(struct engine *e, int n){
+    return atomic_load_explicit(&e->undo.nfree, memory_order_relaxed) >= e->undo.low +
+        atomic_load_explicit(&e->packed_chunks, memory_order_relaxed) + n;
+}
+
+// the control side's part of packing: a track nobody is recording on is
+// packed a chunk per call, reading the chunks while the audio thread
+// plays them, and offered to the audio thread once it's all done, see
+// takePacked. a chunk that doesn't come out smaller is left raw.
+static void packTracks(struct engine *e){
+    struct pack_job *j = &e->job;
+    int state = atomic_load_explicit(&e->pack_state, memory_order_acquire);
+    trackmask_t idle = atomic_load_explicit(&e->idle, memory_order_relaxed);
+    trackmask_t m;
+    int len, nchunks;
+    int x;
+
+    if (state == PACK_OFFERED) {
+        return;
+    }
+    if (state != PACK_NONE) {
+        if (state == PACK_TAKEN) {
+            e->pack_gen[j->track] = j->gen;
+            e->pack_done |= TRACK_BIT(j->track);
+        }
+        dropJob(e);
+        return;
+    }
+
+    if (j->track < 0) {
+        for (m = idle; m; ){
+            unsigned gen;
+            x = tracks_next(&m);
+            gen = atomic_load_explicit(&e->generation[x], memory_order_acquire);
+            if (!(e->pack_done & TRACK_BIT(x)) || e->pack_gen[x] != gen) {
+                j->track = x;
+                j->gen = gen;
+                j->next = 0;
+                j->n = 0;
+                j->raw = 0;
+                j->bytes = 0;
+                break;
+            }
+        }
+        return;
+    }
+    x = j->track;
+    //recorded on since, it'll be idle again some other time
+    if (!(idle & TRACK_BIT(x)) ||
+            atomic_load_explicit(&e->generation[x], memory_order_acquire) != j->gen) {
+        dropJob(e);
+        return;
+    }
+    len = engine_track_length(e, x);
+    nchunks = (len + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+
+    for (; j->next < nchunks; j->next++){
+        sample_t *chunk = __atomic_load_n(&e->tracks.table[x][j->next], __ATOMIC_ACQUIRE);
+        int frames = len - j->next * CHUNK_FRAMES;
+        struct pack *p;
+
+        //a silent one costs nothing as it is, and packed it would need a
+        //chunk from the pool back the moment it's recorded on
+        if (!chunk || !__atomic_load_n(&e->tracks.peak[x][j->next], __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (frames > CHUNK_FRAMES) {
+            frames = CHUNK_FRAMES;
+        }
+        if ((p = pack_encode(chunk, frames))) {
+            p->id = ++e->pack_seq;
+            //the audio thread decodes it, so it's pinned like the rest
+            if (e->pin_storage) {
+                mlock(p, p->bytes);
+            }
+            j->chunk[j->n] = j->next;
+            j->packed[j->n++] = p;
+            j->raw += sizeof(sample_t) * FRAMES_TO_SAMPLES(frames);
+            j->bytes += p->bytes;
+        }
+        j->next++;
+        return;
+    }
+
+    //a pool too small to take the track back raw leaves it as it is,
+    //until it's recorded on again
+    if (j->n && poolKeeps(e, j->n)) {
+        atomic_store_explicit(&e->pack_state, PACK_OFFERED, memory_order_release);
+        return;
+    }
+    e->pack_gen[x] = j->gen;
+    e->pack_done |= TRACK_BIT(x);
+    dropJob(e);
+}
+
+// makes storage ready for a track that got longer than what its store
+// has: committed, pinned and cleared, since a loop file still holds the
+// initial recording past the loop. then the audio thread takes it.
+static void growStores(struct engine *e){
+    int i;
+
+    for (i=0; i<e->tracks.count; i++){
+        struct loopstore *s = &e->stores[i];
+        int len = engine_track_length(e, i);
+        int want = (len + CHUNK_FRAMES - 1) / CHUNK_FRAMES * CHUNK_FRAMES;
+        int have = atomic_load_explicit(&e->stored[i], memory_order_relaxed);
+
+        if (want <= have) {
+            continue;
+        }
+        //a lock that fails has still committed, as before
+        if (e->pin_storage) {
+            loopstore_lock(s, want);
+        } else {
+            loopstore_commit(s, want);
+        }
+        if (s->committed < (size_t)want) {
+            continue;
+        }
+        memset(s->body + FRAMES_TO_SAMPLES((size_t)have), 0,
+            sizeof(sample_t) * FRAMES_TO_SAMPLES((size_t)(want - have)));
+        atomic_store_explicit(&e->stored[i], want, memory_order_release);
+    }
+}
+
+void engine_service(struct engine *e){
+    int closed_len = atomic_load_explicit(&e->closed_len, memory_order_acquire);
+    size_t want;
+    size_t have;
+    int i;
+
+    if (closed_len) {
+        if (!e->stores_locked) {
+            //a restored track may be longer than the loop. nothing changes
+            //a length before the undo history is there.
+            for (i=0; i<e->tracks.count; i++){
+                int len = engine_track_length(e, i);
+                if (e->pin_storage) {
+                    loopstore_lock(&e->stores[i], len);
+                }
+                //the table has the slices this far already
+                atomic_store_explicit(&e->stored[i],
+                    (len + CHUNK_FRAMES - 1) / CHUNK_FRAMES * CHUNK_FRAMES,
+                    memory_order_relaxed);
+            }
+            //without it overdubs are written in place
+            undo_start(&e->undo, e->undo_bytes, engine_longest_track(e, closed_len),
+                e->pin_storage);
+            e->stores_locked = 1;
+        }
+        //someone is reading a chunk, it can wait for the next call
+        if (pthread_mutex_trylock(&e->service_lock) == 0) {
+            undo_service(&e->undo);
+            pthread_mutex_unlock(&e->service_lock);
+        }
+        growStores(e);
+        //packing gives chunks back through undo layers too
+        if (e->pack_idle && atomic_load_explicit(&e->undo.ready, memory_order_acquire)) {
+            packTracks(e);
+        }
+        return;
+    }
+
+    want = atomic_load_explicit(&e->recorded, memory_order_relaxed) + commitAhead(e);
+    if (want > (size_t)e->max_frames) {
+        want = e->max_frames;
+    }
+    if (want <= (size_t)atomic_load_explicit(&e->committed, memory_order_relaxed)) {
+        return;
+    }
+
+    have = e->max_frames;
+    for (i=0; i<e->tracks.count; i++){
+        loopstore_commit(&e->stores[i], want);
+        if (e->stores[i].committed < have) {
+            have = e->stores[i].committed;
+        }
+    }
+    //only publish once every track's pages are in
+    atomic_store_explicit(&e->committed, have, memory_order_release);
+}
+
+// never blocks; if the control thread falls behind the note is dropped
+void engine_notify(struct engine *e, int type, int track, int value){
+    struct engine_note note;
+    note.type = type;
+    note.track = track;
+    note.value = value;
+    ring_push(&e->notes, &note);
+}
+
+// seqlock, so the control side never sees a frame from one period and a
+// time from another
+void engine_clock(struct engine *e, long long ns){
+    unsigned seq = atomic_load_explicit(&e->clock_seq, memory_order_relaxed);
+
+    atomic_store_explicit(&e->clock_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&e->clock_frame, e->frames + FRAMESIZE, memory_order_relaxed);
+    atomic_store_explicit(&e->clock_ns, ns, memory_order_relaxed);
+    atomic_store_explicit(&e->clock_seq, seq + 2, memory_order_release);
+}
+
+long long engine_frame_at(struct engine *e, long long ns){
+    unsigned seq;
+    long long frame;
+    long long at;
+
+    do {
+        seq = atomic_load_explicit(&e->clock_seq, memory_order_acquire);
+        frame = atomic_load_explicit(&e->clock_frame, memory_order_relaxed);
+        at = atomic_load_explicit(&e->clock_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) ||
+        seq != atomic_load_explicit(&e->clock_seq, memory_order_relaxed));
+
+    if (!seq) {
+        return -1;
+    }
+    frame += (ns - at) * (long long)e->rate / 1000000000LL;
+    return frame < 0 ? 0 : frame;
+}
+
+// the loudest frames of interleaved samples get
+static int peakOf(const sample_t *p, int frames){
+    int peak = 0;
+    int i;
+
+    for (i=0; i<FRAMES_TO_SAMPLES(frames); i++){
+        int v = p[i] < 0 ? -p[i] : p[i];
+        peak = v > peak ? v : peak;
+    }
+    return peak;
+}
+
+// after the span went into a chunk, added on or written over
+static inline void raisePeak(uint16_t *peak, const struct span *s, int add){
+    int p = add ? *peak + s->peak : (*peak > s->peak ? *peak : s->peak);
+    *peak = p > -SAMPLE_MIN ? -SAMPLE_MIN : p;
+}
+
+// one track's share of a contiguous piece of a span, frames long. a punch
+// in or out crossfades over XFADE_FRAMES first, then the steady kernels
+// take over.
+static void writeTrack(struct tracks *t, int x, const struct span *s,
+                sample_t *dst,
+                uint16_t *peak,
+                const sample_t *src,
+                int frames){
+    int reset = (s->reset & TRACK_BIT(x)) != 0;
+    int target = s->recording & TRACK_BIT(x) ? RECORD_FULL : 0;
+    record_fn write;
+
+    if (t->fade_gain[x] != target) {
+        int step = target > t->fade_gain[x] ? XFADE_STEP : -XFADE_STEP;
+        int n = (target - t->fade_gain[x]) / step;
+        if (n > frames) {
+            n = frames;
+        }
+        //a reset track has nothing worth keeping under the fade
+        if (reset) {
+            record_overwrite_ramp(dst, src, n, t->fade_gain[x], step);
+        } else {
+            record_add_ramp(dst, src, n, t->fade_gain[x], step);
+        }
+        raisePeak(peak, s, !reset);
+        t->fade_gain[x] += n * step;
+        dst += FRAMES_TO_SAMPLES(n);
+        src += FRAMES_TO_SAMPLES(n);
+        frames -= n;
+    }
+    if (!frames) {
+        return;
+    }
+
+    if (t->fade_gain[x]) {
+        //if this track has not been reset, copy the new data in,
+        //otherwise, move direct overwrite if recording
+        write = reset ? record_overwrite : record_add;
+    }
+    //otherwise, if it has been reset and not recording, set 0. unless
+    //it's silent already.
+    else if (reset && *peak) {
+        write = record_clear;
+    }
+    else {
+        return;
+    }
+    write(dst, src, FRAMES_TO_SAMPLES(frames));
+    if (write != record_clear) {
+        raisePeak(peak, s, write == record_add);
+    }
+}
+
+// where loop position pos falls in a track len frames long
+static inline int trackAddr(long long pos, int len){
+    int addr = pos % len;
+    return addr < 0 ? addr + len : addr;
+}
+
+static inline int trackChunks(int len){
+    return (len + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+}
+
+// the block of a track len frames long that play position pos is in,
+// counted in blocks played since looping started
+static inline long long blockAt(long long pos, int len){
+    return pos / len * ((len + PACK_BLOCK_FRAMES - 1) / PACK_BLOCK_FRAMES) +
+        trackAddr(pos, len) / PACK_BLOCK_FRAMES;
+}
+
+// the chunk of track x that loop address addr is in, as the track is
+// heard right now: the open take's copy if it has one. NULL if it's empty.
+static inline sample_t *chunkAt(struct tracks *t, int x, int addr){
+    int c = addr / CHUNK_FRAMES;
+    sample_t *chunk = t->pass[x][c] ? t->pass[x][c] : t->table[x][c];
+    return chunk ? chunk + FRAMES_TO_SAMPLES(addr % CHUNK_FRAMES) : NULL;
+}
+
+// and the peak that goes with it
+static inline uint16_t *peakAt(struct tracks *t, int x, int addr){
+    int c = addr / CHUNK_FRAMES;
+    return t->pass[x][c] ? &t->pass_peak[x][c] : &t->peak[x][c];
+}
+
+// the packed chunk heard at loop address addr of track x, if that's what
+// is heard there: there's no raw chunk in the table or the take over it
+static inline const struct pack *packedAt(struct tracks *t, int x, int addr){
+    int c = addr / CHUNK_FRAMES;
+    return t->table[x][c] || t->pass[x][c] ? NULL : t->packed[x][c];
+}
+
+// the frames of pack p at loop address addr, from the slot track x keeps
+// the block played pos'th in. decoded into it first if it isn't there,
+// out of the period's budget or past it.
+static const sample_t *aheadAt(struct engine *e, int x, const struct pack *p,
+                int addr, long long pos){
+    struct tracks *t = &e->tracks;
+    int slot = pos % AHEAD_BLOCKS;
+    sample_t *block = t->ahead[x] + slot * FRAMES_TO_SAMPLES(PACK_BLOCK_FRAMES);
+
+    if (t->ahead_at[x][slot] != pos || t->ahead_id[x][slot] != p->id) {
+        pack_decode_block(p, addr % CHUNK_FRAMES / PACK_BLOCK_FRAMES, block);
+        t->ahead_at[x][slot] = pos;
+        t->ahead_id[x][slot] = p->id;
+        atomic_fetch_sub_explicit(&e->decode_budget, 1, memory_order_relaxed);
+    }
+    return block + FRAMES_TO_SAMPLES(addr % PACK_BLOCK_FRAMES);
+}
+
+// decodes the next block after the play head a packed track doesn't have
+// yet, while the period's budget lasts. tracks mostly come to the end of
+// a block in the same period, so rather than all decoding then, each
+// works a few blocks ahead as the budget lets it.
+static void readAhead(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    int nblocks = (t->len[x] + PACK_BLOCK_FRAMES - 1) / PACK_BLOCK_FRAMES;
+    long long at = blockAt(e->play_pos, t->len[x]);
+    long long pos;
+
+    for (pos = at + 1; pos < at + AHEAD_BLOCKS; pos++){
+        int addr = pos % nblocks * PACK_BLOCK_FRAMES;
+        int slot = pos % AHEAD_BLOCKS;
+        const struct pack *p = t->peak[x][addr / CHUNK_FRAMES] ? packedAt(t, x, addr) : NULL;
+
+        if (!p || (t->ahead_at[x][slot] == pos && t->ahead_id[x][slot] == p->id)) {
+            continue;
+        }
+        if (atomic_load_explicit(&e->decode_budget, memory_order_relaxed) > 0) {
+            aheadAt(e, x, p, addr, pos);
+        }
+        return;
+    }
+}
+
+// track x from play position pos on, as many frames of it up to *frames
+// as run on in one piece: up to where it wraps, or the next chunk, or
+// block of a packed one. *frames is cut down to that. from layer l if it
+// isn't NULL, a reset's, else as the track is heard. NULL for silence.
+static const sample_t *playPiece(struct engine *e, int x, const struct layer *l,
+                long long pos, int *frames){
+    struct tracks *t = &e->tracks;
+    int addr = trackAddr(pos, t->len[x]);
+    int c = addr / CHUNK_FRAMES;
+    const sample_t *chunk;
+    const struct pack *p = NULL;
+
+    if (*frames > t->len[x] - addr) {
+        *frames = t->len[x] - addr;
+    }
+    if (*frames > CHUNK_FRAMES - addr % CHUNK_FRAMES) {
+        *frames = CHUNK_FRAMES - addr % CHUNK_FRAMES;
+    }
+    if (l) {
+        if (!l->peak[c]) {
+            return NULL;
+        }
+        chunk = l->ptr[c] ? l->ptr[c] + FRAMES_TO_SAMPLES(addr % CHUNK_FRAMES) : NULL;
+        p = l->packed[c];
+    } else {
+        if (!*peakAt(t, x, addr)) {
+            return NULL;
+        }
+        chunk = chunkAt(t, x, addr);
+        if (!chunk && (t->packs & TRACK_BIT(x))) {
+            p = packedAt(t, x, addr);
+        }
+    }
+    if (chunk || !p) {
+        return chunk;
+    }
+    if (*frames > PACK_BLOCK_FRAMES - addr % PACK_BLOCK_FRAMES) {
+        *frames = PACK_BLOCK_FRAMES - addr % PACK_BLOCK_FRAMES;
+    }
+    return aheadAt(e, x, p, addr, blockAt(pos, t->len[x]));
+}
+
+// frames of track x from play position pos on into dst, piece by piece
+static void playFrames(struct engine *e, int x, const struct layer *l,
+                long long pos, sample_t *dst, int frames){
+    while (frames > 0) {
+        int n = frames;
+        const sample_t *src = playPiece(e, x, l, pos, &n);
+        if (src) {
+            memcpy(dst, src, sizeof(sample_t) * FRAMES_TO_SAMPLES(n));
+        } else {
+            memset(dst, 0, sizeof(sample_t) * FRAMES_TO_SAMPLES(n));
+        }
+        dst += FRAMES_TO_SAMPLES(n);
+        pos += n;
+        frames -= n;
+    }
+}
+
+// one track's share of a span, in as many contiguous pieces as the
+// track's own wrap point and chunk edges cut it into
+static void writeSpanTrack(struct tracks *t, int x, const struct span *s){
+    int len = t->len[x];
+    int addr = trackAddr(s->pos, len);
+    int done = 0;
+
+    while (done < s->frames) {
+        int n = s->frames - done;
+        sample_t *dst = chunkAt(t, x, addr);
+        if (n > CHUNK_FRAMES - addr % CHUNK_FRAMES) {
+            n = CHUNK_FRAMES - addr % CHUNK_FRAMES;
+        }
+        if (n > len - addr) {
+            n = len - addr;
+        }
+        //an empty chunk that got no chunk from the pool
+        if (dst) {
+            writeTrack(t, x, s, dst, peakAt(t, x, addr), s->in + FRAMES_TO_SAMPLES(done), n);
+        }
+        done += n;
+        addr = (addr + n) % len;
+    }
+}
+
+static void writeSpan(struct tracks *t, const struct span *s){
+    trackmask_t active = s->active;
+
+    while (active) {
+        writeSpanTrack(t, tracks_next(&active), s);
+    }
+}
+
+// counts track x's chunks standing as packs alone again, after its table
+// or take changed
+static void countPacked(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    int n = 0;
+    int c;
+
+    if (t->packs & TRACK_BIT(x)) {
+        for (c=0; c<trackChunks(t->len[x]); c++){
+            n += !t->table[x][c] && !t->pass[x][c] && t->packed[x][c];
+        }
+    }
+    atomic_fetch_add_explicit(&e->packed_chunks, n - t->npacked[x], memory_order_relaxed);
+    t->npacked[x] = n;
+}
+
+// trades a layer's chunks for the ones in the table
+static void swapLayer(struct engine *e, struct layer *l){
+    sample_t **table = e->tracks.table[l->track];
+    uint16_t *peak = e->tracks.peak[l->track];
+    struct pack **packed = e->tracks.packed[l->track];
+    sample_t *p;
+    uint16_t q;
+    struct pack *r;
+    int i;
+
+    for (i=0; i<l->n; i++){
+        p = table[l->chunk[i]];
+        table[l->chunk[i]] = l->ptr[i];
+        l->ptr[i] = p;
+        q = peak[l->chunk[i]];
+        peak[l->chunk[i]] = l->peak[i];
+        l->peak[i] = q;
+        r = packed[l->chunk[i]];
+        packed[l->chunk[i]] = l->packed[i];
+        l->packed[i] = r;
+    }
+    i = e->tracks.len[l->track];
+    __atomic_store_n(&e->tracks.len[l->track], l->len, __ATOMIC_RELAXED);
+    l->len = i;
+    countPacked(e, l->track);
+    atomic_fetch_add_explicit(&e->generation[l->track], 1, memory_order_release);
+}
+
+// cuts a reset's fade out short, before its layer goes anywhere
+static void stopGhost(struct tracks *t, int x){
+    t->ghost[x] = NULL;
+    t->ghost_gain[x] = 0;
+    t->ghosting &= ~TRACK_BIT(x);
+}
+
+// lets go of the oldest layer any track has, for its chunks
+static void dropOldestLayer(struct engine *e){
+    struct tracks *t = &e->tracks;
+    struct layer *l = NULL;
+    int x;
+
+    for (x=0; x<t->count; x++){
+        if (t->applied[x] && (!l || (int)(t->oldest[x]->seq - l->seq) < 0)) {
+            l = t->oldest[x];
+        }
+    }
+    if (!l) {
+        return;
+    }
+    x = l->track;
+    if (t->applied[x] == l) {
+        t->applied[x] = NULL;
+    }
+    if (t->ghost[x] == l) {
+        stopGhost(t, x);
+    }
+    t->oldest[x] = l->newer;
+    if (l->newer) {
+        l->newer->older = NULL;
+    }
+    undo_retire(&e->undo, l);
+}
+
+// swaps layer l into track x's table and keeps what it replaces as the
+// track's newest layer, in place of anything that was undone
+static void pushLayer(struct engine *e, int x, struct layer *l){
+    struct tracks *t = &e->tracks;
+    struct layer *redo = t->applied[x] ? t->applied[x]->newer : t->oldest[x];
+    struct layer *next;
+
+    for (; redo; redo = next){
+        next = redo->newer;
+        undo_retire(&e->undo, redo);
+    }
+    swapLayer(e, l);
+
+    l->seq = e->layer_seq++;
+    l->older = t->applied[x];
+    l->newer = NULL;
+    if (l->older) {
+        l->older->newer = l;
+    } else {
+        t->oldest[x] = l;
+    }
+    t->applied[x] = l;
+}
+
+// the take's copies go into the table, see pushLayer
+static void keepTake(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    struct layer *l = t->take[x];
+    int i;
+
+    for (i=0; i<l->n; i++){
+        l->ptr[i] = t->pass[x][l->chunk[i]];
+        l->peak[i] = t->pass_peak[x][l->chunk[i]];
+        t->pass[x][l->chunk[i]] = NULL;
+    }
+    //nothing copied, nothing to undo
+    if (!l->n) {
+        undo_retire(&e->undo, l);
+        return;
+    }
+    pushLayer(e, x, l);
+}
+
+// closes the open take of track x, if there is one
+static void endTake(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+
+    if (t->take[x]) {
+        keepTake(e, x);
+    } else if (t->passing & TRACK_BIT(x)) {
+        //one written in place changed the table all the same
+        atomic_fetch_add_explicit(&e->generation[x], 1, memory_order_release);
+    }
+    if (t->lost[x]) {
+        engine_notify(e, NOTE_LOST, x, t->lost[x]);
+        t->lost[x] = 0;
+    }
+    t->take[x] = NULL;
+    t->passing &= ~TRACK_BIT(x);
+}
+
+// once there's a pool for an overdub to take chunks from, the slices of
+// the first recording that stayed silent are let go: they go into a layer
+// of their own that is retired straight away, which gives their pages
+// back. from then on only what holds audio takes memory, and a track
+// nobody recorded on costs nothing to mix.
+static void dropSilence(struct engine *e){
+    struct tracks *t = &e->tracks;
+    struct layer *l;
+    int x, c;
+
+    e->silence_dropped = 1;
+    for (x=0; x<t->count; x++){
+        if (!(l = undo_take_layer(&e->undo))) {
+            return;
+        }
+        l->track = x;
+        l->n = 0;
+        for (c=0; c<trackChunks(t->len[x]); c++){
+            if (t->table[x][c] && !t->peak[x][c] && !t->pass[x][c]) {
+                l->chunk[l->n] = c;
+                l->packed[l->n] = NULL;
+                l->ptr[l->n++] = t->table[x][c];
+                t->table[x][c] = NULL;
+            }
+        }
+        if (l->n) {
+            atomic_fetch_add_explicit(&e->generation[x], 1, memory_order_release);
+        }
+        undo_retire(&e->undo, l);
+    }
+}
+
+// the take's copies go back to the pool and the table is left as it was
+static void dropTake(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    struct layer *l = t->take[x];
+    int i;
+
+    for (i=0; i<l->n; i++){
+        l->ptr[i] = t->pass[x][l->chunk[i]];
+        t->pass[x][l->chunk[i]] = NULL;
+    }
+    undo_retire(&e->undo, l);
+    countPacked(e, x);
+}
+
+// a span's chunks the take hasn't copied yet get one from the pool. out of
+// chunks, that bit of the take is written in place and can't be undone.
+// a silent chunk needs no copy: the take moves it over and writes it in
+// place, and undo puts silence back. an empty chunk written in place gets
+// one too, or the writes to it are lost; just clearing it needs none. the
+// pool keeps a chunk back for every one standing as a pack, which has
+// nothing raw to write in place, and only it may have that one.
+static void copyOnWrite(struct engine *e, int x, const struct span *s){
+    struct tracks *t = &e->tracks;
+    struct layer *l = t->take[x];
+    trackmask_t bit = TRACK_BIT(x);
+    int clear = (s->reset & bit) && !(s->recording & bit) && !t->fade_gain[x];
+    int len = t->len[x];
+    int addr = trackAddr(s->pos, len);
+    int done = 0;
+    sample_t *chunk;
+
+    while (done < s->frames) {
+        int c = addr / CHUNK_FRAMES;
+        int n = s->frames - done;
+        int packed = !t->table[x][c] && !t->pass[x][c] && t->packed[x][c];
+        int spare = packed || atomic_load_explicit(&e->undo.nfree, memory_order_relaxed) >
+            atomic_load_explicit(&e->packed_chunks, memory_order_relaxed);
+        if (n > CHUNK_FRAMES - addr % CHUNK_FRAMES) {
+            n = CHUNK_FRAMES - addr % CHUNK_FRAMES;
+        }
+        if (n > len - addr) {
+            n = len - addr;
+        }
+
+        if (t->pass[x][c] || (clear && !t->peak[x][c])) {
+            //nothing to do
+        } else if (l && t->table[x][c] && !t->peak[x][c]) {
+            //a stale pack goes along, so it can't come back with the silence
+            t->pass[x][c] = t->table[x][c];
+            t->pass_peak[x][c] = 0;
+            l->packed[l->n] = t->packed[x][c];
+            l->chunk[l->n++] = c;
+            t->packed[x][c] = NULL;
+            __atomic_store_n(&t->table[x][c], NULL, __ATOMIC_RELEASE);
+        } else if (l && spare && (chunk = undo_take_chunk(&e->undo))) {
+            t->pass[x][c] = chunk;
+            t->pass_peak[x][c] = t->peak[x][c];
+            l->packed[l->n] = NULL;
+            l->chunk[l->n++] = c;
+            t->copy[x][t->ncopy[x]++] = c;
+        } else if (!t->table[x][c] && spare && (chunk = undo_take_chunk(&e->undo))) {
+            t->table[x][c] = chunk;
+            t->copy[x][t->ncopy[x]++] = c;
+            atomic_fetch_add_explicit(&e->generation[x], 1, memory_order_release);
+        } else if (!t->table[x][c]) {
+            t->lost[x] += n;
+        }
+        if (packed && (t->pass[x][c] || t->table[x][c])) {
+            t->npacked[x]--;
+            atomic_fetch_sub_explicit(&e->packed_chunks, 1, memory_order_relaxed);
+        }
+        done += n;
+        addr = (addr + n) % len;
+    }
+}
+
+// on the audio thread, before the record work: every track that writes this
+// period has a take open, with its chunks copied on write. a take ends the
+// first period its track has nothing to write.
+static void prepareTakes(struct engine *e){
+    struct tracks *t = &e->tracks;
+    trackmask_t m;
+    int x;
+    int i;
+
+    if (atomic_load_explicit(&e->undo.nfree, memory_order_relaxed) < e->undo.low +
+            atomic_load_explicit(&e->packed_chunks, memory_order_relaxed)) {
+        dropOldestLayer(e);
+    }
+
+    for (m = e->active | t->passing; m; ){
+        trackmask_t bit;
+        x = tracks_next(&m);
+        bit = TRACK_BIT(x);
+        t->ncopy[x] = 0;
+
+        if (!(e->active & bit)) {
+            endTake(e, x);
+            continue;
+        }
+        if (!(t->passing & bit)) {
+            t->passing |= bit;
+            if ((t->take[x] = undo_take_layer(&e->undo))) {
+                t->take[x]->track = x;
+                t->take[x]->n = 0;
+                t->take[x]->len = t->len[x];
+            } else {
+                dropOldestLayer(e);
+            }
+        }
+        for (i=0; i<e->nspans; i++){
+            if (e->spans[i].active & bit) {
+                copyOnWrite(e, x, &e->spans[i]);
+            }
+        }
+    }
+}
+
+// the period's record work for track x while looping: the chunks the take
+// just got are filled in from what they stand in for, or with silence for
+// an empty one, then written to. a packed chunk is decoded into its copy,
+// so a track goes back to raw samples a chunk at a time as it's recorded
+// on.
+static void recordTrack(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    int i;
+
+    for (i=0; i<t->ncopy[x]; i++){
+        int c = t->copy[x][i];
+        sample_t *dst = t->pass[x][c] ? t->pass[x][c] : t->table[x][c];
+        const sample_t *src = t->pass[x][c] ? t->table[x][c] : NULL;
+        int frames = t->len[x] - c * CHUNK_FRAMES;
+        size_t bytes;
+        if (frames > CHUNK_FRAMES) {
+            frames = CHUNK_FRAMES;
+        }
+        bytes = sizeof(sample_t) * FRAMES_TO_SAMPLES(frames);
+        if (!t->peak[x][c]) {
+            memset(dst, 0, bytes);
+        } else if (src) {
+            memcpy(dst, src, bytes);
+        } else if (t->packed[x][c]) {
+            pack_decode(t->packed[x][c], dst);
+        } else {
+            memset(dst, 0, bytes);
+        }
+    }
+
+    for (i=0; i<e->nspans; i++){
+        if (e->spans[i].active & TRACK_BIT(x)) {
+            writeSpanTrack(t, x, &e->spans[i]);
+        }
+    }
+}
+
+// once the writes are done the fading bits stay up until fade_gain has
+// caught up, and the ghosting ones until the fade out is over
+static void settleTracks(struct engine *e){
+    struct tracks *t = &e->tracks;
+    trackmask_t m;
+    int x;
+
+    for (m = t->fading; m; ){
+        x = tracks_next(&m);
+        if (t->fade_gain[x] == (t->recording & TRACK_BIT(x) ? RECORD_FULL : 0)) {
+            t->fading &= ~TRACK_BIT(x);
+        }
+    }
+    for (m = t->ghosting; m; ){
+        x = tracks_next(&m);
+        if (!t->ghost_gain[x]) {
+            stopGhost(t, x);
+        }
+    }
+}
+
+// a reset empties the track at once. the whole table goes into a layer,
+// so undo can bring it back, and plays on from there for XFADE_FRAMES as
+// it fades out; its chunks are given back once the layer goes. returns 0
+// if there's no layer to be had, and the reset clears the loop in place
+// instead.
+static int flipTrack(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    struct layer *l = undo_take_layer(&e->undo);
+    int nchunks = trackChunks(t->len[x]);
+    int i;
+
+    if (!l) {
+        dropOldestLayer(e);
+        return 0;
+    }
+    endTake(e, x);
+    l->track = x;
+    l->n = nchunks;
+    l->len = t->len[x];
+    for (i=0; i<nchunks; i++){
+        l->chunk[i] = i;
+        l->ptr[i] = NULL;
+        l->peak[i] = 0;
+        l->packed[i] = NULL;
+    }
+    pushLayer(e, x, l);
+
+    t->ghost[x] = l;
+    t->ghost_gain[x] = RECORD_FULL;
+    t->ghosting |= TRACK_BIT(x);
+    return 1;
+}
+
+// writes frames of input at loop position pos into every track that is
+// recording, fading or being reset. a looping period's spans are kept for
+// recordTrack instead.
+static void recordSpan(struct engine *e,
+                const sample_t *in,
+                long long pos,
+                int frames){
+    struct tracks *t = &e->tracks;
+    struct span s;
+
+    s.in = in;
+    s.pos = pos;
+    s.frames = frames;
+    s.recording = t->recording;
+    s.reset = t->reset;
+    s.active = t->recording | t->fading | t->reset;
+    if (!s.active || !frames) {
+        return;
+    }
+    s.peak = peakOf(in, frames);
+    if (e->state == ENGINE_LOOPING) {
+        e->spans[e->nspans++] = s;
+        e->active |= s.active;
+    } else {
+        writeSpan(t, &s);
+    }
+}
+
+// hands the period's output to whoever taps it, never waiting
+static void tapOutput(struct engine *e, const sample_t *out){
+    if (e->tap && !ring_push(e->tap, out)) {
+        atomic_fetch_add_explicit(&e->tap_lost, 1, memory_order_relaxed);
+    }
+}
+
+static void closeLoop(struct engine *e){
+    struct tracks *t = &e->tracks;
+    int chunks = trackChunks(e->max_frames);
+    int x, c;
+
+    //whatever is still fading gets cut where storage ran out. past the
+    //loop there's no storage until a track made longer has some made
+    //ready, see takeSlices.
+    for (x=0; x<t->count; x++){
+        t->fade_gain[x] = 0;
+        t->len[x] = e->looplen * FRAMESIZE;
+        t->slices[x] = trackChunks(t->len[x]) * CHUNK_FRAMES;
+        for (c=trackChunks(t->len[x]); c<chunks; c++){
+            t->table[x][c] = NULL;
+        }
+    }
+    e->tracks.recording = 0;
+    e->tracks.fading = 0;
+    e->state = ENGINE_LOOPING;
+    //the play side is EVENT_WINDOW periods ahead of the loop just closed
+    e->count = (EVENT_WINDOW - 1) % e->looplen;
+    e->passes = 0;
+    for (x=0; x<e->tracks.count; x++){
+        e->tracks.busy_at[x] = e->frames;
+    }
+    atomic_store_explicit(&e->closed_len, e->looplen * FRAMESIZE,
+        memory_order_release);
+    engine_notify(e, NOTE_LOOP_CLOSED, -1, e->looplen);
+}
+
+static void applyRecord(struct engine *e, const struct engine_cmd *cmd){
+    struct tracks *t = &e->tracks;
+    trackmask_t bit = TRACK_BIT(cmd->track);
+
+    if (cmd->value) {
+        t->recording |= bit;
+    } else {
+        t->recording &= ~bit;
+    }
+    //while looping fade_gain only catches up once the period's writes are
+    //done, so any change counts as fading until settleTracks says otherwise
+    t->fading |= bit;
+    if (e->state == ENGINE_WAITING && cmd->value) {
+        e->state = ENGINE_INITIAL;
+        e->looplen = 0;
+        engine_notify(e, NOTE_INITIAL_RECORDING, -1, 0);
+    }
+}
+
+static void applyPending(struct engine *e){
+    applyRecord(e, &e->pending[0]);
+    e->npending--;
+    memmove(e->pending, e->pending + 1, e->npending * sizeof(e->pending[0]));
+}
+
+// the press that starts the initial recording came at frame start + offset.
+// if the nearest onset in the history came before it, the downbeat a late
+// foot missed is still there: the loop starts at it instead, with the
+// frames up to the press written in as though it had been on time. the
+// loop gets as many whole periods in front as that takes. returns the
+// frames reached back.
+static int reachBack(struct engine *e, long long start, int offset){
+    long long press = start + offset;
+    long long reach = e->lookback;
+    long long from, origin, at;
+    int k;
+
+    if (reach > e->history_frames - WINDOW_FRAMES) {
+        reach = e->history_frames - WINDOW_FRAMES;
+    }
+    if (reach > e->max_frames / 2) {
+        reach = e->max_frames / 2;
+    }
+    if (reach > press) {
+        reach = press;
+    }
+    if (reach <= 0) {
+        return 0;
+    }
+    //whatever has come in since, up to the period just captured, counts
+    //for nearness too
+    at = onset_nearest(e->history, e->history_frames, press - reach, e->frames + FRAMESIZE, press);
+    if (at < 0 || at >= press) {
+        return 0;
+    }
+    //punching in fades, so it starts a fade early to keep the attack whole
+    from = at - XFADE_FRAMES < press - reach ? press - reach : at - XFADE_FRAMES;
+    k = from < start ? (start - from + FRAMESIZE - 1) / FRAMESIZE : 0;
+    origin = start - (long long)k * FRAMESIZE;
+    e->looplen = k;
+    for (at=from; at<press; ){
+        int h = at % e->history_frames;
+        int n = press - at < e->history_frames - h ? press - at : e->history_frames - h;
+        recordSpan(e, e->history + FRAMES_TO_SAMPLES(h), at - origin, n);
+        at += n;
+    }
+    return press - from;
+}
+
+// one delayed period of input, captured from absolute frame start. pending
+// commands cut it into segments so each one lands on its own sample.
+static void handleReadin(struct engine *e, const sample_t *in, long long start){
+    int offset = 0;
+    int waiting, reached;
+
+    if (e->state == ENGINE_INITIAL &&
+            (e->looplen + 1) * FRAMESIZE >
+            atomic_load_explicit(&e->committed, memory_order_acquire)) {
+        //the recording also ends if it catches up with committed storage.
+        //this period is then the first of the loop's second pass.
+        closeLoop(e);
+        e->count = EVENT_WINDOW % e->looplen;
+    }
+    if (e->state == ENGINE_LOOPING) {
+        //where the play head was when this period came in, pulled back
+        //by the latency
+        e->rec_pos = (e->passes * e->looplen + e->count - EVENT_WINDOW) * FRAMESIZE -
+            e->latency;
+    }
+
+    while (offset < FRAMESIZE) {
+        int end = FRAMESIZE;
+
+        //anything due by now applies here, late ones included
+        while (e->npending) {
+            long long at = e->pending[0].at;
+            if (at > start + offset) {
+                if (at < start + FRAMESIZE) {
+                    end = at - start;
+                }
+                break;
+            }
+            waiting = e->state == ENGINE_WAITING;
+            applyPending(e);
+            if (waiting && e->state == ENGINE_INITIAL && (reached = reachBack(e, start, offset))) {
+                engine_notify(e, NOTE_REACHED_BACK, -1, reached);
+            }
+        }
+
+        if (e->state == ENGINE_INITIAL) {
+            recordSpan(e, in + FRAMES_TO_SAMPLES(offset),
+                e->looplen * FRAMESIZE + offset, end - offset);
+        } else if (e->state == ENGINE_LOOPING) {
+            recordSpan(e, in + FRAMES_TO_SAMPLES(offset),
+                e->rec_pos + offset, end - offset);
+        }
+        offset = end;
+    }
+
+    if (e->state == ENGINE_INITIAL) {
+        settleTracks(e);
+        e->looplen++;
+        atomic_store_explicit(&e->recorded, e->looplen * FRAMESIZE,
+            memory_order_relaxed);
+        //closes once the last punch out has faded
+        if (!e->tracks.recording && !e->tracks.fading) {
+            closeLoop(e);
+        }
+    }
+}
+
+// snaps input frame at to the nearest of quantize divisions of the loop
+static long long quantizeAt(struct engine *e, long long at){
+    long long LOOPLENN = e->looplen * FRAMESIZE;
+    long long addr;
+    long long line;
+
+    //the loop address input frame at lands on
+    addr = at - e->frames + (long long)e->count * FRAMESIZE - e->latency;
+    addr %= LOOPLENN;
+    if (addr < 0) {
+        addr += LOOPLENN;
+    }
+    line = (addr * e->quantize + LOOPLENN / 2) / LOOPLENN;
+    return at + line * LOOPLENN / e->quantize - addr;
+}
+
+static void queueRecord(struct engine *e, struct engine_cmd *cmd){
+    int i;
+
+    //as soon as possible is the period coming in right now
+    if (cmd->at < 0) {
+        cmd->at = e->frames;
+    }
+    if (e->quantize && e->state == ENGINE_LOOPING) {
+        cmd->at = quantizeAt(e, cmd->at);
+    }
+    //out of room, the earliest one goes in early rather than out of order
+    if (e->npending == PENDING_MAX) {
+        applyPending(e);
+    }
+    //stable, so presses stamped alike keep their order
+    for (i=e->npending; i>0 && e->pending[i-1].at > cmd->at; i--){
+        e->pending[i] = e->pending[i-1];
+    }
+    e->pending[i] = *cmd;
+    e->npending++;
+}
+
+static void undoTrack(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    struct layer *l = t->applied[x];
+
+    if (t->passing & TRACK_BIT(x)) {
+        //the table never saw the take. if the track is still recording a
+        //new one starts next period, faded in again. a take written in
+        //place is there for good.
+        if (t->take[x]) {
+            dropTake(e, x);
+            t->take[x] = NULL;
+            t->passing &= ~TRACK_BIT(x);
+            t->fade_gain[x] = 0;
+            t->fading |= TRACK_BIT(x);
+        }
+        return;
+    }
+    if (l) {
+        stopGhost(t, x);
+        swapLayer(e, l);
+        t->applied[x] = l->older;
+    }
+}
+
+static void redoTrack(struct engine *e, int x){
+    struct tracks *t = &e->tracks;
+    struct layer *l = t->applied[x] ? t->applied[x]->newer : t->oldest[x];
+
+    if (l && !(t->passing & TRACK_BIT(x))) {
+        stopGhost(t, x);
+        swapLayer(e, l);
+        t->applied[x] = l;
+    }
+}
+
+// what track x plays for the period at the play head, NULL for silence.
+// mostly that's straight out of a chunk. a period the track wraps in, or
+// that crosses a chunk or block, is put together in its fadeout buffer,
+// as is a ghosting track's: itself if it is audible, over what the reset
+// emptied out, ramped down.
+static const sample_t *playTrack(struct engine *e, int x, int audible){
+    struct tracks *t = &e->tracks;
+    sample_t old[PERIOD_SAMPLES];
+    const sample_t *now = NULL;
+    int frames = FRAMESIZE;
+    int n;
+
+    if (audible) {
+        now = playPiece(e, x, NULL, e->play_pos, &frames);
+    }
+    if (frames == FRAMESIZE && !(t->ghosting & TRACK_BIT(x))) {
+        return now;
+    }
+    if (audible) {
+        playFrames(e, x, NULL, e->play_pos, t->fadeout[x], FRAMESIZE);
+    } else {
+        memset(t->fadeout[x], 0, sizeof(t->fadeout[x]));
+    }
+    if (!(t->ghosting & TRACK_BIT(x))) {
+        return t->fadeout[x];
+    }
+    n = t->ghost_gain[x] / XFADE_STEP;
+    if (n > FRAMESIZE) {
+        n = FRAMESIZE;
+    }
+    playFrames(e, x, t->ghost[x], e->play_pos, old, n);
+    record_add_ramp(t->fadeout[x], old, n, t->ghost_gain[x], -XFADE_STEP);
+    t->ghost_gain[x] -= n * XFADE_STEP;
+    return t->fadeout[x];
+}
+
+// the length of track x as CMD_LENGTH gives it
+static int lengthRatio(struct engine *e, int x){
+    int len = e->tracks.len[x];
+    int looplen = e->looplen * FRAMESIZE;
+
+    return len >= looplen ? len / looplen : -(looplen / len);
+}
+
+// the frames a track loops over with the master loop looplen frames
+// long, for CMD_LENGTH's ratio. -1 if it can't: too long or short, or
+// not a whole number of frames.
+static int ratioLength(int looplen, int ratio, int max_frames){
+    long long len;
+
+    if (ratio == 0 || ratio > TRACK_MAX_RATIO || ratio < -TRACK_MAX_RATIO) {
+        return -1;
+    }
+    if (ratio > 0) {
+        len = (long long)looplen * ratio;
+    } else if (looplen % -ratio == 0) {
+        len = looplen / -ratio;
+    } else {
+        return -1;
+    }
+    return len < FRAMESIZE || len > max_frames ? -1 : len;
+}
+
+// CMD_LENGTH. the new length goes in as a layer, so undo brings the old
+// one back. notes the length the track has either way.
+static void lengthTrack(struct engine *e, int x, int ratio){
+    struct tracks *t = &e->tracks;
+    trackmask_t busy = t->passing | t->recording | t->fading | t->reset |
+        t->reset_held | t->ghosting;
+    int len = ratioLength(e->looplen * FRAMESIZE, ratio, e->max_frames);
+    int nchunks = trackChunks(t->len[x]);
+    struct layer *l;
+    int c;
+
+    if (e->state != ENGINE_LOOPING) {
+        engine_notify(e, NOTE_LENGTH, x, 0);
+        return;
+    }
+    for (c=0; c<nchunks && !t->peak[x][c]; c++);
+    if (len < 0 || len == t->len[x] || c < nchunks || (busy & TRACK_BIT(x)) ||
+            !(l = undo_take_layer(&e->undo))) {
+        engine_notify(e, NOTE_LENGTH, x, lengthRatio(e, x));
+        return;
+    }
+    l->track = x;
+    l->n = 0;
+    l->len = len;
+    //the track is silent and its chunks stay. only the one the old length
+    //ends partway into goes, it has nothing to go by past there, maybe
+    //not even storage, and past the old end whatever a take written in
+    //place before an undo left.
+    for (c=0; c<trackChunks(len); c++){
+        int end = c == nchunks - 1 && t->len[x] % CHUNK_FRAMES && len > t->len[x];
+        if (end || (c >= nchunks && (t->peak[x][c] || t->packed[x][c]))) {
+            l->chunk[l->n] = c;
+            l->ptr[l->n] = NULL;
+            l->peak[l->n] = 0;
+            l->packed[l->n++] = NULL;
+        }
+    }
+    pushLayer(e, x, l);
+    engine_notify(e, NOTE_LENGTH, x, lengthRatio(e, x));
+}
+
+// a track made longer than the loop gets the slices of its own store the
+// control side has made ready, where its table has nothing. like the
+// loop's own slices each goes in once, and one that finds its chunk in
+// use is never used.
+static void takeSlices(struct engine *e){
+    struct tracks *t = &e->tracks;
+    int x, c;
+
+    for (x=0; x<t->count; x++){
+        int stored = atomic_load_explicit(&e->stored[x], memory_order_acquire);
+        for (; t->slices[x] < stored; t->slices[x] += CHUNK_FRAMES){
+            c = t->slices[x] / CHUNK_FRAMES;
+            if (!t->table[x][c] && !t->pass[x][c] && !t->packed[x][c]) {
+                t->peak[x][c] = 0;
+                __atomic_store_n(&t->table[x][c],
+                    t->body[x] + (size_t)c * FRAMES_TO_SAMPLES(CHUNK_FRAMES), __ATOMIC_RELEASE);
+            }
+        }
+    }
+}
+
+// swaps in the packs the control side offers, if the track is still as it
+// was packed, nothing is under way on it, and the pool can still keep a
+// chunk back for every pack. the raw chunks go into a layer that's
+// retired at once, which gives them back: pool chunks to the pool, slices
+// of the loop to the system. nobody hears the difference, so the
+// generation stays as it is.
+static void takePacked(struct engine *e){
+    struct tracks *t = &e->tracks;
+    struct pack_job *j = &e->job;
+    trackmask_t busy = t->passing | t->recording | t->fading | t->reset |
+        t->reset_held | t->ghosting;
+    struct layer *l;
+    int x, c, i;
+
+    if (atomic_load_explicit(&e->pack_state, memory_order_acquire) != PACK_OFFERED) {
+        return;
+    }
+    x = j->track;
+    if ((busy & TRACK_BIT(x)) ||
+            atomic_load_explicit(&e->generation[x], memory_order_relaxed) != j->gen ||
+            !poolKeeps(e, j->n) || !(l = undo_take_layer(&e->undo))) {
+        atomic_store_explicit(&e->pack_state, PACK_REFUSED, memory_order_release);
+        return;
+    }
+    l->track = x;
+    l->n = j->n;
+    for (i=0; i<j->n; i++){
+        c = j->chunk[i];
+        l->chunk[i] = c;
+        l->ptr[i] = t->table[x][c];
+        l->peak[i] = 0;
+        l->packed[i] = t->packed[x][c];
+        t->packed[x][c] = j->packed[i];
+        //engine_read_track looks for the pack once the chunk is gone
+        __atomic_store_n(&t->table[x][c], NULL, __ATOMIC_RELEASE);
+    }
+    t->packs |= TRACK_BIT(x);
+    countPacked(e, x);
+    undo_retire(&e->undo, l);
+    atomic_store_explicit(&e->pack_state, PACK_TAKEN, memory_order_release);
+    engine_notify(e, NOTE_PACKED, x, (int)(j->bytes * 100 / j->raw));
+}
+
+// the tracks nobody has recorded on for pack_idle, for the control side
+// to pack. a take held open, or a reset, counts as being recorded on.
+static void noteIdle(struct engine *e){
+    struct tracks *t = &e->tracks;
+    trackmask_t idle = 0;
+    trackmask_t m;
+    int x;
+
+    for (m = e->active | t->passing | t->reset_held; m; ){
+        x = tracks_next(&m);
+        t->busy_at[x] = e->frames;
+    }
+    for (x=0; x<t->count && e->pack_idle; x++){
+        if (e->frames - t->busy_at[x] >= e->pack_idle) {
+            idle |= TRACK_BIT(x);
+        }
+    }
+    atomic_store_explicit(&e->idle, idle, memory_order_relaxed);
+}
+
+static void drainCommands(struct engine *e){
+    struct tracks *t = &e->tracks;
+    struct engine_cmd cmd;
+    trackmask_t bit;
+
+    while (ring_pop(&e->cmds, &cmd)) {
+        if (cmd.type == CMD_QUANTIZE) {
+            e->quantize = cmd.value > 0 ? cmd.value : 0;
+            continue;
+        }
+        if (cmd.track < 0 || cmd.track >= t->count) {
+            continue;
+        }
+        bit = TRACK_BIT(cmd.track);
+        switch (cmd.type) {
+        case CMD_RECORD:
+            queueRecord(e, &cmd);
+            break;
+        case CMD_RESET:
+            t->reset_held = cmd.value ? t->reset_held | bit : t->reset_held & ~bit;
+            break;
+        case CMD_GAIN:
+            if (cmd.value >= 0 && cmd.value <= MIX_MAX_GAIN) {
+                t->gain[cmd.track] = cmd.value;
+                t->silent = cmd.value ? t->silent & ~bit : t->silent | bit;
+            }
+            break;
+        case CMD_MUTE:
+            t->muted = cmd.value ? t->muted | bit : t->muted & ~bit;
+            break;
+        case CMD_UNDO:
+            undoTrack(e, cmd.track);
+            break;
+        case CMD_REDO:
+            redoTrack(e, cmd.track);
+            break;
+        case CMD_LENGTH:
+            lengthTrack(e, cmd.track, cmd.value);
+            break;
+        }
+    }
+}
+
+// one group's share of a looping period, run on whichever lane claims it:
+// the record work for its tracks, then their mix onto the group's bus.
+// tracks don't share anything, so this comes out as it would in series.
+static void mixGroup(void *arg, int g){
+    struct engine *e = arg;
+    struct tracks *t = &e->tracks;
+    struct mix_source sources[MAX_TRACKS];
+    accum_t *bus = e->submix + g * PERIOD_SAMPLES;
+    int nsources = 0;
+    int x;
+
+    for (x=e->group_start[g]; x<e->group_start[g+1]; x++){
+        if (e->active & TRACK_BIT(x)) {
+            recordTrack(e, x);
+        }
+        if ((e->heard & TRACK_BIT(x)) &&
+                (sources[nsources].samples = playTrack(e, x,
+                    (e->audible & TRACK_BIT(x)) != 0))) {
+            sources[nsources].gain = t->gain[x];
+            nsources++;
+        }
+        if (e->audible & t->packs & TRACK_BIT(x)) {
+            readAhead(e, x);
+        }
+    }
+    memset(bus, 0, sizeof(accum_t) * PERIOD_SAMPLES);
+    mix_partial(bus, sources, nsources, PERIOD_SAMPLES);
+}
+
+// when the groups have to be in by. only a driver that keeps the clock
+// has a deadline; offline nothing is ever late.
+static long long mixDeadline(struct engine *e){
+    struct timespec ts;
+
+    if (!atomic_load_explicit(&e->clock_seq, memory_order_relaxed) || e->skipping) {
+        return LLONG_MAX;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec +
+        (long long)FRAMESIZE * 1000000000LL / e->rate * MIX_BUDGET_PERCENT / 100;
+}
+
+// sends the groups out on the pool and sums the buses that come back in
+// time. a late group still finishes its record work before the next
+// period starts, it just isn't heard this once.
+static void mixGroups(struct engine *e, sample_t *out){
+    accum_t bus[PERIOD_SAMPLES];
+    long long deadline = mixDeadline(e);
+    int late = 0;
+    int g;
+    int i;
+
+    pool_run(e->pool, mixGroup, e, e->ngroups);
+    e->batch = 1;
+    pool_wait(e->pool, deadline);
+
+    memset(bus, 0, sizeof(bus));
+    for (g=0; g<e->ngroups; g++){
+        const accum_t *sub = e->submix + g * PERIOD_SAMPLES;
+        if (!pool_task_done(e->pool, g)) {
+            late++;
+            continue;
+        }
+        for (i=0; i<PERIOD_SAMPLES; i++){
+            bus[i] += sub[i];
+        }
+    }
+    accum_to_sample(out, bus, PERIOD_SAMPLES);
+    if (late) {
+        engine_notify(e, NOTE_LATE, -1, late);
+    }
+}
+
+// input goes through the history and is recorded EVENT_WINDOW periods
+// late, by which time any pedal event that belongs in it has arrived.
+// playback is not delayed.
+void engine_process(struct engine *e, const sample_t *in, sample_t *out){
+    struct tracks *t = &e->tracks;
+    struct mix_source sources[MAX_TRACKS];
+    int nsources = 0;
+    trackmask_t m;
+    int x;
+
+    //the groups still out from last period touch everything below
+    if (e->batch) {
+        pool_sync(e->pool);
+        settleTracks(e);
+        e->batch = 0;
+    }
+    e->nspans = 0;
+    e->active = 0;
+
+    drainCommands(e);
+    if (e->state == ENGINE_LOOPING && !e->silence_dropped &&
+            atomic_load_explicit(&e->undo.ready, memory_order_acquire)) {
+        dropSilence(e);
+    }
+    if (e->state == ENGINE_LOOPING) {
+        takePacked(e);
+        takeSlices(e);
+    }
+
+    //a new reset empties its track if it can. one that couldn't keeps
+    //pushing its resetpoint forward while held, and clears a whole pass
+    //of the track.
+    if (e->state == ENGINE_LOOPING) {
+        for (m = t->reset_held & ~t->reset; m; ){
+            x = tracks_next(&m);
+            if (flipTrack(e, x)) {
+                t->flipped |= TRACK_BIT(x);
+            }
+        }
+        for (m = t->reset_held & ~t->flipped; m; ){
+            x = tracks_next(&m);
+            t->resetpoint[x] = e->passes * e->looplen + e->count;
+        }
+        t->reset |= t->reset_held;
+    }
+
+    memcpy(e->history + FRAMES_TO_SAMPLES(e->frames % e->history_frames), in,
+        sizeof(sample_t) * PERIOD_SAMPLES);
+    if (e->frames >= EVENT_WINDOW * FRAMESIZE) {
+        long long start = e->frames - EVENT_WINDOW * FRAMESIZE;
+        handleReadin(e, e->history + FRAMES_TO_SAMPLES(start % e->history_frames), start);
+    }
+    e->frames += FRAMESIZE;
+
+    if (e->state != ENGINE_LOOPING) {
+        memset(out, 0, sizeof(sample_t) * PERIOD_SAMPLES);
+        tapOutput(e, out);
+        return;
+    }
+
+    e->play_pos = (e->passes * e->looplen + e->count) * FRAMESIZE;
+    atomic_store_explicit(&e->decode_budget, e->decode_share, memory_order_relaxed);
+
+    prepareTakes(e);
+    noteIdle(e);
+
+    //only tracks that are not reset, muted or silent are heard, besides
+    //the fade out of a reset
+    e->audible = t->all & ~(t->reset | t->muted | t->silent);
+    e->heard = e->audible | (t->ghosting & ~(t->muted | t->silent));
+    if (e->pool) {
+        mixGroups(e, out);
+    } else {
+        for (m = e->active; m; ){
+            recordTrack(e, tracks_next(&m));
+        }
+        for (m = e->heard; m; ){
+            x = tracks_next(&m);
+            sources[nsources].samples = playTrack(e, x,
+                (e->audible & TRACK_BIT(x)) != 0);
+            if (sources[nsources].samples) {
+                sources[nsources].gain = t->gain[x];
+                nsources++;
+            }
+        }
+        for (m = e->audible & t->packs; m; ){
+            readAhead(e, tracks_next(&m));
+        }
+        settleTracks(e);
+        mix(out, sources, nsources, PERIOD_SAMPLES);
+    }
+
+    /* increment count for next loop */
+    e->count = (e->count + 1) % e->looplen;
+    if (e->count == 0) {
+        e->passes++;
+    }
+
+    /* a let go reset is done once the track is empty */
+    for (m = t->reset & ~t->reset_held; m; ){
+        x = tracks_next(&m);
+        if ((t->flipped & TRACK_BIT(x)) || e->passes * e->looplen + e->count -
+                t->resetpoint[x] >= (t->len[x] + FRAMESIZE - 1) / FRAMESIZE) {
+            t->resetpoint[x] = -1;
+            t->reset &= ~TRACK_BIT(x);
+            t->flipped &= ~TRACK_BIT(x);
+            engine_notify(e, NOTE_RESET_DONE, x, 0);
+        }
+    }
+
+    if(e->count == 0){
+        engine_notify(e, NOTE_WRAP, -1, 0);
+    }
+    tapOutput(e, out);
+}
+
+void engine_skip(struct engine *e, long long frames){
+    sample_t silence[PERIOD_SAMPLES];
+    sample_t out[PERIOD_SAMPLES];
+
+    memset(silence, 0, sizeof(silence));
+    e->skipping = 1;
+    for (; frames >= FRAMESIZE; frames -= FRAMESIZE){
+        engine_process(e, silence, out);
+    }
+    e->skipping = 0;
+}
+
+// frames of pack p from frame from on into dst, a block at a time
+static void unpackFrames(const struct pack *p, sample_t *dst, int from, int frames){
+    sample_t block[FRAMES_TO_SAMPLES(PACK_BLOCK_FRAMES)];
+
+    while (frames > 0) {
+        int n = PACK_BLOCK_FRAMES - from % PACK_BLOCK_FRAMES;
+        if (n > frames) {
+            n = frames;
+        }
+        pack_decode_block(p, from / PACK_BLOCK_FRAMES, block);
+        memcpy(dst, block + FRAMES_TO_SAMPLES(from % PACK_BLOCK_FRAMES),
+            sizeof(sample_t) * FRAMES_TO_SAMPLES(n));
+        dst += FRAMES_TO_SAMPLES(n);
+        from += n;
+        frames -= n;
+    }
+}
+
+unsigned engine_read_track(struct engine *e, int x, sample_t *dst, int from, int frames){
+    unsigned gen = atomic_load_explicit(&e->generation[x], memory_order_acquire);
+    sample_t **table = e->tracks.table[x];
+    struct pack **packed = e->tracks.packed[x];
+    const struct pack *p;
+
+    while (frames > 0) {
+        int n = CHUNK_FRAMES - from % CHUNK_FRAMES;
+        const sample_t *chunk;
+        if (n > frames) {
+            n = frames;
+        }
+        //a chunk can't be given back while it's being copied
+        pthread_mutex_lock(&e->service_lock);
+        chunk = __atomic_load_n(&table[from / CHUNK_FRAMES], __ATOMIC_ACQUIRE);
+        if (chunk) {
+            memcpy(dst, chunk + FRAMES_TO_SAMPLES(from % CHUNK_FRAMES),
+                sizeof(sample_t) * FRAMES_TO_SAMPLES(n));
+        } else if ((p = __atomic_load_n(&packed[from / CHUNK_FRAMES], __ATOMIC_ACQUIRE))) {
+            unpackFrames(p, dst, from % CHUNK_FRAMES, n);
+        } else {
+            memset(dst, 0, sizeof(sample_t) * FRAMES_TO_SAMPLES(n));
+        }
+        pthread_mutex_unlock(&e->service_lock);
+        dst += FRAMES_TO_SAMPLES(n);
+        from += n;
+        frames -= n;
+    }
+    return gen;
+}
+
+int engine_track_length(struct engine *e, int x){
+    return __atomic_load_n(&e->tracks.len[x], __ATOMIC_RELAXED);
+}
+
+int engine_longest_track(struct engine *e, int frames){
+    return (long long)frames * TRACK_MAX_RATIO < e->max_frames ?
+        frames * TRACK_MAX_RATIO : e->max_frames;
+}
+
+int engine_restore(struct engine *e, int frames, const sample_t *const *loops,
+                const int *lengths){
+    struct tracks *t = &e->tracks;
+    int len[MAX_TRACKS];
+    int err;
+    int x, c;
+
+    if (e->state != ENGINE_WAITING || frames <= 0 || frames % FRAMESIZE || frames > e->max_frames) {
+        return -EINVAL;
+    }
+    for (x=0; x<t->count; x++){
+        len[x] = lengths && lengths[x] ? lengths[x] : frames;
+        if (len[x] != ratioLength(frames, len[x] >= frames ? len[x] / frames :
+                -(frames / len[x]), e->max_frames)) {
+            return -EINVAL;
+        }
+    }
+    for (x=0; x<t->count; x++){
+        if ((err = loopstore_commit(&e->stores[x], len[x])) < 0) {
+            return err;
+        }
+        if (loops[x]) {
+            memcpy(t->body[x], loops[x], sizeof(sample_t) * FRAMES_TO_SAMPLES(len[x]));
+        }
+    }
+    e->looplen = frames / FRAMESIZE;
+    atomic_store_explicit(&e->recorded, frames, memory_order_relaxed);
+    closeLoop(e);
+    e->count = 0;
+
+    //closing made every track the loop's length
+    for (x=0; x<t->count; x++){
+        t->len[x] = len[x];
+        t->slices[x] = trackChunks(len[x]) * CHUNK_FRAMES;
+        for (c=0; c<trackChunks(len[x]); c++){
+            int n = len[x] - c * CHUNK_FRAMES < CHUNK_FRAMES ? len[x] - c * CHUNK_FRAMES : CHUNK_FRAMES;
+            t->table[x][c] = t->body[x] + (size_t)c * FRAMES_TO_SAMPLES(CHUNK_FRAMES);
+            t->peak[x][c] = peakOf(t->table[x][c], n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,433 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "ring.h"
+#include "sample.h"
+#include "loopstore.h"
+#include "pack.h"
+#include "pool.h"
+#include "undo.h"
+
+// the rate engine_init runs at when it isn't given one
+#define SAMPLE_HZ 44100
+// tracks are picked at engine_init, up to one bit each in a trackmask_t
+#define MAX_TRACKS 64
+// one per pair of pedals on the board
+#define DEFAULT_TRACKS 3
+
+// bufers, all in frames
+#define FRAMESIZE 32
+// longest loop unless engine_init is given another. that much address
+// space is reserved per track; only what gets recorded is backed.
+#define MAX_LOOP_SECONDS 300
+// how far ahead of the initial recording storage is kept committed
+#define COMMIT_AHEAD_SECONDS 4
+
+// the record path runs this many periods behind the input, so pedal events
+// stamped up to that long ago still land on their exact sample
+#define EVENT_WINDOW 8
+// timed commands waiting for the record path to reach them, room for a
+// press and a release on every track
+#define PENDING_MAX (2 * MAX_TRACKS)
+// crossfade at every punch in and out, in frames
+#define XFADE_FRAMES 64
+// input kept on top of the EVENT_WINDOW, for the first press to reach
+// back into, at whatever rate the engine runs
+#define MAX_LOOKBACK_MS 2000
+
+#define PERIOD_SAMPLES FRAMES_TO_SAMPLES(FRAMESIZE)
+
+// with mix workers the tracks are split into about this many groups per
+// lane, so a lane that finishes early has another group to take
+#define GROUPS_PER_LANE 2
+#define MAX_GROUPS (GROUPS_PER_LANE * (POOL_MAX_WORKERS + 1))
+// share of a period the groups get before the late ones are left out of
+// that period's output
+#define MIX_BUDGET_PERCENT 75
+
+// a track nobody has recorded on for this long is packed, see pack.h,
+// unless the control side says otherwise
+#define DEFAULT_PACK_IDLE_SECONDS 30
+// blocks of a packed track kept decoded for playback, the one playing and
+// those after it
+#define AHEAD_BLOCKS 4
+// a track loops over up to this many times the master loop, or as little
+// as this fraction of it, see CMD_LENGTH
+#define TRACK_MAX_RATIO 8
+
+typedef uint64_t trackmask_t;
+#define TRACK_BIT(i) ((trackmask_t)1 << (i))
+
+// the track table, as a struct of arrays. what the period loop reads per
+// track sits in arrays indexed by track, and every yes/no is a bitmask,
+// so asking whether any track is recording is one test and loops walk
+// only the tracks that have something to do.
+struct tracks {
+    int count;
+    trackmask_t all;
+    trackmask_t recording;
+    //fade_gain hasn't caught up with recording yet
+    trackmask_t fading;
+    //being reset: heard no more, and recording overwrites
+    trackmask_t reset;
+    trackmask_t reset_held;
+    //reset by emptying the table, done as soon as it is let go
+    trackmask_t flipped;
+    //what a reset emptied out is still fading, see ghost
+    trackmask_t ghosting;
+    trackmask_t muted;
+    //gain is 0
+    trackmask_t silent;
+    //an overdub take is open, see pass
+    trackmask_t passing;
+    //has had chunks packed, the only ones playback looks for them in
+    trackmask_t packs;
+    //chunks standing as packs alone, with nothing raw in the table or the
+    //take, each of which takes a chunk from the pool once it's written
+    int npacked[MAX_TRACKS];
+    //frames the open take had nowhere to write, see NOTE_LOST
+    int lost[MAX_TRACKS];
+    //frames of its store the track has had the slices of, see stored
+    int slices[MAX_TRACKS];
+
+    //frames each track loops over: the master loop's length, times or
+    //divided by a whole number. its read head is the loop position modulo
+    //this, and nothing is heard from its chunks past the end. until the
+    //loop closes it's all the storage there is.
+    int len[MAX_TRACKS];
+    //start of each loop, interleaved samples backed by a loopstore. the
+    //initial recording goes straight in here.
+    sample_t *body[MAX_TRACKS];
+    //the loop as CHUNK_FRAMES chunks, the generation playback reads. to
+    //begin with these are just slices of body. NULL is silence, and only
+    //gets a chunk once something is recorded there.
+    sample_t **table[MAX_TRACKS];
+    //chunks the open take has copied, NULL where it hasn't written
+    sample_t **pass[MAX_TRACKS];
+    //the loudest each chunk of table and pass can be: raised as it is
+    //written and carried along with it, so never below what's there. 0 is
+    //silence, which is neither mixed nor copied.
+    uint16_t *peak[MAX_TRACKS];
+    uint16_t *pass_peak[MAX_TRACKS];
+    //the chunk packed, for a track that's only played back. it's what's
+    //heard where table is NULL, and goes in and out of layers along with
+    //the chunk in table, stale or not, until the layer lets go of it.
+    struct pack **packed[MAX_TRACKS];
+    //packed chunks decoded ahead of the play head, AHEAD_BLOCKS blocks
+    //of them. slot i holds the block played ahead_at[i]th since looping
+    //started, of the pack with ahead_id[i].
+    sample_t *ahead[MAX_TRACKS];
+    long long ahead_at[MAX_TRACKS][AHEAD_BLOCKS];
+    unsigned ahead_id[MAX_TRACKS][AHEAD_BLOCKS];
+    //input frame the track was last written to or held up by a take
+    long long busy_at[MAX_TRACKS];
+    //where the open take keeps what it replaces, NULL if it writes in place
+    struct layer *take[MAX_TRACKS];
+    //chunks the take copied this period, for recordTrack to fill in
+    int ncopy[MAX_TRACKS];
+    int copy[MAX_TRACKS][3];
+    //newest layer undo would take out, and the oldest one kept
+    struct layer *applied[MAX_TRACKS];
+    struct layer *oldest[MAX_TRACKS];
+    //Q14 playback gain, see mix.h
+    int32_t gain[MAX_TRACKS];
+    //how much of the input currently goes in, RECORD_FULL when recording.
+    //ramps over XFADE_FRAMES whenever recording changes.
+    int fade_gain[MAX_TRACKS];
+    //period a reset that couldn't empty the table clears the track from,
+    //counted since looping started. it's done a track's length after.
+    long long resetpoint[MAX_TRACKS];
+    //layer a reset emptied the table into, and how loud it still plays
+    struct layer *ghost[MAX_TRACKS];
+    int ghost_gain[MAX_TRACKS];
+    //a period of a track that's in pieces, where it wraps or crosses a
+    //chunk or block, or is ghosting, with the fade out mixed in
+    sample_t fadeout[MAX_TRACKS][PERIOD_SAMPLES];
+};
+
+// a stretch of one delayed period of input that goes into the same tracks
+// the same way, with the track state as it was for it
+struct span {
+    const sample_t *in;
+    //loop position it starts at, see tracks.len. may be short of 0 early
+    //on, before the play head is a period's latency in.
+    long long pos;
+    int frames;
+    trackmask_t recording;
+    trackmask_t reset;
+    //every track the span writes to
+    trackmask_t active;
+    //loudest sample of in
+    int peak;
+};
+
+// pops the lowest track off a mask, for walking the tracks in it
+static inline int tracks_next(trackmask_t *mask){
+    int x = __builtin_ctzll(*mask);
+    *mask &= *mask - 1;
+    return x;
+}
+
+// control thread -> audio thread
+enum engine_cmd_type {
+    CMD_RECORD,     // value: 1 start recording, 0 stop recording
+    CMD_RESET,      // value: 1 reset pressed, 0 released
+    CMD_GAIN,       // value: Q14 gain, MIX_UNITY_GAIN is unity
+    CMD_MUTE,       // value: 1 muted, 0 heard
+    CMD_QUANTIZE,   // value: punch in/out snaps to this many divisions of
+                    // the loop, 0 for off
+    CMD_UNDO,       // drops the take in progress, or the last one kept
+    CMD_REDO,       // puts back the last take undone
+    CMD_LENGTH,     // value: n loops the track over n times the master
+                    // loop, -n over 1/n of it. only an empty track nothing
+                    // is under way on takes it, and undo takes it back.
+};
+
+struct engine_cmd {
+    short type;
+    short track;
+    int value;
+    //input frame a CMD_RECORD takes effect at, -1 for as soon as possible
+    long long at;
+};
+
+// audio thread -> control thread
+enum engine_note_type {
+    NOTE_INITIAL_RECORDING,
+    NOTE_LOOP_CLOSED,   // value: loop length in frames
+    NOTE_RESET_DONE,    // track: channel that finished resetting
+    NOTE_WRAP,          // loop came back around to the start
+    NOTE_XRUN,          // value: device error code
+    NOTE_SKIPPED,       // value: frames lost to an xrun the loop ran on through
+    NOTE_LATE,          // value: track groups that missed the mix deadline
+    NOTE_REACHED_BACK,  // value: frames before the first press the loop starts
+    NOTE_PACKED,        // track: packed while idle, value: percent of the
+                        // memory its chunks took raw
+    NOTE_LENGTH,        // track: asked for a length, value: the length it
+                        // has now, as CMD_LENGTH gives it
+    NOTE_LOST,          // track: a take ended, value: frames of it that were
+                        // never written, the undo pool being out of chunks
+};
+
+struct engine_note {
+    short type;
+    short track;
+    int value;
+};
+
+enum engine_state {
+    ENGINE_WAITING,
+    ENGINE_INITIAL,
+    ENGINE_LOOPING,
+};
+
+// a track packed on the control side, offered to the audio thread to
+// swap in for the chunks it was packed from
+struct pack_job {
+    int track;
+    //generation of the track the chunks were read at
+    unsigned gen;
+    //chunk to look at next
+    int next;
+    int n;
+    int *chunk;
+    struct pack **packed;
+    //bytes the chunks took raw, and packed
+    size_t raw;
+    size_t bytes;
+};
+
+enum pack_state {
+    PACK_NONE,      // the control side has the job
+    PACK_OFFERED,   // the audio thread has
+    PACK_TAKEN,     // and gave it back, the packs are in the table
+    PACK_REFUSED,   // and gave it back untouched
+};
+
+// the looper itself: loop storage, track state and the per period DSP.
+// it knows nothing about the device; audio.c (or anything else) feeds it
+// one period at a time through engine_process.
+struct engine {
+    unsigned int rate;
+    //longest loop, a multiple of FRAMESIZE
+    int max_frames;
+
+    //sample clock: the input frame that had just been captured at clock_ns
+    //(CLOCK_MONOTONIC). written by the driver, read by the control side.
+    atomic_uint clock_seq;
+    atomic_llong clock_frame;
+    atomic_llong clock_ns;
+
+    struct spsc_ring cmds;
+    struct spsc_ring notes;
+
+    struct loopstore stores[MAX_TRACKS];
+    //undo layers and the chunks they keep, set up once the loop closes
+    struct undo undo;
+    //memory the undo history may take, set by the control side before that
+    size_t undo_bytes;
+    //how far back the first press may look for the downbeat it came late
+    //for, in frames, set by the control side before starting. 0 never does,
+    //and it goes no further than MAX_LOOKBACK_MS.
+    int lookback;
+    //frames a track has to go without being recorded on before it's
+    //packed, set by the control side before starting. 0 never packs.
+    int pack_idle;
+    //tracks that have, published by the audio thread every period
+    atomic_ullong idle;
+    //packing, see engine_service. owned by the control side but for the
+    //job while it's offered.
+    struct pack_job job;
+    atomic_int pack_state;
+    unsigned pack_seq;
+    //tracks all packed that could be, as of pack_gen
+    trackmask_t pack_done;
+    unsigned pack_gen[MAX_TRACKS];
+    //npacked over every track, which the pool keeps back for them and a
+    //track is only packed into if it has them to spare
+    atomic_int packed_chunks;
+    //bumped whenever a track's table or length changes: a take kept, undo,
+    //redo
+    atomic_uint generation[MAX_TRACKS];
+    //held by engine_service while it gives back memory the tables may
+    //point at, and by engine_read_track while it reads them
+    pthread_mutex_t service_lock;
+    //every period of output is pushed here too if it's set, see session.h.
+    //periods that don't fit are counted in tap_lost.
+    struct spsc_ring *tap;
+    atomic_uint tap_lost;
+    //pin storage once the loop closes. off when there's no device to keep up with
+    int pin_storage;
+    int stores_locked;
+    //frames of every track the audio thread may write, set by the control side
+    atomic_int committed;
+    //frames taken by the initial recording so far, set by the audio thread
+    atomic_int recorded;
+    //loop length in frames once the initial recording closes, else 0
+    atomic_int closed_len;
+    //frames of each track's store made ready for a track longer than the
+    //loop, set by the control side. its table gets the slices past the
+    //loop from here.
+    atomic_int stored[MAX_TRACKS];
+
+    // everything below is owned by the audio thread once it is started
+    struct tracks tracks;
+    int state;
+    int looplen;
+    int count;
+    //frames to shift incoming audio
+    int latency;
+    //input frames seen so far
+    long long frames;
+    //the last EVENT_WINDOW + 1 periods of input and MAX_LOOKBACK_MS more,
+    //history_frames in all
+    sample_t *history;
+    int history_frames;
+    //timed commands, sorted by when they are due
+    struct engine_cmd pending[PENDING_MAX];
+    int npending;
+    int quantize;
+    unsigned layer_seq;
+
+    //loop position the delayed period of input lands on in LOOPING
+    long long rec_pos;
+    //tracks the record path writes to this period
+    trackmask_t active;
+
+    //mix workers, NULL to do everything on the audio thread
+    struct pool *pool;
+    int ngroups;
+    //tracks group g mixes start at group_start[g]
+    int group_start[MAX_GROUPS + 1];
+    //the groups' record work for this period and what they play
+    struct span spans[FRAMESIZE];
+    int nspans;
+    trackmask_t audible;
+    //audible, and the tracks only heard fading out
+    trackmask_t heard;
+    //frames played since looping started, where every track's read head
+    //is taken from
+    long long play_pos;
+    //one bus per group, summed on the audio thread
+    accum_t *submix;
+    //groups of the last period may still be running
+    int batch;
+    //running through lost input, which nobody hears, so nothing is late
+    int skipping;
+    //times the loop has come back around
+    long long passes;
+    //blocks of packed chunks that may be decoded this period, shared out
+    //over the groups. decode_share is what every period gets: enough for
+    //every track to keep up twice over.
+    atomic_int decode_budget;
+    int decode_share;
+    //the first recording's silent chunks have been let go
+    int silence_dropped;
+};
+
+// sets up ntracks loops (up to MAX_TRACKS), each up to max_frames long
+// (MAX_LOOP_SECONDS if it's 0), and the rings, to run at rate (SAMPLE_HZ
+// if it's 0). no device is involved, so the engine can just as well be
+// driven directly (offline rendering, benchmarks).
+int engine_init(struct engine *e, int ntracks, int max_frames, unsigned int rate);
+void engine_free(struct engine *e);
+// splits the tracks into groups mixed by nworkers threads besides the
+// audio thread, at SCHED_FIFO priority unless it is 0. call before
+// starting the device.
+int engine_start_workers(struct engine *e, int nworkers, int priority);
+
+// the per period callback: one FRAMESIZE period of interleaved input in,
+// one period of output out. runs on the audio thread and never blocks,
+// allocates or prints.
+void engine_process(struct engine *e, const sample_t *in, sample_t *out);
+// audio thread only, for the driver to report things like xruns
+void engine_notify(struct engine *e, int type, int track, int value);
+// audio thread only: the period about to be processed finished capturing
+// at ns on CLOCK_MONOTONIC
+void engine_clock(struct engine *e, long long ns);
+// audio thread only: frames (a multiple of FRAMESIZE) of input were lost,
+// to an xrun. the engine runs on through them as silence, output thrown
+// away, so the loop and the record path stay where the sample clock says
+// they are rather than falling behind by the gap.
+void engine_skip(struct engine *e, long long frames);
+
+// called from the control thread only. engine_send returns 0 if the
+// command ring is full and the command should be retried later.
+int engine_send(struct engine *e, int type, int track, int value);
+int engine_send_at(struct engine *e, int type, int track, int value, long long at);
+int engine_poll(struct engine *e, struct engine_note *note);
+
+// the input frame captured at ns on CLOCK_MONOTONIC, going by the last
+// clock the driver published. -1 if there is no clock yet.
+long long engine_frame_at(struct engine *e, long long ns);
+
+// any thread but the audio one, once the loop has closed: copies frames of
+// track x from address from of its own loop into dst, as playback would
+// hear them without an open take. returns the track's generation before
+// the read; if it has moved on since, a take went in during it and dst
+// may have some of both.
+unsigned engine_read_track(struct engine *e, int x, sample_t *dst, int from, int frames);
+// and the frames it loops over. read it after the generation, which
+// moves on with it.
+int engine_track_length(struct engine *e, int x);
+
+// the longest a track can be with the master loop frames long
+int engine_longest_track(struct engine *e, int frames);
+
+// before the engine is started: skips the initial recording and starts
+// looping frames long, with loops[x] (NULL for silence) in track x. a
+// track is lengths[x] long, a multiple or divisor of frames as CMD_LENGTH
+// allows, or frames if that's 0 or lengths is NULL.
+int engine_restore(struct engine *e, int frames, const sample_t *const *loops,
+                const int *lengths);
+
+// control side housekeeping the audio thread can't do itself: commits loop
+// storage ahead of the initial recording, pins it once the loop closes,
+// sets up the undo history then and frees what it lets go of. packs a
+// chunk of an idle track per call. call it regularly from the control
+// thread.
+void engine_service(struct engine *e);
+
+#endif
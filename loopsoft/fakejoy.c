@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "unojoy.h"
+
+// an UnoJoy board on a pty, for trying the looper's serial reader without
+// one. prints the device to give looper -U, then answers byte requests
+// like the stock sketch and pushes changes after UNOJOY_PUSH like one
+// built with it. buttons are moved by lines on stdin:
+//   <button> <0|1>      release or press, numbered as in unojoy.h
+//   <button>            flip it
+//   wait <ms>
+// blank lines and lines starting with # are skipped. stdin closing
+// releases everything and quits once the last change is out.
+
+struct board {
+    int fd;
+    //dataForController_t, sticks centred
+    unsigned char data[7];
+    int push;
+};
+
+static void sendButtons(struct board *b){
+    unsigned char packet[UNOJOY_PACKET];
+    int i;
+
+    packet[0] = packet[4] = UNOJOY_SYNC;
+    for (i=0; i<UNOJOY_STATE_BYTES; i++){
+        packet[i + 1] = b->data[i];
+        packet[4] ^= b->data[i];
+    }
+    if (write(b->fd, packet, sizeof(packet)) < 0) {
+        perror("fakejoy");
+    }
+}
+
+static void setButton(struct board *b, int button, int value){
+    unsigned char bit = 1 << (button % 8);
+    unsigned char old = b->data[button / 8];
+
+    if (value < 0) {
+        value = !(old & bit);
+    }
+    b->data[button / 8] = value ? old | bit : old & ~bit;
+    if (b->push && b->data[button / 8] != old) {
+        sendButtons(b);
+    }
+}
+
+// requests from the reader, answered like the sketch's timer interrupt
+static void answer(struct board *b){
+    unsigned char in[64];
+    unsigned char out[64];
+    ssize_t n = read(b->fd, in, sizeof(in));
+    int nout = 0;
+    int i;
+
+    for (i=0; i<n; i++){
+        if (in[i] == UNOJOY_PUSH) {
+            b->push = 1;
+            sendButtons(b);
+        } else if (in[i] < sizeof(b->data)) {
+            out[nout++] = b->data[in[i]];
+        }
+    }
+    if (nout && write(b->fd, out, nout) < 0) {
+        perror("fakejoy");
+    }
+}
+
+static long long now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// still answering requests meanwhile
+static void idle(struct board *b, int ms){
+    struct pollfd pfd = { .fd = b->fd, .events = POLLIN };
+    long long until = now() + ms * 1000000LL;
+    long long left;
+
+    while ((left = until - now()) > 0) {
+        if (poll(&pfd, 1, (left + 999999) / 1000000) > 0) {
+            answer(b);
+        }
+    }
+}
+
+static int command(struct board *b, const char *line){
+    int button, value, n;
+
+    if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') {
+        return 0;
+    }
+    if (sscanf(line, "wait %d", &n) == 1) {
+        idle(b, n);
+        return 0;
+    }
+    n = sscanf(line, "%d %d", &button, &value);
+    if (n < 1 || button < 0 || button >= UNOJOY_BUTTONS) {
+        return -1;
+    }
+    setButton(b, button, n == 2 ? !!value : -1);
+    return 0;
+}
+
+// whole lines off stdin, a read at a time so poll sees the rest coming.
+// returns 0 at the end.
+static int readLines(struct board *b, char *buf, int *fill, int size){
+    ssize_t n = read(fileno(stdin), buf + *fill, size - 1 - *fill);
+    char *line = buf;
+    char *end;
+
+    if (n <= 0) {
+        return n < 0 && errno == EINTR;
+    }
+    *fill += n;
+    buf[*fill] = '\0';
+    while ((end = strchr(line, '\n'))) {
+        *end = '\0';
+        if (command(b, line) < 0) {
+            fprintf(stderr, "fakejoy: expected <button> [0|1] or wait <ms>\n");
+        }
+        line = end + 1;
+    }
+    *fill -= line - buf;
+    memmove(buf, line, *fill);
+    //a line too long for the buffer is dropped
+    if (*fill == size - 1) {
+        *fill = 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]){
+    struct board board;
+    struct pollfd fds[2];
+    struct termios tio;
+    char lines[256];
+    int fill = 0;
+    int slave;
+    int i;
+
+    memset(&board, 0, sizeof(board));
+    memset(board.data + UNOJOY_STATE_BYTES, 128, sizeof(board.data) - UNOJOY_STATE_BYTES);
+    if ((board.fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+            grantpt(board.fd) < 0 || unlockpt(board.fd) < 0) {
+        perror("fakejoy: no pty");
+        return 1;
+    }
+    //held open and raw so nothing is echoed back before the reader comes
+    //along, and a reader leaving isn't a hangup
+    if ((slave = open(ptsname(board.fd), O_RDWR | O_NOCTTY)) < 0 ||
+            tcgetattr(slave, &tio) < 0) {
+        perror("fakejoy: no pty");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    printf("%s\n", ptsname(board.fd));
+    fflush(stdout);
+
+    fds[0].fd = board.fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = fileno(stdin);
+    fds[1].events = POLLIN;
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            answer(&board);
+        }
+        if (!(fds[1].revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+        if (readLines(&board, lines, &fill, sizeof(lines)) <= 0) {
+            break;
+        }
+    }
+
+    for (i=0; i<UNOJOY_BUTTONS; i++){
+        setButton(&board, i, 0);
+    }
+    //let polls see the release too
+    idle(&board, 1000);
+    close(slave);
+    close(board.fd);
+    return 0;
+}
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "gpio.h"
+
+#define EVENT_RING_SIZE 256
+// kernels before 5.7 stamp v1 line events with CLOCK_REALTIME
+#define MAX_TIMESTAMP_SKEW_NS 1000000000LL
+
+long long gpio_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// an edge, or a wakeup with pin == -1, through the wake pipe
+static int readWake(struct gpio_input *g, struct gpio_event *edge){
+    if (read(g->wake[0], edge, sizeof(*edge)) != sizeof(*edge) || edge->pin < 0) {
+        return 0;
+    }
+    return 1;
+}
+
+/* gpio character device */
+
+static int chardevOpen(struct gpio_input *g){
+    int chip = open(g->chip, O_RDONLY);
+    int i;
+
+    if (chip < 0) {
+        fprintf(stderr, "cannot open %s (%s)\n", g->chip, strerror(errno));
+        return -errno;
+    }
+
+    for (i=0; i<g->npins; i++){
+        struct gpioevent_request req;
+
+        memset(&req, 0, sizeof(req));
+        req.lineoffset = g->lines[i];
+        req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+        req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+        snprintf(req.consumer_label, sizeof(req.consumer_label), "pi-looper");
+
+        if (ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+            int err = errno;
+            fprintf(stderr, "cannot watch gpio line %d (%s)\n", g->lines[i], strerror(err));
+            close(chip);
+            return -err;
+        }
+        g->fds[i] = req.fd;
+    }
+
+    close(chip);
+    return 0;
+}
+
+static int chardevWait(struct gpio_input *g, struct gpio_event *edge, int timeout_ms){
+    struct pollfd fds[GPIO_MAX_PINS + 1];
+    struct gpioevent_data data;
+    int i;
+
+    for (i=0; i<g->npins; i++){
+        fds[i].fd = g->fds[i];
+        fds[i].events = POLLIN;
+    }
+    fds[g->npins].fd = g->wake[0];
+    fds[g->npins].events = POLLIN;
+
+    if (poll(fds, g->npins + 1, timeout_ms) < 0) {
+        return errno == EINTR ? 0 : -errno;
+    }
+    if (fds[g->npins].revents & POLLIN) {
+        return readWake(g, edge);
+    }
+
+    for (i=0; i<g->npins; i++){
+        if (!(fds[i].revents & POLLIN)) {
+            continue;
+        }
+        if (read(g->fds[i], &data, sizeof(data)) != sizeof(data)) {
+            return -EIO;
+        }
+
+        long long now = gpio_now();
+        edge->pin = i;
+        edge->value = data.id == GPIOEVENT_EVENT_RISING_EDGE;
+        edge->when = (long long)data.timestamp;
+        //not on our clock, settle for when we saw it
+        if (edge->when > now || now - edge->when > MAX_TIMESTAMP_SKEW_NS) {
+            edge->when = now;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static int chardevLevel(struct gpio_input *g, int pin){
+    struct gpiohandle_data data;
+
+    if (ioctl(g->fds[pin], GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+        return -errno;
+    }
+    return data.values[0];
+}
+
+static void chardevClose(struct gpio_input *g){
+    int i;
+    for (i=0; i<g->npins; i++){
+        if (g->fds[i] >= 0) {
+            close(g->fds[i]);
+        }
+        g->fds[i] = -1;
+    }
+}
+
+const struct gpio_backend gpio_chardev = {
+    "chardev", chardevOpen, chardevWait, chardevLevel, chardevClose,
+};
+
+/* fake pins for running without hardware */
+
+static int fakeOpen(struct gpio_input *g){
+    int i;
+    //idle pedals read high, see ACTIVE_POSITION in looper.c
+    for (i=0; i<g->npins; i++){
+        g->fake_level[i] = 1;
+    }
+    return 0;
+}
+
+static int fakeWait(struct gpio_input *g, struct gpio_event *edge, int timeout_ms){
+    struct pollfd fd;
+
+    fd.fd = g->wake[0];
+    fd.events = POLLIN;
+    if (poll(&fd, 1, timeout_ms) <= 0) {
+        return 0;
+    }
+    return readWake(g, edge);
+}
+
+static int fakeLevel(struct gpio_input *g, int pin){
+    return g->fake_level[pin];
+}
+
+static void fakeClose(struct gpio_input *g){
+    (void)g;
+}
+
+const struct gpio_backend gpio_fake = {
+    "fake", fakeOpen, fakeWait, fakeLevel, fakeClose,
+};
+
+int gpio_fake_set(struct gpio_input *g, int pin, int value){
+    struct gpio_event edge;
+
+    if (g->backend != &gpio_fake || pin < 0 || pin >= g->npins) {
+        return -EINVAL;
+    }
+    g->fake_level[pin] = value;
+    edge.pin = pin;
+    edge.value = value;
+    edge.when = gpio_now();
+    return write(g->wake[1], &edge, sizeof(edge)) == sizeof(edge) ? 0 : -errno;
+}
+
+/* debouncing */
+
+static void emit(struct gpio_input *g, int pin, int value, long long when){
+    struct gpio_event ev;
+
+    g->state[pin] = value;
+    g->lockout[pin] = gpio_now() + GPIO_DEBOUNCE_MS * 1000000LL;
+
+    ev.pin = pin;
+    ev.value = value;
+    ev.when = when;
+    ring_push(&g->events, &ev);
+}
+
+// the first edge that changes a pin's state is passed on straight away so
+// presses aren't delayed, then the pin is ignored until it has had time to
+// settle, and its level is checked again in case a release got lost in
+// the bounce
+static void *debounceThread(void *arg){
+    struct gpio_input *g = arg;
+    struct gpio_event edge;
+    int i;
+
+    while (atomic_load(&g->running)) {
+        long long now = gpio_now();
+        long long next = 0;
+        int timeout = -1;
+
+        for (i=0; i<g->npins; i++){
+            if (g->lockout[i] && (!next || g->lockout[i] < next)) {
+                next = g->lockout[i];
+            }
+        }
+        if (next) {
+            timeout = next > now ? (int)((next - now) / 1000000) + 1 : 0;
+        }
+
+        int rc = g->backend->wait(g, &edge, timeout);
+        if (rc < 0) {
+            fprintf(stderr, "gpio %s backend failed (%s)\n", g->backend->name, strerror(-rc));
+            break;
+        }
+        if (rc > 0 && !g->lockout[edge.pin] && edge.value != g->state[edge.pin]) {
+            emit(g, edge.pin, edge.value, edge.when);
+        }
+
+        now = gpio_now();
+        for (i=0; i<g->npins; i++){
+            if (!g->lockout[i] || now < g->lockout[i]) {
+                continue;
+            }
+            g->lockout[i] = 0;
+            int level = g->backend->level(g, i);
+            if (level >= 0 && level != g->state[i]) {
+                emit(g, i, level, now);
+            }
+        }
+    }
+    return NULL;
+}
+
+int gpio_open(struct gpio_input *g, const struct gpio_backend *backend,
+                const char *chip, const int *lines, int npins){
+    int err;
+    int i;
+
+    memset(g, 0, sizeof(*g));
+    g->backend = backend;
+    g->chip = chip;
+    g->npins = npins;
+    g->wake[0] = g->wake[1] = -1;
+    atomic_init(&g->running, 0);
+    for (i=0; i<GPIO_MAX_PINS; i++){
+        g->fds[i] = -1;
+    }
+
+    if (npins > GPIO_MAX_PINS) {
+        return -EINVAL;
+    }
+    memcpy(g->lines, lines, sizeof(int) * npins);
+
+    if (pipe(g->wake) < 0) {
+        return -errno;
+    }
+    if (ring_init(&g->events, sizeof(struct gpio_event), EVENT_RING_SIZE) < 0) {
+        gpio_close(g);
+        return -ENOMEM;
+    }
+    if ((err = backend->open(g)) < 0) {
+        gpio_close(g);
+        return err;
+    }
+
+    for (i=0; i<npins; i++){
+        int level = backend->level(g, i);
+        g->state[i] = level < 0 ? 1 : level;
+    }
+    return 0;
+}
+
+void gpio_close(struct gpio_input *g){
+    if (!g->backend) {
+        return;
+    }
+    gpio_stop(g);
+    if (g->backend) {
+        g->backend->close(g);
+    }
+    if (g->wake[0] >= 0) {
+        close(g->wake[0]);
+        close(g->wake[1]);
+    }
+    g->wake[0] = g->wake[1] = -1;
+    ring_free(&g->events);
+    g->backend = NULL;
+}
+
+int gpio_level(struct gpio_input *g, int pin){
+    return g->state[pin];
+}
+
+int gpio_start(struct gpio_input *g){
+    int err;
+
+    atomic_store(&g->running, 1);
+    if ((err = pthread_create(&g->thread, NULL, debounceThread, g))) {
+        atomic_store(&g->running, 0);
+        return -err;
+    }
+    return 0;
+}
+
+void gpio_stop(struct gpio_input *g){
+    struct gpio_event wakeup;
+
+    if (!atomic_exchange(&g->running, 0)) {
+        return;
+    }
+    wakeup.pin = -1;
+    if (write(g->wake[1], &wakeup, sizeof(wakeup)) < 0) {
+        perror("gpio wakeup");
+    }
+    pthread_join(g->thread, NULL);
+}
+
+int gpio_poll(struct gpio_input *g, struct gpio_event *ev){
+    return ring_pop(&g->events, ev);
+}
@@ -0,0 +1,78 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "ring.h"
+
+#define GPIO_MAX_PINS 32
+// edges within this long of an accepted edge are taken as contact bounce
+#define GPIO_DEBOUNCE_MS 20
+
+// a debounced edge. pin is the index into the lines given to gpio_open,
+// when is the CLOCK_MONOTONIC time of the edge in ns.
+struct gpio_event {
+    short pin;
+    short value;
+    long long when;
+};
+
+struct gpio_input;
+
+// where raw (still bouncing) edges come from
+struct gpio_backend {
+    const char *name;
+    int (*open)(struct gpio_input *g);
+    // waits up to timeout_ms (-1 forever) for the next raw edge or a wakeup.
+    // returns 1 with edge filled in, 0 on timeout or wakeup, <0 on error.
+    int (*wait)(struct gpio_input *g, struct gpio_event *edge, int timeout_ms);
+    int (*level)(struct gpio_input *g, int pin);
+    void (*close)(struct gpio_input *g);
+};
+
+// the kernel's gpio character device, edges timestamped by the kernel
+extern const struct gpio_backend gpio_chardev;
+// no hardware, edges come from gpio_fake_set
+extern const struct gpio_backend gpio_fake;
+
+// edges are read and debounced on a thread of their own and handed to
+// the control thread through a ring, so nobody polls pins any more
+struct gpio_input {
+    const struct gpio_backend *backend;
+    const char *chip;
+    int npins;
+    int lines[GPIO_MAX_PINS];
+    int fds[GPIO_MAX_PINS];
+    //wakes the thread up; also carries the fake backend's edges
+    int wake[2];
+    short fake_level[GPIO_MAX_PINS];
+
+    //owned by the debounce thread once started
+    short state[GPIO_MAX_PINS];
+    long long lockout[GPIO_MAX_PINS];
+
+    struct spsc_ring events;
+    pthread_t thread;
+    atomic_int running;
+};
+
+// lines are line offsets on chip (BCM numbers on gpiochip0 for a Pi)
+int gpio_open(struct gpio_input *g, const struct gpio_backend *backend,
+                const char *chip, const int *lines, int npins);
+void gpio_close(struct gpio_input *g);
+
+// debounced level of a pin, only meaningful before gpio_start
+int gpio_level(struct gpio_input *g, int pin);
+
+int gpio_start(struct gpio_input *g);
+void gpio_stop(struct gpio_input *g);
+
+// control thread: next debounced edge, 0 if there is none
+int gpio_poll(struct gpio_input *g, struct gpio_event *ev);
+
+// fake backend only: the pin changes to value now
+int gpio_fake_set(struct gpio_input *g, int pin, int value);
+
+long long gpio_now(void);
+
+#endif
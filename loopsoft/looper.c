@@ -7,156 +7,462 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
-#include <pulse/simple.h>
-#include <pulse/sample.h>
-#include <pulse/error.h>
 #include <termios.h>
-#include <SDL/SDL.h>
+#include <sys/mman.h>
 #include <time.h>
-#include <wiringPi.h>
-
-#define 
-
-#define INPUT_MODE INPUT_MODE_GPIO 0
+#include "audio.h"
+#include "controls.h"
+#include "mix.h"
+#include "session.h"
 
 #ifndef INPUT_MODE
 #define INPUT_MODE INPUT_MODE_GPIO
 #endif 
 
+// how often the control thread wakes up to pass on input and notes
+#define CONTROL_POLL_USEC 1000
 
-// bufers
-#define FRAMESIZE 32
-#define MAXNUMFRAMES 30000
-#define BUFLEN FRAMESIZE * MAXNUMFRAMES
-
-#define SAMPLE_HZ 44100
-#define NUM_LOOPS 3
-
-// GPIO stuff
-#define RECORDING_0 15  // head 8
-#define RESET_0 16      // head 10
-#define RECORDING_1 8   // head 3
-#define RESET_1 9       // head 5
+// GPIO stuff, BCM line numbers on the pi's gpiochip0
+#define GPIO_CHIP "/dev/gpiochip0"
+#define RECORDING_0 14  // head 8
+#define RESET_0 15      // head 10
+#define RECORDING_1 2   // head 3
+#define RESET_1 3       // head 5
 #define RECORDING_2 18  // head 12
-#define RESET_2 7       // head 7
-
-#define ACTIVE_POSITION 0
-#define PASSIVE_POSITION 1
-
-
-struct recordingloop{
-    //pointer to end of loop
-    int *body;
-    //point to overwrite until. Used for efficient live reset
-    //-1 indicates no overwrite
-    short resetpoint;
-    //recording
-    short recording;
-    //muted?
-    short muted;
-};
-
-int recording_pins[NUM_LOOPS];
-int reset_pins[NUM_LOOPS];
-
-int getkey() {
-    int character;
-
-    /* read a character from the stdin stream without blocking */
-    /*   returns EOF (-1) if no character is available */
-    character = fgetc(stdin);
-
-    return character;
-}
-
-void doInput(struct recordingloop subloops[], int currenttime){
+#define RESET_2 4       // head 7
+
+// how far a late first press looks back for the downbeat it missed
+#define DEFAULT_LOOKBACK_MS 250
+
+// the pedal pairs on the board, one per channel
+const int recording_pins[] = { RECORDING_0, RECORDING_1, RECORDING_2 };
+const int reset_pins[] = { RESET_0, RESET_1, RESET_2 };
+#define BOARD_CHANNELS (int)(sizeof(recording_pins) / sizeof(recording_pins[0]))
+
+// keyboard stand-ins for the pedals, one toggle each, undo and redo, and
+// a channel's length a step down or up
+const char recording_keys[] = "123456789";
+const char reset_keys[] = "zxcvbnm,.";
+const char undo_keys[] = "asdfghjkl";
+const char redo_keys[] = "ASDFGHJKL";
+const char shorter_keys[] = "ZXCVBNM<>";
+const char longer_keys[] = "!@#$%^&*(";
+#define KEY_CHANNELS (int)(sizeof(recording_keys) - 1)
+#define QUIT_KEY 'q'
+
+// joystick buttons 2i and 2i + 1 are channel i's record and reset
+#define JOY_CHANNELS 4
+// and the same for the UnoJoy sample sketch's pins 2 to 9: triangle,
+// circle, square, cross, up, down, left, right
+const int unojoy_buttons[] = { 0, 1, 2, 3, 14, 16, 13, 15 };
+#define UNOJOY_CHANNELS (int)(sizeof(unojoy_buttons) / sizeof(unojoy_buttons[0]) / 2)
+
+// the board's pedals, keys for everything, a joystick and an UnoJoy, unless -m
+// gives a map of its own
+void defaultMap(struct control_map *m, int channels){
     int i;
-    for (i=0; i<NUM_LOOPS; i++){
-        int rst = digitalRead(reset_pins[i]);
-        subloops[i].recording = 
-            (PASSIVE_POSITION == rst) &&
-            (ACTIVE_POSITION  == digitalRead(recording_pins[i]));
-        if (ACTIVE_POSITION == rst) {
-            subloops[i].resetpoint = currenttime;
-        }
-    }
-}
 
-int anyRecording(struct recordingloop subloops[]){
-    int i;
-    for(i=0; i<NUM_LOOPS; i++){
-        if(subloops[i].recording){
-            return 1;
-        }
+    for (i=0; i<channels && i<BOARD_CHANNELS; i++){
+        controls_bind(m, CONTROL_GPIO, recording_pins[i], ACTION_RECORD, i, 0);
+        controls_bind(m, CONTROL_GPIO, reset_pins[i], ACTION_RESET, i, 0);
     }
-    return 0;
+    for (i=0; i<channels && i<JOY_CHANNELS; i++){
+        controls_bind(m, CONTROL_JOYSTICK, 2 * i, ACTION_RECORD, i, 0);
+        controls_bind(m, CONTROL_JOYSTICK, 2 * i + 1, ACTION_RESET, i, 0);
+    }
+    for (i=0; i<channels && i<UNOJOY_CHANNELS; i++){
+        controls_bind(m, CONTROL_UNOJOY, unojoy_buttons[2 * i], ACTION_RECORD, i, 0);
+        controls_bind(m, CONTROL_UNOJOY, unojoy_buttons[2 * i + 1], ACTION_RESET, i, 0);
+    }
+    for (i=0; i<channels && i<KEY_CHANNELS; i++){
+        controls_bind(m, CONTROL_KEYBOARD, recording_keys[i], ACTION_RECORD, i, CONTROL_TOGGLE);
+        controls_bind(m, CONTROL_KEYBOARD, reset_keys[i], ACTION_RESET, i, CONTROL_TOGGLE);
+        controls_bind(m, CONTROL_KEYBOARD, undo_keys[i], ACTION_UNDO, i, 0);
+        controls_bind(m, CONTROL_KEYBOARD, redo_keys[i], ACTION_REDO, i, 0);
+        controls_bind(m, CONTROL_KEYBOARD, shorter_keys[i], ACTION_SHORTER, i, 0);
+        controls_bind(m, CONTROL_KEYBOARD, longer_keys[i], ACTION_LONGER, i, 0);
+    }
+    controls_bind(m, CONTROL_KEYBOARD, QUIT_KEY, ACTION_QUIT, 0, 0);
 }
 
-int anyReset(struct recordingloop subloops[]){
-    int i;
-    for(i=0; i<NUM_LOOPS; i++){
-        if(subloops[i].resetpoint != -1){
-            return 1;
+void printNotes(struct engine *e){
+    struct engine_note note;
+
+    while (engine_poll(e, &note)) {
+        switch (note.type) {
+        case NOTE_INITIAL_RECORDING:
+            printf("starting initial recording\n");
+            break;
+        case NOTE_REACHED_BACK:
+            printf("started %d ms before the press, on the downbeat\n",
+                (int)((long long)note.value * 1000 / e->rate));
+            break;
+        case NOTE_PACKED:
+            printf("\nchannel (%d) packed, %d%% of its size\n", note.track, note.value);
+            break;
+        case NOTE_LOOP_CLOSED:
+            printf("looplen %d\n", note.value);
+            break;
+        case NOTE_LENGTH:
+            if (!note.value) {
+                printf("\nchannel (%d) keeps to the loop until it closes\n", note.track);
+            } else if (note.value > 0) {
+                printf("\nchannel (%d) loops over %d loops\n", note.track, note.value);
+            } else {
+                printf("\nchannel (%d) loops over 1/%d of the loop\n", note.track, -note.value);
+            }
+            break;
+        case NOTE_LOST:
+            fprintf(stderr, "\nchannel (%d) lost %d frames of its take, out of undo memory\n",
+                note.track, note.value);
+            break;
+        case NOTE_RESET_DONE:
+            printf("\nreset channel (%d) complete", note.track);
+            break;
+        case NOTE_WRAP:
+            printf(".");
+            break;
+        case NOTE_XRUN:
+            fprintf(stderr, "\nxrun (%s)\n", strerror(-note.value));
+            break;
+        case NOTE_SKIPPED:
+            fprintf(stderr, "lost %d frames, the loop carried on through them\n", note.value);
+            break;
+        case NOTE_LATE:
+            fprintf(stderr, "\n%d track groups missed the mix\n", note.value);
+            break;
         }
     }
-    return 0;
+    fflush(stdout);
 }
 
-pa_simple *outs = NULL;
-pa_simple *ins = NULL;
+struct engine engine;
+struct audio audio;
+struct session session;
+int streaming;
+struct controls controls;
+int controlling;
+struct stats_server stats;
+int serving;
 int exitcode = 1;
 
 struct termios orig_term_attr;
 struct termios new_term_attr;
 
 void finish(){
+    char report[2048];
+
+    if (controlling) {
+        controls_close(&controls);
+    }
+    if (serving) {
+        stats_close(&stats);
+    }
+    audio_stop(&audio);
+    if (atomic_load(&audio.stats.count[STAT_PERIODS])) {
+        stats_report(&audio.stats, report, sizeof(report));
+        printf("\n%s", report);
+    }
+    audio_close(&audio);
+    if (streaming) {
+        session_close(&session);
+    }
+    engine_free(&engine);
 
     /* restore the original terminal attributes */
     tcsetattr(fileno(stdin), TCSANOW, &orig_term_attr);
 
-    if (ins)
-        pa_simple_free(ins);
-    if (outs)
-        pa_simple_free(outs);
     exit(exitcode);
 }
 
-void handleReadin(struct recordingloop subloops[],  
-                int *inbuf, 
-                int latency,
-                int LOOPLENN, 
-                int current_head){
+// settings, from the config file and then the command line
+struct settings {
+    struct control_devices devices;
+    const struct audio_backend *backend;
+    const char *device;
+    unsigned int rate;
+    int period;
+    int channels;
+    int loop_seconds;
+    int lookback_ms;
+    int pack_seconds;
+    int tracks;
+    int cores;
+    int undo_mb;
+    int quantize;
+    int calibrate;
+    const char *map;
+    const char *save;
+    const char *restore;
+    const char *stats_path;
+    int direct;
+};
+
+// the config file, read before the command line so options there win.
+// one "<key> <value>" per line, each key standing for an option.
+#define CONFIG_FILE ".looperrc"
+#define DEVICE_OPT 'D'
+
+const struct {
+    const char *key;
+    int opt;
+} config_keys[] = {
+    { "backend", 'b' },
+    { "device", DEVICE_OPT },
+    { "rate", 'r' },
+    { "period", 'p' },
+    { "channels", 'n' },
+    { "loop_seconds", 'l' },
+    { "lookback_ms", 'w' },
+    { "pack_seconds", 'i' },
+    { "tracks", 't' },
+    { "cores", 'j' },
+    { "undo_mb", 'u' },
+    { "quantize", 'q' },
+    { "gpiochip", 'g' },
+    { "map", 'm' },
+    { "joystick", 'J' },
+    { "unojoy", 'U' },
+    { "unojoy_hz", 'P' },
+    { "stats", 'S' },
+};
+#define CONFIG_KEYS (int)(sizeof(config_keys) / sizeof(config_keys[0]))
+
+void usage(){
+    fprintf(stderr, "usage: looper [-c] [-k] [-f config] [-g gpiochip] [-q divisions]\n"
+        "              [-b backend] [-p period] [-r rate] [-n channels] [-t tracks]\n"
+        "              [-l seconds] [-w ms] [-i seconds] [-j cores] [-u undo_mb]\n"
+        "              [-s name [-d]] [-o name] [-m map] [-J joystick]\n"
+        "              [-U serial [-P hz]] [-S socket]\n"
+        "              [device]\n"
+        "  -f  read settings from config instead of ~/" CONFIG_FILE ", one per line:\n"
+        "        <key> <value>\n"
+        "      with keys backend device rate period channels loop_seconds lookback_ms\n"
+        "      pack_seconds tracks cores undo_mb quantize gpiochip map joystick unojoy\n"
+        "      unojoy_hz stats,\n"
+        "      standing for the options below. options given here win.\n"
+        "  -b  audio backend, one of: %s\n"
+        "  -p  period in frames, a multiple of %d\n"
+        "  -r  sample rate\n"
+        "  -n  channels of the device, up to %d. loops are stereo whatever it has:\n"
+        "      a mono device feeds both sides and plays their mix\n"
+        "  -t  number of tracks, up to %d\n"
+        "  -l  longest loop, in seconds (%d)\n"
+        "  -w  let the first press start the loop on a downbeat up to this many\n"
+        "      ms before it, heard in the input (%d), 0 for right at the press,\n"
+        "      up to %d\n"
+        "  -i  pack a track losslessly in memory once it's gone this many seconds\n"
+        "      without being recorded on (%d), 0 never to\n"
+        "  -j  cores to mix the tracks on, up to %d\n"
+        "  -u  memory kept for undo, in MB (%d)\n"
+        "  -s  stream the output to name.wav and save the loops to name.loop\n"
+        "  -d  write them with O_DIRECT\n"
+        "  -o  start looping what was saved in name.loop\n"
+        "  -c  measure the device's round trip latency first, with output\n"
+        "      looped back to input, and remember it\n"
+        "  -k  no pedals, just the keyboard and joystick\n"
+        "  -m  bind buttons as listed in map instead of the defaults, one per line:\n"
+        "        <gpio|joy|key|uno> <button>\n"
+        "          <record|reset|undo|redo|shorter|longer|quit> [channel] [toggle]\n"
+        "  -J  evdev node of the joystick, the first one found if not given\n"
+        "  -U  serial port of an UnoJoy board, read directly\n"
+        "  -P  ask it for its buttons this many times a second (%d), or 0 to\n"
+        "      have a sketch built with UNOJOY_PUSH send changes as they happen\n"
+        "  -S  serve timings and xrun counts on this unix socket\n"
+        "  -q  snap punch in and out to this many divisions of the loop\n",
+        audio_backend_names(), FRAMESIZE, MAX_DEVICE_CHANNELS, MAX_TRACKS, MAX_LOOP_SECONDS,
+        DEFAULT_LOOKBACK_MS, MAX_LOOKBACK_MS, DEFAULT_PACK_IDLE_SECONDS, POOL_MAX_WORKERS + 1, DEFAULT_UNDO_MB, DEFAULT_UNOJOY_HZ);
+    exit(1);
+}
+
+// one option, from either place. arg has to outlive the settings.
+int setOption(struct settings *s, int opt, const char *arg){
+    switch (opt) {
+    case 'c':
+        s->calibrate = 1;
+        break;
+    case 'k':
+        s->devices.gpio = NULL;
+        break;
+    case 'g':
+        s->devices.chip = arg;
+        break;
+    case 'q':
+        s->quantize = atoi(arg);
+        break;
+    case 'b':
+        if (!(s->backend = audio_find_backend(arg))) {
+            fprintf(stderr, "no audio backend '%s'\n", arg);
+            return -1;
+        }
+        break;
+    case 'p':
+        s->period = atoi(arg);
+        break;
+    case 'r':
+        s->rate = atoi(arg);
+        break;
+    case 'n':
+        s->channels = atoi(arg);
+        break;
+    case 't':
+        s->tracks = atoi(arg);
+        break;
+    case 'l':
+        s->loop_seconds = atoi(arg);
+        break;
+    case 'w':
+        s->lookback_ms = atoi(arg);
+        break;
+    case 'i':
+        s->pack_seconds = atoi(arg);
+        break;
+    case 'j':
+        s->cores = atoi(arg);
+        break;
+    case 'u':
+        s->undo_mb = atoi(arg);
+        break;
+    case 's':
+        s->save = arg;
+        break;
+    case 'd':
+        s->direct = 1;
+        break;
+    case 'o':
+        s->restore = arg;
+        break;
+    case 'm':
+        s->map = arg;
+        break;
+    case 'J':
+        s->devices.joystick = arg;
+        break;
+    case 'U':
+        s->devices.unojoy = arg;
+        break;
+    case 'P':
+        s->devices.unojoy_hz = atoi(arg);
+        break;
+    case 'S':
+        s->stats_path = arg;
+        break;
+    case DEVICE_OPT:
+        s->device = arg;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+// a missing file is only an error if it was asked for
+int loadConfig(struct settings *s, const char *path, int asked){
+    char line[512];
+    char key[32];
+    char value[256];
+    FILE *f;
+    int lineno = 0;
+    int err = 0;
     int i;
-    int x;
 
-    for(i=0; i<FRAMESIZE; i++){
-        //calc addr
-        long addr = (current_head + i - latency) % LOOPLENN;    
-        if (addr<0) {
-            addr = LOOPLENN + (addr % LOOPLENN);
+    if (!(f = fopen(path, "r"))) {
+        err = -errno;
+        if (!asked && err == -ENOENT) {
+            return 0;
         }
+        fprintf(stderr, "cannot open %s (%s)\n", path, strerror(-err));
+        return err;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *arg;
 
-        for (x=0; x<NUM_LOOPS; x++){
-            if(subloops[x].recording){
-                //if this track has not been reset, copy the new data in
-                if (subloops[x].resetpoint == -1){
-                    subloops[x].body[addr] = subloops[x].body[addr] + inbuf[i];
-                }
-                //otherwise, move direct overwrite if recording
-                else{
-                    subloops[x].body[addr] = inbuf[i];
-                }
-            }
-            //otherwise, if it has been reset and not recording, set 0.
-            else if (subloops[x].resetpoint != -1) {
-                subloops[x].body[addr] = 0;
-            }
+        lineno++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%31s %255s", key, value) != 2) {
+            fprintf(stderr, "%s:%d: expected <key> <value>\n", path, lineno);
+            err = -EINVAL;
+            break;
+        }
+        for (i=0; i<CONFIG_KEYS && strcmp(config_keys[i].key, key); i++);
+        if (i == CONFIG_KEYS) {
+            fprintf(stderr, "%s:%d: no setting '%s'\n", path, lineno, key);
+            err = -EINVAL;
+            break;
+        }
+        //kept for as long as the looper runs
+        if (!(arg = strdup(value))) {
+            err = -ENOMEM;
+            break;
+        }
+        if (setOption(s, config_keys[i].opt, arg) < 0) {
+            fprintf(stderr, "%s:%d: bad %s\n", path, lineno, key);
+            err = -EINVAL;
+            break;
         }
     }
+    fclose(f);
+    return err;
 }
 
+#define OPTIONS "ckdf:g:q:b:p:r:n:t:l:w:i:j:u:s:o:m:J:U:P:S:"
+
 int main(int argc, char*argv[]) {
+    struct settings set = {
+        .devices = {
+            .gpio = &gpio_chardev,
+            .chip = GPIO_CHIP,
+            .unojoy_hz = DEFAULT_UNOJOY_HZ,
+        },
+        .backend = &audio_alsa,
+        .device = "default",
+        .rate = SAMPLE_HZ,
+        .period = FRAMESIZE,
+        .channels = CHANNELS,
+        .loop_seconds = MAX_LOOP_SECONDS,
+        .lookback_ms = DEFAULT_LOOKBACK_MS,
+        .pack_seconds = DEFAULT_PACK_IDLE_SECONDS,
+        .tracks = DEFAULT_TRACKS,
+        .cores = 1,
+        .undo_mb = DEFAULT_UNDO_MB,
+    };
+    struct control_map bindings;
+    const char *config = NULL;
+    char path[512];
+    const char *home;
+    int opt;
+
+    //the file goes first, wherever -f is
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        if (opt == 'f') {
+            config = optarg;
+        } else if (opt == '?') {
+            usage();
+        }
+    }
+    if (config) {
+        if (loadConfig(&set, config, 1) < 0) {
+            usage();
+        }
+    } else if ((home = getenv("HOME"))) {
+        snprintf(path, sizeof(path), "%s/" CONFIG_FILE, home);
+        if (loadConfig(&set, path, 0) < 0) {
+            usage();
+        }
+    }
+    optind = 1;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        if (opt != 'f' && setOption(&set, opt, optarg) < 0) {
+            usage();
+        }
+    }
+    if (optind < argc) {
+        set.device = argv[optind];
+    }
 
     /* set the terminal to raw mode */
     tcgetattr(fileno(stdin), &orig_term_attr);
@@ -166,173 +472,102 @@ int main(int argc, char*argv[]) {
     new_term_attr.c_cc[VMIN] = 0;
     tcsetattr(fileno(stdin), TCSANOW, &new_term_attr);
 
-    // iterator variables
-    int i;
-    int x;
-
-    // initialize input arrays 
-    recording_pins = {RECORDING_0, RECORDING_1, RECORDING_2};
-    reset_pins = {RESET_0, RESET_1, RESET_2};
+    //keep code and libraries resident. loop storage is reserved much larger
+    //than it is used and pins itself, so this can't be MCL_FUTURE.
+    if (mlockall(MCL_CURRENT) < 0) {
+        fprintf(stderr, "warning: mlockall() failed: %s\n", strerror(errno));
+    }
 
-    /* The Sample format to use */
-    static const pa_sample_spec ss = {
-        .format = PA_SAMPLE_S16LE,
-        .rate = SAMPLE_HZ,
-        .channels = 2
-    };
-    int error;
-
-    /* Create a new playback stream */
-    if ( !( outs = pa_simple_new(
-            NULL, // server
-            "pi-looper", // name
-            PA_STREAM_PLAYBACK, // direction
-            NULL, // dev?
-            "playback", //  stream_name
-            &ss, // sample format
-            NULL, // default channel map
-            NULL, //deault buffering
-            &error //error code to error
-        ) )) {
-
-        fprintf(stderr, __FILE__": pa_simple_new() failed: %s\n", pa_strerror(error));
-        finish();
+    if (set.period <= 0 || !set.rate || set.cores < 1 || set.undo_mb < 0 ||
+            set.devices.unojoy_hz < 0 || set.loop_seconds <= 0 || set.lookback_ms < 0 ||
+            set.pack_seconds < 0) {
+        usage();
+    }
+    if (set.lookback_ms > MAX_LOOKBACK_MS) {
+        fprintf(stderr, "can't look back more than %d ms for the downbeat\n", MAX_LOOKBACK_MS);
+        usage();
     }
 
-    /* Create a new capture stream */
-    if ( !( ins = pa_simple_new(
-            NULL, // server
-            "pi-looper", // name
-            PA_STREAM_RECORD, // direction
-            NULL, // dev?
-            "record", //  stream_name
-            &ss, // sample format
-            NULL, // default channel map
-            NULL, //deault buffering
-            &error //error code to error
-        ) )) {
-
-        fprintf(stderr, __FILE__": pa_simple_new() failed: %s\n", pa_strerror(error));
+    //the device may not take the rate asked for, everything counted in
+    //frames goes by the one it runs at
+    if (audio_open(&audio, set.backend, set.device, set.rate, set.period,
+            set.channels) < 0) {
         finish();
     }
-    printf("\n");
-    /*
-    printf("%d\n", MAXNUMFRAMES);
-    printf("%d\n", FRAMESIZE);
-    printf("%d\n", BUFLEN);
-    */
-
-    /* setup controller support */
-    if (SDL_Init( SDL_INIT_JOYSTICK ) < 0){
-        fprintf(stderr, "Couldn't initialize SDL: %s\n", SDL_GetError());
-        exit(1);
+    if (!audio.rate || (unsigned)set.loop_seconds > INT_MAX / audio.rate ||
+            (unsigned)set.pack_seconds > INT_MAX / audio.rate) {
+        fprintf(stderr, "can't have %d s loops or %d s to packing at %u Hz\n",
+            set.loop_seconds, set.pack_seconds, audio.rate);
+        finish();
     }
-    printf("%i joysticks were found.\n", SDL_NumJoysticks() );
-
-    if(SDL_NumJoysticks() > 0){
-        printf("using joystick '%s'\n\n", SDL_JoystickName(0));
-        joy = SDL_JoystickOpen(0);
-    } else{
-        printf("please use keyboard controls\n\n");
+    if (engine_init(&engine, set.tracks, (int)(set.loop_seconds * audio.rate), audio.rate) < 0 ||
+        engine_start_workers(&engine, set.cores - 1, AUDIO_THREAD_PRIORITY) < 0) {
+        finish();
     }
-    
-    int netlatency = pa_simple_get_latency(ins,&error) + pa_simple_get_latency(ins,&error);
-    int addtl_latency_usec = 18000;
-
-    //bytes to shift incoming audio
-    int latency = (netlatency+addtl_latency_usec) / 1000000 * SAMPLE_HZ / FRAMESIZE * FRAMESIZE; // make divisible by 32
-
-    /* setup buffers */
-    int *masterloop = malloc( sizeof(int) * BUFLEN );
-    int *inbuf = malloc( sizeof(int) * FRAMESIZE );
-
-    /* initialize 3 midbuffers */
-    struct recordingloop subloops[NUM_LOOPS];
-    for (i=0; i<NUM_LOOPS; i++){
-        subloops[i].body = malloc(sizeof(int) * BUFLEN);
-        subloops[i].recording = 0;
-        subloops[i].resetpoint = -1;
+    audio_attach(&audio, &engine);
+    if (set.calibrate && audio_calibrate(&audio) < 0) {
+        finish();
     }
-
-    doInput(subloops, -1);
-    
-    printf("Start recording on any channel to begin\n");
-    while( !anyRecording(subloops) ) {
-        doInput(subloops, -1);
-        //clear the contents of the buffer
-        pa_simple_read(ins, inbuf, FRAMESIZE, &error);
+    engine.undo_bytes = (size_t)set.undo_mb << 20;
+    engine.lookback = (long long)set.lookback_ms * audio.rate / 1000;
+    engine.pack_idle = set.pack_seconds * audio.rate;
+    if (set.restore && session_load(&engine, set.restore) < 0) {
+        finish();
     }
-
-    printf("starting initial recording\n");
-
-    //initial recording
-    int looplen;
-    for(looplen = 0; looplen<MAXNUMFRAMES; looplen++){
-        //TODO actually do channeled read
-        if (pa_simple_read(ins, inbuf, FRAMESIZE, &error) < 0) {
-            fprintf(stderr, __FILE__": pa_simple_read() failed: %s\n", pa_strerror(error));
+    if (set.save) {
+        if (session_open(&session, &engine, set.save, set.direct) < 0) {
             finish();
         }
-
-        handleReadin(subloops, inbuf, 0, BUFLEN, looplen * FRAMESIZE);
-
-        doInput(subloops, looplen);
-        if(!anyRecording(subloops)) {
-            break;
-        }
+        streaming = 1;
     }
-
-    int LOOPLENN = looplen * FRAMESIZE;
-    printf("looplen %d\n", looplen);
-
-    int count = 0;
-    int current_head;
-    while(1) {
-        current_head = count*FRAMESIZE;
-
-        /* Read some data into the buffer */
-        if (pa_simple_read(ins, inbuf, FRAMESIZE, &error) < 0) {
-            fprintf(stderr, __FILE__": pa_simple_read() failed: %s\n", pa_strerror(error));
+    if (set.stats_path) {
+        if (stats_serve(&stats, &audio.stats, set.stats_path) < 0) {
             finish();
         }
+        serving = 1;
+    }
 
-        doInput(subloops, count);
-
-        if( anyRecording(subloops) || anyReset(subloops) ) {
-            handleReadin(subloops, inbuf, latency, LOOPLENN, current_head);
-        }
-        
-        for(i=current_head; i<current_head+FRAMESIZE; i++){
-            int sum = 0;
-            for (x=0; x<NUM_LOOPS; x++){
-                //if not reset, copy into masterloop.
-                if (subloops[x].resetpoint == -1 && !subloops[x].muted){
-                    sum = sum + subloops[x].body[i];
-                }
-            }
-            masterloop[i] = sum;
-        }
-
-        /* play the appropriate part of loop_play */
-        if (pa_simple_write(outs, masterloop + current_head, (size_t) FRAMESIZE, &error) < 0) {
-            fprintf(stderr, __FILE__": pa_simple_write() failed: %s\n", pa_strerror(error));
+    //tracks past what the map binds still loop, they just can't be played
+    //live yet
+    controls_map_init(&bindings);
+    if (set.map) {
+        if (controls_map_load(&bindings, set.map) < 0) {
             finish();
         }
+    } else {
+        defaultMap(&bindings, set.tracks);
+    }
+    if (controls_open(&controls, &bindings, set.tracks, &set.devices) < 0) {
+        finish();
+    }
+    controlling = 1;
+    printf("\n");
 
-        /* increment count for next loop */
-        count = (count + 1) % looplen;
+    printf("%s %s: %u Hz, period %d, %d channels, latency %d frames, %s mixer\n",
+        set.backend->name, set.device, audio.rate, audio.period, audio.channels,
+        engine.latency, mix_kernel_name());
+    engine_send(&engine, CMD_QUANTIZE, 0, set.quantize);
 
-        /* reset subloop resetpoints if appropriate */
-        for (i=0; i<NUM_LOOPS; i++){
-            if (subloops[i].resetpoint == count){
-                printf("\nreset channel (%d) complete", i);
-                subloops[i].resetpoint = -1;
-            }
-        }
+    if (audio_start(&audio) < 0) {
+        fprintf(stderr, "cannot start audio thread\n");
+        finish();
+    }
+    if (controls_start(&controls) < 0) {
+        fprintf(stderr, "cannot start reading the controls\n");
+        finish();
+    }
 
-        if(count == 0){
-            printf("."); fflush(stdout);
-        }
+    printf("Start recording on any channel to begin\n");
+
+    // the control loop. everything that may stall lives out here, the
+    // audio thread only ever sees commands through the ring.
+    while (!controls_dispatch(&controls, &engine)) {
+        engine_service(&engine);
+        printNotes(&engine);
+        usleep(CONTROL_POLL_USEC);
     }
-}
 
+    exitcode = 0;
+    finish();
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "loopstore.h"
+
+// commit in steps this size so growing a loop is a handful of syscalls
+#define COMMIT_CHUNK_BYTES (1 << 20)
+
+static size_t pageSize(void){
+    static size_t page;
+    if (!page) {
+        page = sysconf(_SC_PAGESIZE);
+    }
+    return page;
+}
+
+static size_t roundUp(size_t bytes, size_t to){
+    return (bytes + to - 1) / to * to;
+}
+
+int loopstore_reserve(struct loopstore *s, size_t frames, const char *path){
+    size_t bytes = roundUp(frames * FRAME_BYTES, COMMIT_CHUNK_BYTES);
+    int flags = MAP_NORESERVE;
+    void *body;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+
+    if (path) {
+        if ((s->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+            fprintf(stderr, "cannot open loop file %s (%s)\n", path, strerror(errno));
+            return -errno;
+        }
+        if (ftruncate(s->fd, bytes) < 0) {
+            fprintf(stderr, "cannot size loop file %s (%s)\n", path, strerror(errno));
+            loopstore_release(s);
+            return -errno;
+        }
+        flags |= MAP_SHARED;
+    } else {
+        flags |= MAP_PRIVATE | MAP_ANONYMOUS;
+    }
+
+    //nothing is accessible until it's committed
+    body = mmap(NULL, bytes, PROT_NONE, flags, s->fd, 0);
+    if (body == MAP_FAILED) {
+        fprintf(stderr, "cannot reserve loop storage (%s)\n", strerror(errno));
+        loopstore_release(s);
+        return -errno;
+    }
+
+    s->body = body;
+    s->reserved = bytes / FRAME_BYTES;
+    return 0;
+}
+
+void loopstore_release(struct loopstore *s){
+    if (s->body) {
+        munmap(s->body, s->reserved * FRAME_BYTES);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    s->body = NULL;
+    s->reserved = s->committed = s->locked = 0;
+    s->fd = -1;
+}
+
+// fault every page in the range in now rather than on first touch
+static void prefault(char *start, size_t bytes){
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(start, bytes, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+    size_t page = pageSize();
+    size_t i;
+    for (i=0; i<bytes; i+=page){
+        volatile char *p = start + i;
+        *p = *p;
+    }
+}
+
+int loopstore_commit(struct loopstore *s, size_t frames){
+    size_t have = s->committed * FRAME_BYTES;
+    size_t want = roundUp(frames * FRAME_BYTES, COMMIT_CHUNK_BYTES);
+    char *base = (char *)s->body;
+
+    if (frames > s->reserved) {
+        return -ENOSPC;
+    }
+    if (want <= have) {
+        return 0;
+    }
+    if (want > s->reserved * FRAME_BYTES) {
+        want = s->reserved * FRAME_BYTES;
+    }
+
+    if (mprotect(base + have, want - have, PROT_READ | PROT_WRITE) < 0) {
+        fprintf(stderr, "cannot commit loop storage (%s)\n", strerror(errno));
+        return -errno;
+    }
+    prefault(base + have, want - have);
+
+    s->committed = want / FRAME_BYTES;
+    return 0;
+}
+
+int loopstore_lock(struct loopstore *s, size_t frames){
+    size_t keep = roundUp(frames * FRAME_BYTES, pageSize());
+    size_t have;
+    char *base = (char *)s->body;
+    int err;
+
+    if ((err = loopstore_commit(s, frames)) < 0) {
+        return err;
+    }
+    have = s->committed * FRAME_BYTES;
+
+    //drop whatever the initial recording committed past the end
+    if (have > keep) {
+        madvise(base + keep, have - keep, MADV_DONTNEED);
+        mprotect(base + keep, have - keep, PROT_NONE);
+        s->committed = keep / FRAME_BYTES;
+    }
+
+    if (mlock(base, keep) < 0) {
+        fprintf(stderr, "warning: cannot lock loop storage (%s)\n", strerror(errno));
+        return -errno;
+    }
+    s->locked = keep / FRAME_BYTES;
+    return 0;
+}
+
+void loopstore_discard(sample_t *start, size_t frames){
+    size_t bytes = frames * FRAME_BYTES;
+
+    munlock(start, bytes);
+    madvise(start, bytes, MADV_DONTNEED);
+}
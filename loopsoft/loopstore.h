@@ -0,0 +1,41 @@
+#ifndef LOOPSTORE_H
+#define LOOPSTORE_H
+
+#include <stddef.h>
+#include "sample.h"
+
+#define FRAME_BYTES (CHANNELS * sizeof(sample_t))
+
+// storage for one track. a large range of address space is reserved up
+// front but only made accessible (and faulted in) as recording grows,
+// then pinned once the loop length is known so the audio thread never
+// takes a page fault. all sizes are in frames.
+struct loopstore {
+    sample_t *body;
+    //frames of address space reserved
+    size_t reserved;
+    //frames accessible and already faulted in
+    size_t committed;
+    //frames pinned with mlock
+    size_t locked;
+    //backing file, -1 for anonymous memory
+    int fd;
+};
+
+// path may be NULL for anonymous memory, otherwise the file is created
+// (or reused) and sized to the reservation
+int loopstore_reserve(struct loopstore *s, size_t frames, const char *path);
+void loopstore_release(struct loopstore *s);
+
+// make at least the first frames accessible and resident. never call from
+// the audio thread, it faults pages in.
+int loopstore_commit(struct loopstore *s, size_t frames);
+
+// the loop is frames long for good: pin it and give back everything past it
+int loopstore_lock(struct loopstore *s, size_t frames);
+
+// gives back the pages of a stretch nothing reads any more. it reads as
+// silence after. start has to be page aligned.
+void loopstore_discard(sample_t *start, size_t frames);
+
+#endif
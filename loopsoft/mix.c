@@ -0,0 +1,202 @@
+#include <string.h>
+#include "mix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIX_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MIX_NEON 1
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+// the vector kernels handle whole blocks and leave the tail to this
+static void mixTail(sample_t *out, const struct mix_source *src,
+                int nsrc, int start, int nsamples){
+    int i;
+    int x;
+
+    for (i=start; i<nsamples; i++){
+        accum_t sum = 0;
+        for (x=0; x<nsrc; x++){
+            sum += ((accum_t)src[x].samples[i] * src[x].gain) >> MIX_GAIN_SHIFT;
+        }
+        out[i] = sample_saturate(sum);
+    }
+}
+
+void mix_scalar(sample_t *out, const struct mix_source *src,
+                int nsrc, int nsamples){
+    mixTail(out, src, nsrc, 0, nsamples);
+}
+
+// a source at a time, which the compiler vectorizes well enough on its own
+void mix_partial(accum_t *bus, const struct mix_source *src,
+                int nsrc, int nsamples){
+    int i;
+    int x;
+
+    for (x=0; x<nsrc; x++){
+        const sample_t *s = src[x].samples;
+        int32_t g = src[x].gain;
+        for (i=0; i<nsamples; i++){
+            bus[i] += ((accum_t)s[i] * g) >> MIX_GAIN_SHIFT;
+        }
+    }
+}
+
+#ifdef MIX_X86
+// 8 samples per block. interleaving with zero turns madd into an exact
+// 16x16->32 multiply by the gain, packs does the final saturation.
+static void mix_sse2(sample_t *out, const struct mix_source *src,
+                int nsrc, int nsamples){
+    const __m128i zero = _mm_setzero_si128();
+    int i;
+    int x;
+
+    for (i=0; i+8<=nsamples; i+=8){
+        __m128i acc0 = zero;
+        __m128i acc1 = zero;
+        for (x=0; x<nsrc; x++){
+            __m128i g = _mm_set1_epi32(src[x].gain);
+            __m128i v = _mm_loadu_si128((const __m128i *)(src[x].samples + i));
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(v, zero), g);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(v, zero), g);
+            acc0 = _mm_add_epi32(acc0, _mm_srai_epi32(lo, MIX_GAIN_SHIFT));
+            acc1 = _mm_add_epi32(acc1, _mm_srai_epi32(hi, MIX_GAIN_SHIFT));
+        }
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(acc0, acc1));
+    }
+    mixTail(out, src, nsrc, i, nsamples);
+}
+
+// 16 samples per block
+__attribute__((target("avx2")))
+static void mix_avx2(sample_t *out, const struct mix_source *src,
+                int nsrc, int nsamples){
+    int i;
+    int x;
+
+    for (i=0; i+16<=nsamples; i+=16){
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        for (x=0; x<nsrc; x++){
+            const sample_t *s = src[x].samples + i;
+            __m256i g = _mm256_set1_epi32(src[x].gain);
+            __m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)s));
+            __m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(s + 8)));
+            a = _mm256_srai_epi32(_mm256_mullo_epi32(a, g), MIX_GAIN_SHIFT);
+            b = _mm256_srai_epi32(_mm256_mullo_epi32(b, g), MIX_GAIN_SHIFT);
+            acc0 = _mm256_add_epi32(acc0, a);
+            acc1 = _mm256_add_epi32(acc1, b);
+        }
+        //packs works per 128 bit lane, put the quadwords back in order
+        __m256i packed = _mm256_permute4x64_epi64(
+            _mm256_packs_epi32(acc0, acc1), 0xd8);
+        _mm256_storeu_si256((__m256i *)(out + i), packed);
+    }
+    mixTail(out, src, nsrc, i, nsamples);
+}
+#endif
+
+#ifdef MIX_NEON
+// 8 samples per block
+static void mix_neon(sample_t *out, const struct mix_source *src,
+                int nsrc, int nsamples){
+    int i;
+    int x;
+
+    for (i=0; i+8<=nsamples; i+=8){
+        int32x4_t acc0 = vdupq_n_s32(0);
+        int32x4_t acc1 = vdupq_n_s32(0);
+        for (x=0; x<nsrc; x++){
+            int16_t g = (int16_t)src[x].gain;
+            int16x8_t v = vld1q_s16(src[x].samples + i);
+            int16x4_t a = vget_low_s16(v);
+            int16x4_t b = vget_high_s16(v);
+            acc0 = vaddq_s32(acc0, vshrq_n_s32(vmull_n_s16(a, g), MIX_GAIN_SHIFT));
+            acc1 = vaddq_s32(acc1, vshrq_n_s32(vmull_n_s16(b, g), MIX_GAIN_SHIFT));
+        }
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(acc0), vqmovn_s32(acc1)));
+    }
+    mixTail(out, src, nsrc, i, nsamples);
+}
+
+static int haveNeon(void){
+#if defined(__aarch64__)
+    return 1;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+}
+#endif
+
+struct mix_kernel {
+    const char *name;
+    mix_fn fn;
+    int (*supported)(void);
+};
+
+static int always(void){
+    return 1;
+}
+
+#ifdef MIX_X86
+static int haveAvx2(void){
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// best first
+static const struct mix_kernel kernels[] = {
+#ifdef MIX_X86
+    { "avx2", mix_avx2, haveAvx2 },
+    { "sse2", mix_sse2, always },
+#endif
+#ifdef MIX_NEON
+    { "neon", mix_neon, haveNeon },
+#endif
+    { "scalar", mix_scalar, always },
+};
+
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+mix_fn mix = mix_scalar;
+static const char *kernel_name = "scalar";
+
+void mix_init(void){
+    int i;
+
+#ifdef MIX_X86
+    __builtin_cpu_init();
+#endif
+    for (i=0; i<NUM_KERNELS; i++){
+        if (kernels[i].supported()) {
+            mix = kernels[i].fn;
+            kernel_name = kernels[i].name;
+            return;
+        }
+    }
+}
+
+const char *mix_kernel_name(void){
+    return kernel_name;
+}
+
+int mix_select(const char *name){
+    int i;
+
+    for (i=0; i<NUM_KERNELS; i++){
+        if (strcmp(kernels[i].name, name) == 0 && kernels[i].supported()) {
+            mix = kernels[i].fn;
+            kernel_name = kernels[i].name;
+            return 0;
+        }
+    }
+    return -1;
+}
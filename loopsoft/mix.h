@@ -0,0 +1,43 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include "sample.h"
+
+// per track gain is Q14, so unity is 1 << 14 and the max is just under 2x
+#define MIX_GAIN_SHIFT 14
+#define MIX_UNITY_GAIN (1 << MIX_GAIN_SHIFT)
+#define MIX_MAX_GAIN 32767
+
+// one track feeding the mixer. everything that used to be tested per
+// sample (reset, muted) is decided once per period when building the
+// source list; a muted or resetting track simply isn't in it.
+struct mix_source {
+    const sample_t *samples;
+    int32_t gain;
+};
+
+// sums nsamples of every source, each scaled by its gain, on the accum_t
+// bus and saturates the result into out.
+typedef void (*mix_fn)(sample_t *out, const struct mix_source *src,
+                int nsrc, int nsamples);
+
+// the kernel picked for this cpu by mix_init()
+extern mix_fn mix;
+
+void mix_init(void);
+const char *mix_kernel_name(void);
+// force a kernel by name ("scalar", "sse2", "avx2", "neon").
+// returns -1 if it isn't built in or this cpu can't run it.
+int mix_select(const char *name);
+
+// adds the sources onto bus without saturating, for mixing a share of the
+// tracks somewhere else. summing the buses and saturating once gives
+// exactly what mix would have for all of them.
+void mix_partial(accum_t *bus, const struct mix_source *src,
+                int nsrc, int nsamples);
+
+// plain C reference every other kernel has to match bit for bit
+void mix_scalar(sample_t *out, const struct mix_source *src,
+                int nsrc, int nsamples);
+
+#endif
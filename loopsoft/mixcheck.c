@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mix.h"
+
+// every mix kernel this cpu can run against mix_scalar, bit for bit, and
+// mix_partial summed over two buses against it too. sources are random,
+// or pinned at full scale so the sum saturates, with gains of 0, unity,
+// the max and anything between. source and sample counts are odd as well
+// as even so the tails get their share.
+
+#define MAX_SOURCES 33
+#define MAX_SAMPLES 515
+#define ROUNDS 2000
+
+static const char *names[] = { "scalar", "sse2", "avx2", "neon" };
+#define NNAMES (int)(sizeof(names) / sizeof(names[0]))
+
+static sample_t samples[MAX_SOURCES][MAX_SAMPLES];
+
+static unsigned int next(unsigned int *seed){
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static int32_t pickGain(unsigned int *seed){
+    switch (next(seed) % 5) {
+    case 0:
+        return 0;
+    case 1:
+        return MIX_UNITY_GAIN;
+    case 2:
+        return MIX_MAX_GAIN;
+    case 3:
+        return MIX_UNITY_GAIN + next(seed) % (MIX_MAX_GAIN - MIX_UNITY_GAIN + 1);
+    default:
+        return next(seed) % MIX_UNITY_GAIN;
+    }
+}
+
+// loud sets most samples to the rails, so every kernel has to saturate
+static void fill(struct mix_source *src, int nsrc, int nsamples, int loud, unsigned int *seed){
+    int x, i;
+
+    for (x=0; x<nsrc; x++){
+        for (i=0; i<nsamples; i++){
+            unsigned int r = next(seed);
+            if (loud && r % 4) {
+                samples[x][i] = r & 4 ? SAMPLE_MAX : SAMPLE_MIN;
+            } else {
+                samples[x][i] = (sample_t)r;
+            }
+        }
+        src[x].samples = samples[x];
+        src[x].gain = pickGain(seed);
+    }
+}
+
+// the sources split over two buses, then saturated once
+static void mixTwoBuses(sample_t *out, const struct mix_source *src, int nsrc, int nsamples){
+    accum_t a[MAX_SAMPLES] = { 0 };
+    accum_t b[MAX_SAMPLES] = { 0 };
+    int i;
+
+    mix_partial(a, src, nsrc / 2, nsamples);
+    mix_partial(b, src + nsrc / 2, nsrc - nsrc / 2, nsamples);
+    for (i=0; i<nsamples; i++){
+        out[i] = sample_saturate(a[i] + b[i]);
+    }
+}
+
+int main(void){
+    struct mix_source src[MAX_SOURCES];
+    sample_t want[MAX_SAMPLES];
+    sample_t got[MAX_SAMPLES];
+    int bad = 0;
+    int k, r;
+
+    mix_init();
+    printf("%s picked for this cpu\n", mix_kernel_name());
+    for (k=0; k<=NNAMES; k++){
+        const char *name = k < NNAMES ? names[k] : "partial";
+        unsigned int seed = 1;
+        int wrong = 0;
+
+        if (k < NNAMES && mix_select(name) < 0) {
+            printf("%-8s not available here\n", name);
+            continue;
+        }
+        for (r=0; r<ROUNDS; r++){
+            int nsrc = 1 + next(&seed) % MAX_SOURCES;
+            int nsamples = 1 + next(&seed) % MAX_SAMPLES;
+
+            fill(src, nsrc, nsamples, r % 3 == 0, &seed);
+            mix_scalar(want, src, nsrc, nsamples);
+            if (k < NNAMES) {
+                mix(got, src, nsrc, nsamples);
+            } else {
+                mixTwoBuses(got, src, nsrc, nsamples);
+            }
+            if (memcmp(want, got, sizeof(sample_t) * nsamples) != 0) {
+                if (!wrong) {
+                    fprintf(stderr, "%s differs from scalar with %d sources, %d samples\n",
+                        name, nsrc, nsamples);
+                }
+                wrong++;
+            }
+        }
+        printf("%-8s %d of %d mixes differ\n", name, wrong, ROUNDS);
+        bad |= wrong != 0;
+    }
+    printf("%s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include "onset.h"
+
+static inline int peakAt(const sample_t *ring, int size, long long f){
+    const sample_t *s = ring + FRAMES_TO_SAMPLES(f % size);
+    int peak = 0;
+    int c;
+
+    for (c=0; c<CHANNELS; c++){
+        if (abs(s[c]) > peak) {
+            peak = abs(s[c]);
+        }
+    }
+    return peak;
+}
+
+// mean absolute sample of the block at f
+static int blockLevel(const sample_t *ring, int size, long long f){
+    long sum = 0;
+    int i, c;
+
+    for (i=0; i<ONSET_BLOCK; i++){
+        const sample_t *s = ring + FRAMES_TO_SAMPLES((f + i) % size);
+        for (c=0; c<CHANNELS; c++){
+            sum += abs(s[c]);
+        }
+    }
+    return sum / FRAMES_TO_SAMPLES(ONSET_BLOCK);
+}
+
+long long onset_nearest(const sample_t *ring, int size,
+                long long from, long long to, long long near){
+    long long best = -1;
+    long long f;
+    int before[2] = { 0, 0 };
+    int seen = 0;
+
+    for (f=from; f+ONSET_BLOCK<=to; f+=ONSET_BLOCK){
+        int level, prev;
+
+        //nothing further on can be any nearer
+        if (best >= 0 && f - near > llabs(best - near)) {
+            break;
+        }
+        level = blockLevel(ring, size, f);
+        prev = before[0] > before[1] ? before[0] : before[1];
+
+        //the first blocks only set the level to jump from
+        if (seen >= 2 && level >= ONSET_FLOOR && level >= ONSET_RATIO * prev) {
+            long long at = f;
+            while (at < f + ONSET_BLOCK - 1 && peakAt(ring, size, at) < level) {
+                at++;
+            }
+            if (best < 0 || llabs(at - near) < llabs(best - near)) {
+                best = at;
+            }
+        }
+        before[1] = before[0];
+        before[0] = level;
+        seen++;
+    }
+    return best;
+}
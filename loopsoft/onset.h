@@ -0,0 +1,24 @@
+#ifndef ONSET_H
+#define ONSET_H
+
+#include "sample.h"
+
+// where notes start in a ring of input, for a late first press to find
+// the downbeat it missed. the input is looked at in blocks by its mean
+// level; an onset is a block that clears ONSET_FLOOR and jumps ONSET_RATIO
+// times over the two before it, placed on the block's first frame as
+// loud as the block's mean.
+
+#define ONSET_BLOCK 64
+#define ONSET_RATIO 4
+// mean absolute sample, about -42 dBFS
+#define ONSET_FLOOR 256
+
+// ring holds size frames, input frame f at f % size. looks through frames
+// from to to (not including it) and returns the onset nearest to near, -1
+// if there's none. runs on the audio thread: no allocation, and no more
+// than one pass over the frames.
+long long onset_nearest(const sample_t *ring, int size,
+                long long from, long long to, long long near);
+
+#endif
@@ -0,0 +1,522 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pack.h"
+
+// how a block keeps its two channels
+enum {
+    STEREO_LR,      // left, right
+    STEREO_LS,      // left, left - right
+    STEREO_RS,      // right, left - right
+    STEREO_RAW,     // the samples as they are, nothing came out smaller
+};
+
+#define MODE_BITS 2
+#define ORDER_BITS 4
+#define SHIFT_BITS 4
+#define COEF_BITS 15
+#define RICE_BITS 5
+#define MAX_RICE 30
+#define PARTITIONS ((PACK_BLOCK_FRAMES + PACK_PARTITION - 1) / PACK_PARTITION)
+// the reader fetches up to this far past the last bit it needs: a refill
+// counts up to seven bytes more than it's asked for, and the next one
+// reads eight from there
+#define PAD_BYTES 16
+// a block stored raw, plus its mode and the odd byte it ends on
+#define MAX_BLOCK_BYTES (PACK_BLOCK_FRAMES * CHANNELS * (int)sizeof(sample_t) + 2)
+
+/* bits, most significant first */
+
+struct bitwriter {
+    uint8_t *p;
+    uint64_t acc;
+    int n;
+};
+
+struct bitreader {
+    const uint8_t *p;
+    uint64_t cache;
+    //bits of cache still to be read, from the top
+    int n;
+};
+
+// bits is up to 32
+static void put(struct bitwriter *w, uint32_t v, int bits){
+    w->acc = (w->acc << bits) | (v & (uint32_t)((1ULL << bits) - 1));
+    w->n += bits;
+    while (w->n >= 8) {
+        w->n -= 8;
+        *w->p++ = w->acc >> w->n;
+    }
+}
+
+// q zeros and a one
+static void putUnary(struct bitwriter *w, uint32_t q){
+    for (; q >= 32; q -= 32){
+        put(w, 0, 32);
+    }
+    put(w, 1, q + 1);
+}
+
+static void flush(struct bitwriter *w){
+    if (w->n) {
+        *w->p++ = w->acc << (8 - w->n);
+        w->n = 0;
+    }
+}
+
+// tops the cache up to at least 56 bits from the next eight bytes. the
+// bits under the ones counted are read again next time, so they're right
+// too, just not counted.
+static inline void refill(struct bitreader *r){
+    uint64_t v;
+
+    memcpy(&v, r->p, sizeof(v));
+    r->cache |= __builtin_bswap64(v) >> r->n;
+    r->p += (63 - r->n) >> 3;
+    r->n |= 56;
+}
+
+// bits is up to 32
+static inline uint32_t get(struct bitreader *r, int bits){
+    uint32_t v;
+
+    if (!bits) {
+        return 0;
+    }
+    refill(r);
+    v = r->cache >> (64 - bits);
+    r->cache <<= bits;
+    r->n -= bits;
+    return v;
+}
+
+static inline int32_t getSigned(struct bitreader *r, int bits){
+    return (int32_t)(get(r, bits) << (32 - bits)) >> (32 - bits);
+}
+
+static inline uint32_t getUnary(struct bitreader *r){
+    uint32_t q = 0;
+    int z;
+
+    for (;;) {
+        refill(r);
+        z = r->cache ? __builtin_clzll(r->cache) : 64;
+        if (z < r->n) {
+            break;
+        }
+        q += r->n;
+        r->cache <<= r->n;
+        r->n = 0;
+    }
+    r->cache <<= z;
+    r->cache <<= 1;
+    r->n -= z + 1;
+    return q + z;
+}
+
+// one Rice coded value with parameter k. it's nearly always in the cache
+// whole, and taken in one go.
+static inline uint32_t getRice(struct bitreader *r, int k){
+    int z;
+
+    if (r->n < 32) {
+        refill(r);
+    }
+    z = r->cache ? __builtin_clzll(r->cache) : 64;
+    if (z + 1 + k <= r->n) {
+        uint32_t u = (uint32_t)z << k;
+        r->cache <<= z + 1;
+        if (k) {
+            u |= r->cache >> (64 - k);
+            r->cache <<= k;
+        }
+        r->n -= z + 1 + k;
+        return u;
+    }
+    return getUnary(r) << k | get(r, k);
+}
+
+static inline uint32_t zigzag(int32_t v){
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+/* encoding */
+
+// one channel of a block, as it would be coded
+struct channel {
+    int order;
+    int shift;
+    int32_t coef[PACK_MAX_ORDER];
+    //bits a raw sample takes, one more for the difference
+    int bits;
+    int rice[PARTITIONS];
+    //bits the whole channel codes to
+    long cost;
+    int32_t s[PACK_BLOCK_FRAMES];
+    int32_t res[PACK_BLOCK_FRAMES];
+};
+
+// the cheapest Rice parameter for u, and what it costs
+static int riceParam(const uint32_t *u, int n, long *cost){
+    uint64_t sum = 0;
+    int best = 0;
+    int guess = 0;
+    int k, i;
+
+    for (i=0; i<n; i++){
+        sum += u[i];
+    }
+    *cost = -1;
+    while (guess < MAX_RICE && ((uint64_t)n << (guess + 1)) < sum) {
+        guess++;
+    }
+    for (k = guess > 0 ? guess - 1 : 0; k <= guess + 1 && k <= MAX_RICE; k++){
+        long bits = (long)n * (k + 1);
+        for (i=0; i<n; i++){
+            bits += u[i] >> k;
+        }
+        if (*cost < 0 || bits < *cost) {
+            *cost = bits;
+            best = k;
+        }
+    }
+    return best;
+}
+
+// residuals of s under the channel's filter, and the parameters to code
+// them with. 0 if some residual is too big to be worth coding.
+static int residuals(struct channel *ch, int n){
+    const int32_t *s = ch->s;
+    uint32_t u[PACK_PARTITION];
+    int p, i, j;
+
+    ch->cost = ORDER_BITS;
+    if (ch->order) {
+        ch->cost += SHIFT_BITS + ch->order * (COEF_BITS + ch->bits);
+    }
+    for (p=0; p*PACK_PARTITION<n; p++){
+        int start = p * PACK_PARTITION;
+        int end = start + PACK_PARTITION < n ? start + PACK_PARTITION : n;
+        long bits;
+
+        //the first partition starts after the warm up
+        if (start < ch->order) {
+            start = ch->order;
+        }
+        for (i=start; i<end; i++){
+            int64_t pred = 0;
+            int64_t e;
+            for (j=0; j<ch->order; j++){
+                pred += (int64_t)ch->coef[j] * s[i - 1 - j];
+            }
+            e = s[i] - (pred >> ch->shift);
+            if (e > (1 << 24) || e < -(1 << 24)) {
+                return 0;
+            }
+            ch->res[i] = e;
+            u[i - start] = zigzag(e);
+        }
+        ch->rice[p] = riceParam(u, end - start, &bits);
+        ch->cost += RICE_BITS + bits;
+    }
+    return 1;
+}
+
+// picks an order from how well each would predict s, going by the
+// Levinson-Durbin recursion on a windowed copy, and quantizes its filter
+static void analyze(struct channel *ch, int n){
+    const int32_t *s = ch->s;
+    double x[PACK_BLOCK_FRAMES];
+    double r[PACK_MAX_ORDER + 1];
+    double a[PACK_MAX_ORDER + 1];
+    double lpc[PACK_MAX_ORDER + 1][PACK_MAX_ORDER + 1];
+    double err[PACK_MAX_ORDER + 1];
+    double tmp[PACK_MAX_ORDER + 1];
+    double energy = 0;
+    double best = -1;
+    double cmax = 0;
+    double carry = 0;
+    int max = n - 1 < PACK_MAX_ORDER ? n - 1 : PACK_MAX_ORDER;
+    int limit = (1 << (COEF_BITS - 1)) - 1;
+    int order = 0;
+    int exp;
+    int i, j;
+
+    for (i=0; i<n; i++){
+        double w = (i - (n - 1) / 2.0) / ((n + 1) / 2.0);
+        x[i] = s[i] * (1 - w * w);
+        energy += (double)s[i] * s[i];
+    }
+    for (j=0; j<=max; j++){
+        r[j] = 0;
+        for (i=j; i<n; i++){
+            r[j] += x[i] * x[i - j];
+        }
+    }
+
+    ch->order = 0;
+    ch->shift = 0;
+    if (r[0] <= 0) {
+        return;
+    }
+    err[0] = r[0];
+    for (i=1; i<=max; i++){
+        double k = r[i];
+        for (j=1; j<i; j++){
+            k -= a[j] * r[i - j];
+        }
+        k /= err[i - 1];
+        for (j=1; j<i; j++){
+            tmp[j] = a[j] - k * a[i - j];
+        }
+        for (j=1; j<i; j++){
+            a[j] = tmp[j];
+        }
+        a[i] = k;
+        err[i] = err[i - 1] * (1 - k * k);
+        memcpy(lpc[i], a, sizeof(a));
+        if (err[i] <= 0) {
+            max = i;
+            break;
+        }
+    }
+
+    //about what a Rice coded residual of that variance takes
+    for (i=0; i<=max; i++){
+        double var = err[i] / r[0] * energy / n;
+        double bits = (n - i) * (0.5 * log2(var + 1) + 1);
+        if (i) {
+            bits += SHIFT_BITS + i * (COEF_BITS + ch->bits);
+        }
+        if (best < 0 || bits < best) {
+            best = bits;
+            order = i;
+        }
+    }
+    if (!order) {
+        return;
+    }
+
+    for (j=1; j<=order; j++){
+        cmax = fabs(lpc[order][j]) > cmax ? fabs(lpc[order][j]) : cmax;
+    }
+    frexp(cmax, &exp);
+    ch->shift = COEF_BITS - 1 - exp;
+    if (ch->shift < 0 || cmax == 0) {
+        return;
+    }
+    if (ch->shift > (1 << SHIFT_BITS) - 1) {
+        ch->shift = (1 << SHIFT_BITS) - 1;
+    }
+    //rounding errors carried on to the next coefficient
+    for (j=0; j<order; j++){
+        double v = lpc[order][j + 1] * (1 << ch->shift) + carry;
+        long q = lround(v);
+        q = q > limit ? limit : q < -limit - 1 ? -limit - 1 : q;
+        carry = v - q;
+        ch->coef[j] = q;
+    }
+    ch->order = order;
+}
+
+static void prepare(struct channel *ch, int n, int bits){
+    ch->bits = bits;
+    analyze(ch, n);
+    if (!residuals(ch, n)) {
+        ch->order = 0;
+        ch->shift = 0;
+        residuals(ch, n);
+    }
+}
+
+static void writeChannel(struct bitwriter *w, const struct channel *ch, int n){
+    int p, i;
+
+    put(w, ch->order, ORDER_BITS);
+    if (ch->order) {
+        put(w, ch->shift, SHIFT_BITS);
+        for (i=0; i<ch->order; i++){
+            put(w, ch->coef[i], COEF_BITS);
+        }
+        for (i=0; i<ch->order; i++){
+            put(w, ch->s[i], ch->bits);
+        }
+    }
+    for (p=0; p*PACK_PARTITION<n; p++){
+        int start = p * PACK_PARTITION < ch->order ? ch->order : p * PACK_PARTITION;
+        int end = (p + 1) * PACK_PARTITION < n ? (p + 1) * PACK_PARTITION : n;
+        int k = ch->rice[p];
+
+        put(w, k, RICE_BITS);
+        for (i=start; i<end; i++){
+            uint32_t u = zigzag(ch->res[i]);
+            putUnary(w, u >> k);
+            put(w, u, k);
+        }
+    }
+}
+
+// returns the bytes block took
+static int encodeBlock(uint8_t *dst, const sample_t *src, int n, struct channel *ch){
+    static const int pairs[3][2] = {
+        [STEREO_LR] = { 0, 1 },
+        [STEREO_LS] = { 0, 2 },
+        [STEREO_RS] = { 1, 2 },
+    };
+    struct bitwriter w = { dst, 0, 0 };
+    long best = (long)n * CHANNELS * 16;
+    int mode = STEREO_RAW;
+    int m, i;
+
+    for (i=0; i<n; i++){
+        ch[0].s[i] = src[2 * i];
+        ch[1].s[i] = src[2 * i + 1];
+        ch[2].s[i] = ch[0].s[i] - ch[1].s[i];
+    }
+    prepare(&ch[0], n, 16);
+    prepare(&ch[1], n, 16);
+    prepare(&ch[2], n, 17);
+    for (m=0; m<3; m++){
+        long cost = ch[pairs[m][0]].cost + ch[pairs[m][1]].cost;
+        if (cost < best) {
+            best = cost;
+            mode = m;
+        }
+    }
+
+    put(&w, mode, MODE_BITS);
+    if (mode == STEREO_RAW) {
+        for (i=0; i<FRAMES_TO_SAMPLES(n); i++){
+            put(&w, src[i], 16);
+        }
+    } else {
+        writeChannel(&w, &ch[pairs[mode][0]], n);
+        writeChannel(&w, &ch[pairs[mode][1]], n);
+    }
+    flush(&w);
+    return w.p - dst;
+}
+
+struct pack *pack_encode(const sample_t *src, int frames){
+    int nblocks = (frames + PACK_BLOCK_FRAMES - 1) / PACK_BLOCK_FRAMES;
+    size_t head = sizeof(struct pack) + sizeof(uint32_t) * nblocks;
+    size_t raw = sizeof(sample_t) * FRAMES_TO_SAMPLES(frames);
+    struct channel *ch = malloc(sizeof(struct channel) * 3);
+    struct pack *p = malloc(head + (size_t)nblocks * MAX_BLOCK_BYTES + PAD_BYTES);
+    struct pack *fit;
+    uint8_t *data;
+    size_t len = 0;
+    int b;
+
+    if (!ch || !p) {
+        free(ch);
+        free(p);
+        return NULL;
+    }
+    p->frames = frames;
+    p->nblocks = nblocks;
+    data = (uint8_t *)p + head;
+    for (b=0; b<nblocks; b++){
+        p->at[b] = len;
+        len += encodeBlock(data + len, src + FRAMES_TO_SAMPLES(b * PACK_BLOCK_FRAMES),
+            pack_block_frames(p, b), ch);
+    }
+    free(ch);
+    if (head + len >= raw) {
+        free(p);
+        return NULL;
+    }
+    memset(data + len, 0, PAD_BYTES);
+    p->bytes = head + len + PAD_BYTES;
+    //shrinking doesn't move it, but it may
+    if ((fit = realloc(p, p->bytes))) {
+        p = fit;
+    }
+    return p;
+}
+
+/* decoding */
+
+static void readChannel(struct bitreader *r, int32_t *s, int n, int bits){
+    int32_t coef[PACK_MAX_ORDER];
+    int order = get(r, ORDER_BITS);
+    int shift = 0;
+    int p, i, j;
+
+    if (order) {
+        shift = get(r, SHIFT_BITS);
+        for (i=0; i<order; i++){
+            coef[i] = getSigned(r, COEF_BITS);
+        }
+        for (i=0; i<order; i++){
+            s[i] = getSigned(r, bits);
+        }
+    }
+    for (p=0; p*PACK_PARTITION<n; p++){
+        int start = p * PACK_PARTITION < order ? order : p * PACK_PARTITION;
+        int end = (p + 1) * PACK_PARTITION < n ? (p + 1) * PACK_PARTITION : n;
+        int k = get(r, RICE_BITS);
+
+        for (i=start; i<end; i++){
+            uint32_t u = getRice(r, k);
+            int64_t pred = 0;
+            //the sample just decoded goes in last, it's the one waited on
+            for (j=order-1; j>=0; j--){
+                pred += (int64_t)coef[j] * s[i - 1 - j];
+            }
+            s[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            s[i] += pred >> shift;
+        }
+    }
+}
+
+void pack_decode_block(const struct pack *p, int b, sample_t *dst){
+    int32_t a[PACK_BLOCK_FRAMES];
+    int32_t d[PACK_BLOCK_FRAMES];
+    int n = pack_block_frames(p, b);
+    struct bitreader r;
+    int mode;
+    int i;
+
+    r.p = (const uint8_t *)(p->at + p->nblocks) + p->at[b];
+    r.cache = 0;
+    r.n = 0;
+    mode = get(&r, MODE_BITS);
+    if (mode == STEREO_RAW) {
+        for (i=0; i<FRAMES_TO_SAMPLES(n); i++){
+            dst[i] = getSigned(&r, 16);
+        }
+        return;
+    }
+    readChannel(&r, a, n, 16);
+    readChannel(&r, d, n, mode == STEREO_LR ? 16 : 17);
+    switch (mode) {
+    case STEREO_LR:
+        for (i=0; i<n; i++){
+            dst[2 * i] = a[i];
+            dst[2 * i + 1] = d[i];
+        }
+        break;
+    case STEREO_LS:
+        for (i=0; i<n; i++){
+            dst[2 * i] = a[i];
+            dst[2 * i + 1] = a[i] - d[i];
+        }
+        break;
+    case STEREO_RS:
+        for (i=0; i<n; i++){
+            dst[2 * i] = a[i] + d[i];
+            dst[2 * i + 1] = a[i];
+        }
+        break;
+    }
+}
+
+void pack_decode(const struct pack *p, sample_t *dst){
+    int b;
+
+    for (b=0; b<p->nblocks; b++){
+        pack_decode_block(p, b, dst + FRAMES_TO_SAMPLES(b * PACK_BLOCK_FRAMES));
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdint.h>
+#include "sample.h"
+
+// lossless packing of loop audio nobody is recording on, so it takes less
+// memory while it only plays. FLAC's scheme, cut down: the audio is cut
+// into PACK_BLOCK_FRAMES blocks that each decode on their own. in a block
+// two of left, right and their difference (whichever pair comes out
+// smallest) are each predicted from the samples before them by a
+// quantized LPC filter, and what the filter misses is Rice coded in
+// partitions with a parameter of their own.
+
+#define PACK_BLOCK_FRAMES 512
+#define PACK_MAX_ORDER 8
+// residuals per Rice parameter
+#define PACK_PARTITION 64
+
+struct pack {
+    //told apart by this rather than the address, which malloc hands out
+    //again. set by whoever packed it.
+    unsigned id;
+    int frames;
+    int nblocks;
+    //bytes taken altogether
+    int bytes;
+    //where each block starts, in the data after the table
+    uint32_t at[];
+};
+
+// packs frames of interleaved src. NULL if it doesn't come out smaller
+// than the samples themselves, or there's no memory. free() it.
+struct pack *pack_encode(const sample_t *src, int frames);
+
+// the frames block b holds, PACK_BLOCK_FRAMES but for a short last block
+static inline int pack_block_frames(const struct pack *p, int b){
+    int left = p->frames - b * PACK_BLOCK_FRAMES;
+    return left < PACK_BLOCK_FRAMES ? left : PACK_BLOCK_FRAMES;
+}
+
+// decodes block b into dst, or all of it. no allocation or locks, fit for
+// the audio thread, though a block costs far more than mixing it: the
+// engine keeps to a budget of them per period.
+void pack_decode_block(const struct pack *p, int b, sample_t *dst);
+void pack_decode(const struct pack *p, sample_t *dst);
+
+#endif
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "pool.h"
+
+// how long an idle worker polls for the next batch before it sleeps. a
+// batch comes every period, so this is usually enough to never sleep.
+#define POOL_SPIN 20000
+// how long pool_sync spins before it starts yielding to the workers
+#define SYNC_SPIN 1000
+
+#define WORK(gen, ntasks) ((uint_fast64_t)(gen) << 32 | (uint_fast64_t)(ntasks) << 16)
+#define WORK_GEN(w) ((unsigned)((w) >> 32))
+#define WORK_TASKS(w) ((int)(((w) >> 16) & 0xffff))
+#define WORK_NEXT(w) ((int)((w) & 0xffff))
+
+static inline void cpuRelax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static long long nowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void futexWait(atomic_uint *addr, unsigned val){
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futexWake(atomic_uint *addr){
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// the next task of batch gen, or -1 once they are all taken. a worker
+// that wakes up late for a batch can't take one from the next.
+static int claimTask(struct pool *p, unsigned gen){
+    uint_fast64_t w = atomic_load_explicit(&p->work, memory_order_acquire);
+
+    do {
+        if (WORK_GEN(w) != gen || WORK_NEXT(w) >= WORK_TASKS(w)) {
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&p->work, &w, w + 1,
+                memory_order_acq_rel, memory_order_acquire));
+    return WORK_NEXT(w);
+}
+
+static void runTasks(struct pool *p, unsigned gen){
+    int task;
+
+    while ((task = claimTask(p, gen)) >= 0) {
+        p->fn(p->arg, task);
+        atomic_store_explicit(&p->done[task], 1, memory_order_release);
+        atomic_fetch_add_explicit(&p->finished, 1, memory_order_release);
+    }
+}
+
+// the generation of the next batch after seen, or of the stop
+static unsigned waitBatch(struct pool *p, unsigned seen){
+    unsigned gen;
+    int i;
+
+    for (i=0; i<POOL_SPIN; i++){
+        if ((gen = atomic_load_explicit(&p->wake, memory_order_acquire)) != seen) {
+            return gen;
+        }
+        cpuRelax();
+    }
+    //counted as asleep before the last look, so pool_run can't miss us
+    atomic_fetch_add(&p->sleepers, 1);
+    while ((gen = atomic_load(&p->wake)) == seen) {
+        futexWait(&p->wake, seen);
+    }
+    atomic_fetch_sub(&p->sleepers, 1);
+    return gen;
+}
+
+static void *poolThread(void *arg){
+    struct pool *p = arg;
+    unsigned seen = 0;
+
+    for (;;) {
+        seen = waitBatch(p, seen);
+        if (atomic_load_explicit(&p->stop, memory_order_acquire)) {
+            break;
+        }
+        runTasks(p, seen);
+    }
+    return NULL;
+}
+
+static int spawnWorker(struct pool *p, int i, int priority){
+    pthread_attr_t attr;
+    struct sched_param param;
+    cpu_set_t cpus;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int err = EPERM;
+
+    if (priority) {
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        param.sched_priority = priority;
+        pthread_attr_setschedparam(&attr, &param);
+        err = pthread_create(&p->threads[i], &attr, poolThread, p);
+        pthread_attr_destroy(&attr);
+        if (err == EPERM && !i) {
+            fprintf(stderr, "warning: cannot use real time scheduling for mix workers\n");
+        }
+    }
+    if (err == EPERM) {
+        err = pthread_create(&p->threads[i], NULL, poolThread, p);
+    }
+    if (err) {
+        return -err;
+    }
+
+    //cpu 0 is left to the audio thread
+    if (ncpu > 1) {
+        CPU_ZERO(&cpus);
+        CPU_SET((i + 1) % ncpu, &cpus);
+        pthread_setaffinity_np(p->threads[i], sizeof(cpus), &cpus);
+    }
+    return 0;
+}
+
+int pool_init(struct pool *p, int nworkers, int priority){
+    int err;
+    int i;
+
+    memset(p, 0, sizeof(*p));
+    if (nworkers < 0 || nworkers > POOL_MAX_WORKERS) {
+        fprintf(stderr, "can't have %d mix workers, 0 to %d\n", nworkers, POOL_MAX_WORKERS);
+        return -EINVAL;
+    }
+    atomic_init(&p->work, WORK(0, 0));
+    atomic_init(&p->wake, 0);
+    atomic_init(&p->sleepers, 0);
+    atomic_init(&p->stop, 0);
+    atomic_init(&p->finished, 0);
+    for (i=0; i<POOL_MAX_TASKS; i++){
+        atomic_init(&p->done[i], 0);
+    }
+
+    for (i=0; i<nworkers; i++){
+        if ((err = spawnWorker(p, i, priority)) < 0) {
+            fprintf(stderr, "cannot start mix worker (%s)\n", strerror(-err));
+            pool_free(p);
+            return err;
+        }
+        p->nworkers++;
+    }
+    return 0;
+}
+
+void pool_free(struct pool *p){
+    int i;
+
+    atomic_store_explicit(&p->stop, 1, memory_order_release);
+    atomic_fetch_add(&p->wake, 1);
+    futexWake(&p->wake);
+    for (i=0; i<p->nworkers; i++){
+        pthread_join(p->threads[i], NULL);
+    }
+    p->nworkers = 0;
+}
+
+void pool_run(struct pool *p, pool_fn fn, void *arg, int ntasks){
+    unsigned gen = atomic_load_explicit(&p->wake, memory_order_relaxed) + 1;
+    int i;
+
+    p->fn = fn;
+    p->arg = arg;
+    p->ntasks = ntasks;
+    for (i=0; i<ntasks; i++){
+        atomic_store_explicit(&p->done[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&p->finished, 0, memory_order_relaxed);
+    atomic_store_explicit(&p->work, WORK(gen, ntasks), memory_order_release);
+
+    atomic_store(&p->wake, gen);
+    if (atomic_load(&p->sleepers)) {
+        futexWake(&p->wake);
+    }
+    runTasks(p, gen);
+}
+
+int pool_wait(struct pool *p, long long deadline){
+    while (atomic_load_explicit(&p->finished, memory_order_acquire) < p->ntasks) {
+        if (nowNs() >= deadline) {
+            return 0;
+        }
+        cpuRelax();
+    }
+    return 1;
+}
+
+void pool_sync(struct pool *p){
+    int i = 0;
+
+    while (atomic_load_explicit(&p->finished, memory_order_acquire) < p->ntasks) {
+        //a worker sharing our cpu needs it to finish
+        if (++i > SYNC_SPIN) {
+            sched_yield();
+        } else {
+            cpuRelax();
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// a handful of worker threads the audio thread hands a batch of small
+// tasks to every period. tasks are claimed off one shared counter, so a
+// lane that finishes early just takes the next one, and the caller works
+// as a lane too. idle workers spin a little and then sleep on a futex.
+#define POOL_MAX_WORKERS 7
+#define POOL_MAX_TASKS 64
+
+typedef void (*pool_fn)(void *arg, int task);
+
+struct pool {
+    int nworkers;
+    pthread_t threads[POOL_MAX_WORKERS];
+
+    //the batch, fixed while it is out
+    pool_fn fn;
+    void *arg;
+    int ntasks;
+    //batch generation in the top half, task count and next task below.
+    //claiming a task is one compare and swap on it.
+    _Alignas(64) atomic_uint_fast64_t work;
+    //batch generation again, for the sleepers to wait on
+    _Alignas(64) atomic_uint wake;
+    atomic_int sleepers;
+    atomic_int stop;
+    //tasks of the batch that are done, and which
+    _Alignas(64) atomic_int finished;
+    atomic_uchar done[POOL_MAX_TASKS];
+};
+
+// starts nworkers threads, pinned to cpus 1 up and at SCHED_FIFO priority
+// if it isn't 0. returns a negative errno.
+int pool_init(struct pool *p, int nworkers, int priority);
+void pool_free(struct pool *p);
+
+// hands out ntasks calls of fn and works on them until none are left to
+// claim. the previous batch must have been synced.
+void pool_run(struct pool *p, pool_fn fn, void *arg, int ntasks);
+// waits for tasks still running on workers until ns on CLOCK_MONOTONIC.
+// returns 1 if the whole batch is done.
+int pool_wait(struct pool *p, long long deadline);
+// waits however long it takes
+void pool_sync(struct pool *p);
+
+static inline int pool_task_done(struct pool *p, int task){
+    return atomic_load_explicit(&p->done[task], memory_order_acquire);
+}
+
+#endif
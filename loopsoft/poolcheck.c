@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+
+// overdubs with an undo pool too small to hold what's recorded on. a
+// loop is recorded, and then either it's left alone long enough to be
+// packed and overdubbed all the way round, or a second track is made
+// longer than the loop and recorded over its whole length. each is run
+// first with a pool that holds everything and no packing, and the track
+// has to come out the same every other way, with nothing lost on the way.
+// a pool just big enough to keep the packed chunks back is run down to
+// its low water mark by the overdub, and one too small must not pack.
+
+#define LOOP_FRAMES (300000 / FRAMESIZE * FRAMESIZE)
+#define IDLE_LOOPS 3
+
+struct run {
+    const char *name;
+    int undo_kb;
+    int pack_idle;
+    //CMD_LENGTH for track 1, which is then the one recorded on, or 0 to
+    //overdub track 0
+    int ratio;
+    //a pool too small to keep a chunk back for every packed one, where
+    //packing has to be refused. any other run with pack_idle has to pack.
+    int refused;
+};
+
+// the first of each ratio is what the rest of it are held to. the loop
+// packs into about 74 chunks, and a pool keeps a quarter of itself free
+static const struct run runs[] = {
+    { "never packed", 65536, 0, 0, 0 },
+    { "small pool", 1024, 0, 0, 0 },
+    { "too small to pack", 1024, 4410, 0, 1 },
+    { "pool just holds pack", 1664, 4410, 0, 0 },
+    { "packed, large pool", 65536, 4410, 0, 0 },
+    { "twice as long", 65536, 0, 2, 0 },
+    { "small pool", 3072, 0, 2, 0 },
+    { "packed, small pool", 3072, 4410, 2, 0 },
+    { "8 times as long", 65536, 0, 8, 0 },
+    { "small pool", 3072, 4410, 8, 0 },
+};
+#define NRUNS (int)(sizeof(runs) / sizeof(runs[0]))
+
+static void fillNoise(sample_t *buf, unsigned int *seed){
+    int i;
+    for (i=0; i<PERIOD_SAMPLES; i++){
+        *seed = *seed * 1103515245 + 12345;
+        buf[i] = (sample_t)(*seed >> 16) >> 5;
+    }
+}
+
+// frames worth of periods, noise if seed is set, else silence
+static void play(struct engine *e, int frames, unsigned int *seed, int *packed, int *lost){
+    sample_t in[PERIOD_SAMPLES] = { 0 };
+    sample_t out[PERIOD_SAMPLES];
+    struct engine_note note;
+
+    for (; frames > 0; frames -= FRAMESIZE){
+        if (seed) {
+            fillNoise(in, seed);
+        }
+        engine_process(e, in, out);
+        engine_service(e);
+        while (engine_poll(e, &note)) {
+            if (note.type == NOTE_PACKED) {
+                (*packed)++;
+            } else if (note.type == NOTE_LOST) {
+                *lost += note.value;
+            }
+        }
+    }
+}
+
+// the track recorded on as it is after, NULL if the engine can't be had.
+// frames is its length.
+static sample_t *record(const struct run *r, int *frames, int *packed, int *lost){
+    struct engine e;
+    sample_t *got;
+    unsigned int seed = 1;
+    int x = r->ratio ? 1 : 0;
+
+    if (engine_init(&e, 2, 0, 0) < 0) {
+        return NULL;
+    }
+    e.pin_storage = 0;
+    e.undo_bytes = (size_t)r->undo_kb << 10;
+    e.pack_idle = r->pack_idle;
+    *packed = *lost = 0;
+
+    engine_send(&e, CMD_RECORD, 0, 1);
+    play(&e, LOOP_FRAMES, &seed, packed, lost);
+    engine_send(&e, CMD_RECORD, 0, 0);
+    play(&e, IDLE_LOOPS * LOOP_FRAMES, NULL, packed, lost);
+    if (r->ratio) {
+        engine_send(&e, CMD_LENGTH, x, r->ratio);
+        play(&e, FRAMESIZE, NULL, packed, lost);
+    }
+    *frames = engine_track_length(&e, x);
+    engine_send(&e, CMD_RECORD, x, 1);
+    play(&e, *frames + 10 * FRAMESIZE, &seed, packed, lost);
+    engine_send(&e, CMD_RECORD, x, 0);
+    play(&e, LOOP_FRAMES, NULL, packed, lost);
+
+    got = malloc(sizeof(sample_t) * FRAMES_TO_SAMPLES(*frames));
+    engine_read_track(&e, x, got, 0, *frames);
+    engine_free(&e);
+    return got;
+}
+
+int main(void){
+    sample_t *want = NULL;
+    int want_frames = 0;
+    int bad = 0;
+    int i, f;
+
+    for (i=0; i<NRUNS; i++){
+        int frames, packed, lost, wrong = 0;
+        sample_t *got = record(&runs[i], &frames, &packed, &lost);
+
+        if (!got) {
+            return 1;
+        }
+        if (!i || runs[i].ratio != runs[i-1].ratio) {
+            free(want);
+            want = got;
+            want_frames = frames;
+        } else {
+            for (f=0; f<frames && f<want_frames; f++){
+                wrong += memcmp(want + FRAMES_TO_SAMPLES(f), got + FRAMES_TO_SAMPLES(f),
+                    sizeof(sample_t) * CHANNELS) != 0;
+            }
+            wrong += abs(frames - want_frames);
+            free(got);
+        }
+        printf("%-20s %5d kB pool: %7d frames, packed %d times, %d frames lost, %d differ\n",
+            runs[i].name, runs[i].undo_kb, frames, packed, lost, wrong);
+        //a run that should have packed and didn't overdubbed nothing packed
+        if (runs[i].pack_idle && (packed > 0) == runs[i].refused) {
+            printf("%-20s should%s have packed\n", runs[i].name, runs[i].refused ? " not" : "");
+            bad = 1;
+        }
+        bad |= lost || wrong;
+    }
+    free(want);
+    printf("%s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
@@ -0,0 +1,45 @@
+#include <string.h>
+#include "record.h"
+
+void record_add(sample_t *restrict dst, const sample_t *restrict src, int n){
+    int i;
+    for (i=0; i<n; i++){
+        dst[i] = sample_saturate((accum_t)dst[i] + src[i]);
+    }
+}
+
+void record_overwrite(sample_t *restrict dst, const sample_t *restrict src, int n){
+    memcpy(dst, src, sizeof(sample_t) * n);
+}
+
+void record_clear(sample_t *dst, const sample_t *src, int n){
+    (void)src;
+    memset(dst, 0, sizeof(sample_t) * n);
+}
+
+void record_add_ramp(sample_t *restrict dst, const sample_t *restrict src, int frames,
+                int gain, int step){
+    int i;
+    int c;
+    for (i=0; i<frames; i++, gain+=step){
+        for (c=0; c<CHANNELS; c++){
+            accum_t in = ((accum_t)src[c] * gain) >> RECORD_GAIN_SHIFT;
+            dst[c] = sample_saturate(dst[c] + in);
+        }
+        dst += CHANNELS;
+        src += CHANNELS;
+    }
+}
+
+void record_overwrite_ramp(sample_t *restrict dst, const sample_t *restrict src, int frames,
+                int gain, int step){
+    int i;
+    int c;
+    for (i=0; i<frames; i++, gain+=step){
+        for (c=0; c<CHANNELS; c++){
+            dst[c] = ((accum_t)src[c] * gain) >> RECORD_GAIN_SHIFT;
+        }
+        dst += CHANNELS;
+        src += CHANNELS;
+    }
+}
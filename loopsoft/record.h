@@ -0,0 +1,30 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "sample.h"
+
+// writes n samples of input into a contiguous span of a track. handleReadin
+// picks one of these per track once per period, so the loops themselves
+// carry no per sample branches and vectorize.
+typedef void (*record_fn)(sample_t *dst, const sample_t *src, int n);
+
+// overdub: add the input on top of what's there, summed on the accum_t
+// bus and saturated back down
+void record_add(sample_t *dst, const sample_t *src, int n);
+// recording over a reset track: replace what's there
+void record_overwrite(sample_t *dst, const sample_t *src, int n);
+// reset and not recording: silence the span, src is ignored
+void record_clear(sample_t *dst, const sample_t *src, int n);
+
+// the input's share during a punch in/out crossfade is Q15
+#define RECORD_GAIN_SHIFT 15
+#define RECORD_FULL (1 << RECORD_GAIN_SHIFT)
+
+// crossfade versions of add and overwrite. these take frames, not samples:
+// the input is scaled by gain, which moves by step after every frame.
+void record_add_ramp(sample_t *dst, const sample_t *src, int frames,
+                int gain, int step);
+void record_overwrite_ramp(sample_t *dst, const sample_t *src, int frames,
+                int gain, int step);
+
+#endif
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "engine.h"
+#include "mix.h"
+#include "wavfile.h"
+#include "session.h"
+
+// headless looper: input from a file, pedal presses from an event script,
+// output to a file, as fast as the cpu goes.
+//
+// the script has one event per line, sorted or not:
+//   <sample> record <channel> <0|1>
+//   <sample> reset <channel> <0|1>
+//   <sample> gain <channel> <q14 gain>
+//   <sample> mute <channel> <0|1>
+//   <sample> quantize 0 <divisions per loop, 0 for off>
+//   <sample> undo <channel> 0
+//   <sample> redo <channel> 0
+//   <sample> length <channel> <n times the loop, or -n for 1/n of it>
+// where <sample> is the frame index in the input. record events land on
+// that exact frame, the rest at the start of the period it falls in.
+// blank lines and lines starting with # are skipped.
+
+struct event {
+    long when;
+    int type;
+    int track;
+    int value;
+};
+
+static int compareEvents(const void *a, const void *b){
+    const struct event *x = a;
+    const struct event *y = b;
+    return (x->when > y->when) - (x->when < y->when);
+}
+
+static int loadEvents(const char *path, struct event **events){
+    FILE *f = fopen(path, "r");
+    char line[256];
+    char action[32];
+    int count = 0;
+    int size = 0;
+    int lineno = 0;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    *events = NULL;
+
+    while (fgets(line, sizeof(line), f)) {
+        struct event ev;
+        lineno++;
+
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%ld %31s %d %d", &ev.when, action, &ev.track, &ev.value) != 4) {
+            fprintf(stderr, "%s:%d: expected <sample> <action> <channel> <value>\n",
+                path, lineno);
+            goto fail;
+        }
+        if (strcmp(action, "record") == 0) {
+            ev.type = CMD_RECORD;
+        } else if (strcmp(action, "reset") == 0) {
+            ev.type = CMD_RESET;
+        } else if (strcmp(action, "gain") == 0) {
+            ev.type = CMD_GAIN;
+        } else if (strcmp(action, "mute") == 0) {
+            ev.type = CMD_MUTE;
+        } else if (strcmp(action, "quantize") == 0) {
+            ev.type = CMD_QUANTIZE;
+        } else if (strcmp(action, "undo") == 0) {
+            ev.type = CMD_UNDO;
+        } else if (strcmp(action, "redo") == 0) {
+            ev.type = CMD_REDO;
+        } else if (strcmp(action, "length") == 0) {
+            ev.type = CMD_LENGTH;
+        } else {
+            fprintf(stderr, "%s:%d: unknown action '%s'\n", path, lineno, action);
+            goto fail;
+        }
+        if (ev.track < 0 || ev.track >= MAX_TRACKS) {
+            fprintf(stderr, "%s:%d: no channel %d\n", path, lineno, ev.track);
+            goto fail;
+        }
+
+        if (count == size) {
+            size = size ? size * 2 : 64;
+            *events = realloc(*events, sizeof(struct event) * size);
+        }
+        (*events)[count++] = ev;
+    }
+    fclose(f);
+
+    qsort(*events, count, sizeof(struct event), compareEvents);
+    return count;
+
+fail:
+    fclose(f);
+    free(*events);
+    return -1;
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: render [-l latency_frames] [-m mixer] [-j workers] [-u undo_mb] [-o session] input.wav events.txt output.wav\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    struct engine engine;
+    struct wavfile in;
+    struct wavfile out;
+    struct engine_note note;
+    struct event *events;
+    sample_t inbuf[PERIOD_SAMPLES];
+    sample_t outbuf[PERIOD_SAMPLES];
+    struct timespec start, end;
+    const char *mixer = NULL;
+    int latency = 0;
+    int workers = 0;
+    int undo_mb = DEFAULT_UNDO_MB;
+    const char *restore = NULL;
+    int nevents;
+    int tracks = DEFAULT_TRACKS;
+    int i;
+    int next = 0;
+    long frames = 0;
+    long got;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:m:j:u:o:")) != -1) {
+        switch (opt) {
+        case 'l':
+            latency = atoi(optarg);
+            break;
+        case 'm':
+            mixer = optarg;
+            break;
+        case 'j':
+            workers = atoi(optarg);
+            break;
+        case 'u':
+            undo_mb = atoi(optarg);
+            break;
+        case 'o':
+            restore = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 3) {
+        usage();
+    }
+
+    if ((nevents = loadEvents(argv[optind + 1], &events)) < 0) {
+        return 1;
+    }
+    if (wav_open_read(&in, argv[optind]) < 0) {
+        return 1;
+    }
+    //enough tracks for every channel the script touches
+    for (i=0; i<nevents; i++){
+        if (events[i].track >= tracks) {
+            tracks = events[i].track + 1;
+        }
+    }
+    if (engine_init(&engine, tracks, 0, in.rate) < 0 ||
+        engine_start_workers(&engine, workers, 0) < 0) {
+        return 1;
+    }
+    if (mixer && mix_select(mixer) < 0) {
+        fprintf(stderr, "mixer '%s' is not available here\n", mixer);
+        return 1;
+    }
+    engine.latency = latency;
+    engine.undo_bytes = (size_t)undo_mb << 20;
+    //events then play over the saved loops
+    if (restore && session_load(&engine, restore) < 0) {
+        return 1;
+    }
+    if (wav_open_write(&out, argv[optind + 2], engine.rate) < 0) {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while ((got = wav_read(&in, inbuf, FRAMESIZE)) > 0) {
+        //pad the last period out with silence
+        memset(inbuf + FRAMES_TO_SAMPLES(got), 0,
+            sizeof(sample_t) * FRAMES_TO_SAMPLES(FRAMESIZE - got));
+
+        //everything due before the end of this period goes in now
+        while (next < nevents && events[next].when < frames + FRAMESIZE) {
+            if (!engine_send_at(&engine, events[next].type, events[next].track,
+                    events[next].value, events[next].when)) {
+                break;
+            }
+            next++;
+        }
+
+        engine_process(&engine, inbuf, outbuf);
+        engine_service(&engine);
+        wav_write(&out, outbuf, got);
+        frames += got;
+
+        while (engine_poll(&engine, &note)) {
+            if (note.type == NOTE_LOOP_CLOSED) {
+                printf("loop closed at frame %ld, %d periods long\n", frames, note.value);
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("rendered %ld frames in %.3f s (%.1fx realtime, %s mixer)\n",
+        frames, secs, secs > 0 ? frames / (double)engine.rate / secs : 0.0,
+        mix_kernel_name());
+
+    wav_close(&in);
+    wav_close(&out);
+    engine_free(&engine);
+    free(events);
+    return 0;
+}
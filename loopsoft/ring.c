@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+
+int ring_init(struct spsc_ring *r, size_t elem_size, size_t capacity){
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    r->buf = malloc(elem_size * size);
+    if (!r->buf) {
+        return -1;
+    }
+    r->elem_size = elem_size;
+    r->mask = size - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    return 0;
+}
+
+void ring_free(struct spsc_ring *r){
+    free(r->buf);
+    r->buf = NULL;
+}
+
+int ring_push(struct spsc_ring *r, const void *elem){
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head - tail > r->mask) {
+        return 0;
+    }
+    memcpy(r->buf + (head & r->mask) * r->elem_size, elem, r->elem_size);
+    //publish the slot only after its contents are written
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 1;
+}
+
+int ring_pop(struct spsc_ring *r, void *elem){
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (head == tail) {
+        return 0;
+    }
+    memcpy(elem, r->buf + (tail & r->mask) * r->elem_size, r->elem_size);
+    //hand the slot back to the producer only after it has been copied out
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+// single producer / single consumer ring of fixed size elements.
+// push must only ever be called from one thread and pop from one other
+// thread; neither side ever blocks or takes a lock, so it is safe to use
+// from the audio thread.
+struct spsc_ring {
+    unsigned char *buf;
+    size_t elem_size;
+    size_t mask;
+    //next slot to write, only advanced by the producer
+    _Alignas(64) atomic_size_t head;
+    //next slot to read, only advanced by the consumer
+    _Alignas(64) atomic_size_t tail;
+};
+
+// capacity is rounded up to a power of two
+int ring_init(struct spsc_ring *r, size_t elem_size, size_t capacity);
+void ring_free(struct spsc_ring *r);
+
+// returns 1 on success, 0 if the ring is full / empty
+int ring_push(struct spsc_ring *r, const void *elem);
+int ring_pop(struct spsc_ring *r, void *elem);
+
+#endif
@@ -0,0 +1,39 @@
+#include <math.h>
+#include "sample.h"
+
+#define FLOAT_SCALE 32768.0f
+
+void sample_to_accum(accum_t *restrict dst, const sample_t *restrict src, int n){
+    int i;
+    for (i=0; i<n; i++){
+        dst[i] = src[i];
+    }
+}
+
+void accum_to_sample(sample_t *restrict dst, const accum_t *restrict src, int n){
+    int i;
+    for (i=0; i<n; i++){
+        dst[i] = sample_saturate(src[i]);
+    }
+}
+
+void sample_to_float(float *restrict dst, const sample_t *restrict src, int n){
+    int i;
+    for (i=0; i<n; i++){
+        dst[i] = src[i] * (1.0f / FLOAT_SCALE);
+    }
+}
+
+void float_to_sample(sample_t *restrict dst, const float *restrict src, int n){
+    int i;
+    for (i=0; i<n; i++){
+        float v = src[i] * FLOAT_SCALE;
+        //clamp in float first, out of range float to int is undefined
+        if (v > SAMPLE_MAX) {
+            v = SAMPLE_MAX;
+        } else if (v < SAMPLE_MIN) {
+            v = SAMPLE_MIN;
+        }
+        dst[i] = (sample_t)lrintf(v);
+    }
+}
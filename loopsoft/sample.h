@@ -0,0 +1,40 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+
+// interleaved stereo, the format the device is opened in
+#define CHANNELS 2
+
+// one sample as it comes from and goes to the device, and as loops are
+// stored. SND_PCM_FORMAT_S16_LE.
+typedef int16_t sample_t;
+#define SAMPLE_MIN INT16_MIN
+#define SAMPLE_MAX INT16_MAX
+
+// the bus overdub and mix sums are done in, wide enough that summing
+// dozens of full scale tracks can't overflow before the final clamp
+typedef int32_t accum_t;
+
+// sizes are kept in frames (one sample per channel) everywhere and only
+// turned into samples when indexing a buffer
+#define FRAMES_TO_SAMPLES(n) ((n) * CHANNELS)
+
+static inline sample_t sample_saturate(accum_t v){
+    if (v > SAMPLE_MAX) {
+        return SAMPLE_MAX;
+    }
+    if (v < SAMPLE_MIN) {
+        return SAMPLE_MIN;
+    }
+    return (sample_t)v;
+}
+
+// conversion stages. n is in samples.
+void sample_to_accum(accum_t *dst, const sample_t *src, int n);
+void accum_to_sample(sample_t *dst, const accum_t *src, int n);
+// float is full scale at +-1.0, for processing that wants it internally
+void sample_to_float(float *dst, const sample_t *src, int n);
+void float_to_sample(sample_t *dst, const float *src, int n);
+
+#endif
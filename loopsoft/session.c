@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "session.h"
+
+// <name>.loop is a header block, then each track's loop as raw interleaved
+// samples, every one starting on a block boundary so it can be written and
+// mapped as is. the header, all little endian:
+//   0  "LOOPSESS"
+//   8  version
+//  12  sample rate
+//  16  channels
+//  20  loop length in frames, 0 until every track has been written
+//  24  tracks
+//  32  per track, 16 bytes: offset of its samples (64 bit), generation,
+//      its length in frames
+// each track has room for the longest it can be. version 1 had no
+// lengths, every track was the loop's.
+#define LOOP_MAGIC "LOOPSESS"
+#define LOOP_VERSION 2
+#define LOOP_TRACKS_AT 32
+#define LOOP_TRACK_BYTES 16
+
+// <name>.wav has a JUNK chunk padding its header out to a block, so the
+// samples can be written straight from aligned blocks too
+#define WAV_DATA_AT SESSION_ALIGN
+
+#define PERIOD_BYTES (sizeof(sample_t) * PERIOD_SAMPLES)
+// how long the writer sleeps with nothing to do
+#define WRITER_IDLE_NS 10000000L
+
+static void put16(char *p, unsigned v){
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(char *p, uint32_t v){
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(char *p, uint64_t v){
+    put32(p, v & 0xffffffff);
+    put32(p + 4, v >> 32);
+}
+
+static uint32_t get32(const unsigned char *p){
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const unsigned char *p){
+    return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static long long nowNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t roundUp(size_t bytes, size_t to){
+    return (bytes + to - 1) / to * to;
+}
+
+// a track's samples in the loop file
+static long long trackOffset(struct session *s, int x){
+    size_t longest = engine_longest_track(s->engine, s->looplen);
+    return SESSION_ALIGN + x * (long long)roundUp(longest * FRAME_BYTES, SESSION_ALIGN);
+}
+
+static int openFile(struct session *s, const char *path, int flags){
+    int fd;
+
+    if (s->direct) {
+        if ((fd = open(path, flags | O_DIRECT, 0644)) >= 0) {
+            return fd;
+        }
+        //not every filesystem takes it, tmpfs for one
+        if (errno == EINVAL) {
+            fprintf(stderr, "warning: %s can't be written with O_DIRECT\n", path);
+            s->direct = 0;
+        }
+    }
+    if ((fd = open(path, flags, 0644)) < 0) {
+        fprintf(stderr, "cannot open %s (%s)\n", path, strerror(errno));
+        return -errno;
+    }
+    return fd;
+}
+
+// pwrite until it's all out. returns a negative errno, reported the first
+// time only so a full card doesn't flood the terminal.
+static int writeAll(struct session *s, int fd, const char *buf, size_t bytes, long long at){
+    ssize_t n;
+
+    while (bytes) {
+        if ((n = pwrite(fd, buf, bytes, at)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!s->failed) {
+                fprintf(stderr, "session: write failed (%s)\n", strerror(errno));
+            }
+            s->failed = 1;
+            return -errno;
+        }
+        buf += n;
+        bytes -= n;
+        at += n;
+    }
+    return 0;
+}
+
+static void writeWavHeader(struct session *s){
+    char *h = s->header;
+    long long data = s->out_bytes;
+
+    //as much as a WAV can say, the samples go on past it anyway
+    if (data > UINT32_MAX - WAV_DATA_AT) {
+        data = UINT32_MAX - WAV_DATA_AT;
+    }
+    memset(h, 0, SESSION_ALIGN);
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, WAV_DATA_AT - 8 + data);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, 1);
+    put16(h + 22, CHANNELS);
+    put32(h + 24, s->engine->rate);
+    put32(h + 28, s->engine->rate * FRAME_BYTES);
+    put16(h + 32, FRAME_BYTES);
+    put16(h + 34, 16);
+    memcpy(h + 36, "JUNK", 4);
+    put32(h + 40, WAV_DATA_AT - 8 - 44);
+    memcpy(h + WAV_DATA_AT - 8, "data", 4);
+    put32(h + WAV_DATA_AT - 4, data);
+    writeAll(s, s->out_fd, h, SESSION_ALIGN, 0);
+}
+
+static void writeLoopHeader(struct session *s, int complete){
+    struct engine *e = s->engine;
+    char *h = s->header;
+    int x;
+
+    memset(h, 0, SESSION_ALIGN);
+    memcpy(h, LOOP_MAGIC, 8);
+    put32(h + 8, LOOP_VERSION);
+    put32(h + 12, e->rate);
+    put32(h + 16, CHANNELS);
+    put32(h + 20, complete ? s->looplen : 0);
+    put32(h + 24, e->tracks.count);
+    for (x=0; x<e->tracks.count && s->looplen; x++){
+        put64(h + LOOP_TRACKS_AT + x * LOOP_TRACK_BYTES, trackOffset(s, x));
+        put32(h + LOOP_TRACKS_AT + x * LOOP_TRACK_BYTES + 8, s->saved[x]);
+        put32(h + LOOP_TRACKS_AT + x * LOOP_TRACK_BYTES + 12, s->saved_len[x]);
+    }
+    writeAll(s, s->loop_fd, h, SESSION_ALIGN, 0);
+}
+
+static void flushOutput(struct session *s){
+    writeAll(s, s->out_fd, s->out_buf, SESSION_BLOCK_BYTES, WAV_DATA_AT + s->out_bytes);
+    s->out_bytes += SESSION_BLOCK_BYTES;
+    s->out_fill = 0;
+}
+
+// everything the audio thread has tapped off so far, with silence for
+// the periods it couldn't, so the file stays in time
+static int drainOutput(struct session *s){
+    unsigned lost = atomic_load_explicit(&s->engine->tap_lost, memory_order_relaxed);
+    int n = 0;
+
+    while (ring_pop(&s->ring, s->out_buf + s->out_fill)) {
+        n++;
+        if ((s->out_fill += PERIOD_BYTES) == SESSION_BLOCK_BYTES) {
+            flushOutput(s);
+        }
+    }
+    for (; s->lost != lost; s->lost++){
+        memset(s->out_buf + s->out_fill, 0, PERIOD_BYTES);
+        if ((s->out_fill += PERIOD_BYTES) == SESSION_BLOCK_BYTES) {
+            flushOutput(s);
+        }
+    }
+    return n;
+}
+
+// one block of the loops: the next piece of the track being written, or
+// the start of the next one whose table changed. once they are all on
+// disk the header follows. returns 0 if there was nothing to do.
+static int saveStep(struct session *s, int force){
+    struct engine *e = s->engine;
+    size_t bytes;
+    int frames;
+    int x;
+
+    if (s->saving < 0) {
+        if (!s->looplen) {
+            if (!(s->looplen = atomic_load_explicit(&e->closed_len, memory_order_acquire))) {
+                return 0;
+            }
+            for (x=0; x<e->tracks.count; x++){
+                s->saved[x] = atomic_load_explicit(&e->generation[x], memory_order_relaxed) - 1;
+            }
+        }
+        if (!force && nowNs() < s->next_save) {
+            return 0;
+        }
+        for (x=0; x<e->tracks.count; x++){
+            if (s->saved[x] != atomic_load_explicit(&e->generation[x], memory_order_acquire)) {
+                break;
+            }
+        }
+        if (x == e->tracks.count) {
+            if (s->dirty) {
+                writeLoopHeader(s, 1);
+                fdatasync(s->loop_fd);
+                s->dirty = 0;
+            }
+            s->next_save = nowNs() + SESSION_SAVE_MS * 1000000LL;
+            return 0;
+        }
+        //a take or new length that goes in partway through gets the track
+        //written again
+        s->saving = x;
+        s->save_at = 0;
+        s->save_gen = atomic_load_explicit(&e->generation[x], memory_order_acquire);
+        s->save_len = engine_track_length(e, x);
+    }
+
+    x = s->saving;
+    frames = s->save_len - s->save_at;
+    if (frames > SESSION_BLOCK_BYTES / (int)FRAME_BYTES) {
+        frames = SESSION_BLOCK_BYTES / FRAME_BYTES;
+    }
+    bytes = roundUp((size_t)frames * FRAME_BYTES, SESSION_ALIGN);
+    memset(s->stage + (size_t)frames * FRAME_BYTES, 0, bytes - (size_t)frames * FRAME_BYTES);
+    engine_read_track(e, x, (sample_t *)s->stage, s->save_at, frames);
+    writeAll(s, s->loop_fd, s->stage, bytes, trackOffset(s, x) + (long long)s->save_at * FRAME_BYTES);
+    s->dirty = 1;
+
+    if ((s->save_at += frames) == s->save_len) {
+        s->saved[x] = s->save_gen;
+        s->saved_len[x] = s->save_len;
+        s->saving = -1;
+    }
+    return 1;
+}
+
+static void *writerThread(void *arg){
+    struct session *s = arg;
+    struct timespec idle = { 0, WRITER_IDLE_NS };
+
+    while (!atomic_load_explicit(&s->stop, memory_order_acquire)) {
+        //output first, the ring is what can't wait
+        int busy = drainOutput(s);
+        busy |= saveStep(s, 0);
+        if (!busy) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+int session_open(struct session *s, struct engine *e, const char *name, int direct){
+    char path[PATH_MAX];
+    int err;
+
+    memset(s, 0, sizeof(*s));
+    s->engine = e;
+    s->direct = direct;
+    s->out_fd = s->loop_fd = -1;
+    s->saving = -1;
+    atomic_init(&s->stop, 0);
+
+    if (ring_init(&s->ring, PERIOD_BYTES, SESSION_RING_PERIODS) < 0 ||
+        posix_memalign((void **)&s->out_buf, SESSION_ALIGN, SESSION_BLOCK_BYTES) ||
+        posix_memalign((void **)&s->stage, SESSION_ALIGN, SESSION_BLOCK_BYTES) ||
+        posix_memalign((void **)&s->header, SESSION_ALIGN, SESSION_ALIGN)) {
+        err = -ENOMEM;
+        goto fail;
+    }
+
+    snprintf(path, sizeof(path), "%s.wav", name);
+    if ((err = s->out_fd = openFile(s, path, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+        goto fail;
+    }
+    snprintf(path, sizeof(path), "%s.loop", name);
+    if ((err = s->loop_fd = openFile(s, path, O_WRONLY | O_CREAT)) < 0) {
+        goto fail;
+    }
+    writeWavHeader(s);
+    writeLoopHeader(s, 0);
+
+    e->tap = &s->ring;
+    s->lost = atomic_load_explicit(&e->tap_lost, memory_order_relaxed);
+    if ((err = -pthread_create(&s->thread, NULL, writerThread, s)) < 0) {
+        fprintf(stderr, "cannot start session writer (%s)\n", strerror(-err));
+        e->tap = NULL;
+        goto fail;
+    }
+    s->running = 1;
+    return 0;
+
+fail:
+    session_close(s);
+    return err;
+}
+
+void session_close(struct session *s){
+    int flags;
+
+    if (s->running) {
+        atomic_store_explicit(&s->stop, 1, memory_order_release);
+        pthread_join(s->thread, NULL);
+        s->running = 0;
+        s->engine->tap = NULL;
+
+        //the last of it, all the loops as they ended up, then the tail,
+        //which isn't a whole block
+        drainOutput(s);
+        while (saveStep(s, 1));
+        if (s->direct) {
+            flags = fcntl(s->out_fd, F_GETFL);
+            fcntl(s->out_fd, F_SETFL, flags & ~O_DIRECT);
+        }
+        writeAll(s, s->out_fd, s->out_buf, s->out_fill, WAV_DATA_AT + s->out_bytes);
+        s->out_bytes += s->out_fill;
+        s->out_fill = 0;
+        writeWavHeader(s);
+    }
+    if (s->out_fd >= 0) {
+        close(s->out_fd);
+    }
+    if (s->loop_fd >= 0) {
+        fdatasync(s->loop_fd);
+        close(s->loop_fd);
+    }
+    s->out_fd = s->loop_fd = -1;
+    free(s->out_buf);
+    free(s->stage);
+    free(s->header);
+    s->out_buf = s->stage = s->header = NULL;
+    ring_free(&s->ring);
+}
+
+int session_load(struct engine *e, const char *name){
+    const sample_t *loops[MAX_TRACKS] = { NULL };
+    int lengths[MAX_TRACKS] = { 0 };
+    const unsigned char *h;
+    char path[PATH_MAX];
+    struct stat st;
+    void *map;
+    uint32_t frames;
+    uint32_t ntracks;
+    uint32_t version;
+    int err = -EINVAL;
+    int fd;
+    int x;
+
+    snprintf(path, sizeof(path), "%s.loop", name);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "cannot open %s (%s)\n", path, strerror(errno));
+        return -errno;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < SESSION_ALIGN) {
+        fprintf(stderr, "%s: not a saved session\n", path);
+        close(fd);
+        return -EINVAL;
+    }
+    //nothing is parsed or decoded, the loops are copied straight out of
+    //the page cache
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "cannot map %s (%s)\n", path, strerror(errno));
+        return -errno;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+    h = map;
+
+    frames = get32(h + 20);
+    ntracks = get32(h + 24);
+    version = get32(h + 8);
+    if (memcmp(h, LOOP_MAGIC, 8) != 0 || version < 1 || version > LOOP_VERSION ||
+            get32(h + 16) != CHANNELS || ntracks > MAX_TRACKS) {
+        fprintf(stderr, "%s: not a saved session\n", path);
+        goto out;
+    }
+    if (!frames) {
+        fprintf(stderr, "%s: the loop was never written out\n", path);
+        goto out;
+    }
+    if (get32(h + 12) != e->rate) {
+        fprintf(stderr, "warning: %s was saved at %u Hz\n", path, get32(h + 12));
+    }
+    if ((int)ntracks != e->tracks.count) {
+        fprintf(stderr, "warning: %s has %u tracks\n", path, ntracks);
+    }
+    for (x=0; x<e->tracks.count && x<(int)ntracks; x++){
+        uint64_t at = get64(h + LOOP_TRACKS_AT + x * LOOP_TRACK_BYTES);
+        uint32_t len = version > 1 ? get32(h + LOOP_TRACKS_AT + x * LOOP_TRACK_BYTES + 12) : frames;
+        if (len > INT_MAX || at + (uint64_t)len * FRAME_BYTES > (uint64_t)st.st_size) {
+            fprintf(stderr, "%s: track %d is cut short\n", path, x);
+            goto out;
+        }
+        loops[x] = (const sample_t *)(h + at);
+        lengths[x] = len;
+    }
+    if ((err = engine_restore(e, frames, loops, lengths)) < 0) {
+        fprintf(stderr, "%s: can't loop %u frames with the tracks' lengths\n", path, frames);
+    }
+
+out:
+    munmap(map, st.st_size);
+    return err;
+}
@@ -0,0 +1,69 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "engine.h"
+#include "ring.h"
+
+// a performance streamed to disk as it is played. the audio thread taps
+// its output into a ring; a writer thread drains it into <name>.wav and,
+// every so often, writes the loops whose tables changed into <name>.loop.
+// all writes are big and aligned and only the writer ever waits on them,
+// so a slow card can't hold up the audio.
+
+// output periods the ring holds, about 6 s at 44.1k
+#define SESSION_RING_PERIODS 8192
+// the writer's unit of i/o, and what it aligns to
+#define SESSION_BLOCK_BYTES (1 << 20)
+#define SESSION_ALIGN 4096
+// how often the loops are looked at for changes
+#define SESSION_SAVE_MS 1000
+
+struct session {
+    struct engine *engine;
+    struct spsc_ring ring;
+    pthread_t thread;
+    int running;
+    atomic_int stop;
+    //opened with O_DIRECT
+    int direct;
+    //a write failed, and was reported
+    int failed;
+    //one block for either file's header
+    char *header;
+
+    //the output, as a WAV file whose samples start a block in
+    int out_fd;
+    char *out_buf;
+    size_t out_fill;
+    long long out_bytes;
+    unsigned lost;
+
+    //the loops, see the layout in session.c
+    int loop_fd;
+    char *stage;
+    int looplen;
+    //generation and length of each track on disk, and the track being
+    //written
+    unsigned saved[MAX_TRACKS];
+    int saved_len[MAX_TRACKS];
+    int dirty;
+    int saving;
+    int save_at;
+    unsigned save_gen;
+    int save_len;
+    long long next_save;
+};
+
+// starts streaming e to name.wav and name.loop, with O_DIRECT if direct
+// and the filesystem takes it. call before the engine is started.
+int session_open(struct session *s, struct engine *e, const char *name, int direct);
+// writes out whatever is left and stops the writer. the engine must
+// be stopped first.
+void session_close(struct session *s);
+
+// starts e from the loops saved in name.loop, see engine_restore
+int session_load(struct engine *e, const char *name);
+
+#endif
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "stats.h"
+
+// how far the server thread steps back from everything else
+#define SERVER_NICE 10
+#define REPORT_BYTES 4096
+
+static const char *const time_names[] = { "read wait", "dsp", "write wait", "cycle" };
+static const double points[] = { 0.5, 0.9, 0.99, 0.999 };
+#define NPOINTS (int)(sizeof(points) / sizeof(points[0]))
+
+// stores rather than atomic_init, the server may be reading
+void stats_init(struct audio_stats *s){
+    int i, j;
+
+    for (i=0; i<STAT_TIMES; i++){
+        for (j=0; j<STATS_BUCKETS; j++){
+            atomic_store_explicit(&s->time[i].count[j], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&s->time[i].max, 0, memory_order_relaxed);
+    }
+    for (i=0; i<STAT_COUNTS; i++){
+        atomic_store_explicit(&s->count[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->budget, 0, memory_order_relaxed);
+    s->last_start = 0;
+}
+
+// the largest time that lands in bucket
+static long long bucketTop(int bucket){
+    int shift;
+
+    if (bucket < STATS_SUB) {
+        return bucket;
+    }
+    shift = bucket / STATS_SUB - 1;
+    return ((long long)(STATS_SUB + bucket % STATS_SUB + 1) << shift) - 1;
+}
+
+long long stats_percentile(const struct stats_histogram *h, double fraction){
+    unsigned counts[STATS_BUCKETS];
+    unsigned long long total = 0;
+    unsigned long long seen = 0;
+    unsigned long long want;
+    long long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    int i;
+
+    //one pass to take a copy, the audio thread keeps on counting
+    for (i=0; i<STATS_BUCKETS; i++){
+        counts[i] = atomic_load_explicit(&h->count[i], memory_order_relaxed);
+        total += counts[i];
+    }
+    if (!total) {
+        return 0;
+    }
+    want = (unsigned long long)(fraction * total + 0.5);
+    if (want < 1) {
+        want = 1;
+    }
+    for (i=0; i<STATS_BUCKETS; i++){
+        seen += counts[i];
+        if (seen >= want) {
+            //nothing was ever bigger than the max
+            return bucketTop(i) < max ? bucketTop(i) : max;
+        }
+    }
+    return max;
+}
+
+// appends to buf like snprintf, keeping count past the end
+static int append(char *buf, size_t size, int len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static int append(char *buf, size_t size, int len, const char *fmt, ...){
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(len < (int)size ? buf + len : NULL, len < (int)size ? size - len : 0, fmt, ap);
+    va_end(ap);
+    return len + (n > 0 ? n : 0);
+}
+
+int stats_report(const struct audio_stats *s, char *buf, size_t size){
+    long long budget = atomic_load_explicit(&s->budget, memory_order_relaxed);
+    int len = 0;
+    int i, j;
+
+    len = append(buf, size, len, "periods %u  xruns %u  short reads %u  over budget %u\n",
+        atomic_load_explicit(&s->count[STAT_PERIODS], memory_order_relaxed),
+        atomic_load_explicit(&s->count[STAT_XRUNS], memory_order_relaxed),
+        atomic_load_explicit(&s->count[STAT_SHORT_READS], memory_order_relaxed),
+        atomic_load_explicit(&s->count[STAT_OVER_BUDGET], memory_order_relaxed));
+    len = append(buf, size, len, "budget %.1f us\n\n%-12s", budget / 1000.0, "us");
+    for (j=0; j<NPOINTS; j++){
+        len = append(buf, size, len, " %9g%%", points[j] * 100);
+    }
+    len = append(buf, size, len, " %10s\n", "max");
+    for (i=0; i<STAT_TIMES; i++){
+        const struct stats_histogram *h = &s->time[i];
+
+        len = append(buf, size, len, "%-12s", time_names[i]);
+        for (j=0; j<NPOINTS; j++){
+            len = append(buf, size, len, " %10.1f", stats_percentile(h, points[j]) / 1000.0);
+        }
+        len = append(buf, size, len, " %10.1f\n",
+            atomic_load_explicit(&h->max, memory_order_relaxed) / 1000.0);
+    }
+    return len;
+}
+
+/* the server */
+
+static void *serverThread(void *arg){
+    struct stats_server *srv = arg;
+    struct pollfd fds[2];
+    char report[REPORT_BYTES];
+    char byte;
+
+    //stats are never worth taking time from the audio or the controls
+    if (setpriority(PRIO_PROCESS, gettid(), SERVER_NICE) < 0) {
+        fprintf(stderr, "warning: stats server runs at normal priority (%s)\n", strerror(errno));
+    }
+
+    fds[0].fd = srv->wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = srv->fd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        int client;
+        int len;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "stats: poll failed (%s)\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (read(srv->wake[0], &byte, 1) < 0) {
+                perror("stats wakeup");
+            }
+            break;
+        }
+        if ((client = accept4(srv->fd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+            continue;
+        }
+        len = stats_report(srv->stats, report, sizeof(report));
+        if (len >= (int)sizeof(report)) {
+            len = sizeof(report) - 1;
+        }
+        //a reader that doesn't keep up just gets less
+        if (send(client, report, len, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            fprintf(stderr, "stats: send failed (%s)\n", strerror(errno));
+        }
+        close(client);
+    }
+    return NULL;
+}
+
+int stats_serve(struct stats_server *srv, const struct audio_stats *s, const char *path){
+    struct sockaddr_un addr;
+    int err;
+
+    memset(srv, 0, sizeof(*srv));
+    srv->stats = s;
+    srv->wake[0] = srv->wake[1] = -1;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "stats socket path too long: %s\n", path);
+        return -ENAMETOOLONG;
+    }
+    snprintf(srv->path, sizeof(srv->path), "%s", path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+    if ((srv->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        return -errno;
+    }
+    //left behind by a looper that didn't get to clean up
+    unlink(path);
+    if (bind(srv->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(srv->fd, 4) < 0) {
+        err = -errno;
+        fprintf(stderr, "cannot serve stats on %s (%s)\n", path, strerror(errno));
+        close(srv->fd);
+        srv->fd = -1;
+        return err;
+    }
+    if (pipe(srv->wake) < 0) {
+        err = -errno;
+        stats_close(srv);
+        return err;
+    }
+    if ((err = pthread_create(&srv->thread, NULL, serverThread, srv))) {
+        stats_close(srv);
+        return -err;
+    }
+    srv->running = 1;
+    return 0;
+}
+
+void stats_close(struct stats_server *srv){
+    char byte = 0;
+
+    if (srv->running) {
+        if (write(srv->wake[1], &byte, 1) < 0) {
+            perror("stats wakeup");
+        }
+        pthread_join(srv->thread, NULL);
+        srv->running = 0;
+    }
+    if (srv->fd >= 0) {
+        close(srv->fd);
+        unlink(srv->path);
+    }
+    srv->fd = -1;
+    if (srv->wake[0] >= 0) {
+        close(srv->wake[0]);
+        close(srv->wake[1]);
+    }
+    srv->wake[0] = srv->wake[1] = -1;
+}
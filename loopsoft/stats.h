@@ -0,0 +1,105 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// how each audio period went, kept by the audio thread as it runs and
+// read from anywhere. times go into log-linear histograms, HDR style:
+// exact below 2^STATS_SUB_BITS ns, then 2^STATS_SUB_BITS buckets per
+// power of two, so anything reads back within about 6%. everything is
+// written by the one audio thread with plain relaxed stores, never a
+// lock, a syscall or a printf.
+
+#define STATS_SUB_BITS 4
+#define STATS_SUB (1 << STATS_SUB_BITS)
+// times are clamped to 2^STATS_MAX_BITS ns, about a minute
+#define STATS_MAX_BITS 36
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB)
+
+enum stats_time {
+    STAT_READ_WAIT,     // blocked waiting for the input
+    STAT_DSP,           // in the engine
+    STAT_WRITE_WAIT,    // handing the output over
+    STAT_CYCLE,         // from one period's start to the next
+    STAT_TIMES,
+};
+
+enum stats_count {
+    STAT_PERIODS,       // passes through the engine
+    STAT_XRUNS,
+    STAT_SHORT_READS,   // input that came up short and was padded
+    STAT_OVER_BUDGET,   // engine took longer than the audio it made
+    STAT_COUNTS,
+};
+
+struct stats_histogram {
+    atomic_uint count[STATS_BUCKETS];
+    atomic_llong max;
+};
+
+struct audio_stats {
+    struct stats_histogram time[STAT_TIMES];
+    atomic_uint count[STAT_COUNTS];
+    //ns of audio one pass through the engine makes
+    atomic_llong budget;
+    //when the last period started, for STAT_CYCLE
+    long long last_start;
+};
+
+void stats_init(struct audio_stats *s);
+
+// audio thread only
+static inline int stats_bucket(long long ns){
+    int msb;
+
+    if (ns < STATS_SUB) {
+        return ns < 0 ? 0 : (int)ns;
+    }
+    if (ns >= 1LL << STATS_MAX_BITS) {
+        ns = (1LL << STATS_MAX_BITS) - 1;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    return (msb - STATS_SUB_BITS + 1) * STATS_SUB +
+        (int)((ns >> (msb - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+static inline void stats_time(struct audio_stats *s, int which, long long ns){
+    struct stats_histogram *h = &s->time[which];
+    atomic_uint *c = &h->count[stats_bucket(ns)];
+
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+    if (ns > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+    }
+}
+
+static inline void stats_count(struct audio_stats *s, int which, unsigned n){
+    atomic_uint *c = &s->count[which];
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+// the time that fraction (0 to 1) of the samples came in under, as the
+// top of its bucket. 0 if there are none.
+long long stats_percentile(const struct stats_histogram *h, double fraction);
+// everything as text, a table of percentiles per time. returns the length.
+int stats_report(const struct audio_stats *s, char *buf, size_t size);
+
+// serves the report to anything that connects to a unix socket, from a
+// thread of its own at low priority:
+//   socat - UNIX-CONNECT:<path>
+struct stats_server {
+    const struct audio_stats *stats;
+    int fd;
+    int wake[2];
+    pthread_t thread;
+    int running;
+    char path[108];
+};
+
+int stats_serve(struct stats_server *srv, const struct audio_stats *s, const char *path);
+void stats_close(struct stats_server *srv);
+
+#endif
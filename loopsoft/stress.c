@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "audio.h"
+
+// runs the looper on the null backend's loopback with xruns forced every
+// so often, and checks it comes through them in time:
+//  - the sample clock stays with the wall clock, rather than falling
+//    behind by every gap
+//  - a click looped on track 0 comes back in through the loopback and is
+//    overdubbed on track 1, which is muted so it doesn't feed back. it
+//    must land on the click's own frame, pass after pass.
+
+#define LOOP_FRAMES (SAMPLE_HZ / 2 / FRAMESIZE * FRAMESIZE)
+#define CLICK 1000
+#define PERIOD (2 * FRAMESIZE)
+// loopback delay, a couple of periods like a real card
+#define DELAY_FRAMES (3 * PERIOD)
+// slack on the clock for scheduling jitter and the part of a gap short of
+// a whole period
+#define CLOCK_SLACK_FRAMES (4 * PERIOD)
+#define SETTLE_MS 200
+
+static void usage(void){
+    fprintf(stderr, "usage: stress [-t seconds] [-e every_ms] [-s stall_ms] [-j cores]\n"
+        "              [-c channels]\n");
+    exit(1);
+}
+
+// the control thread's part while it runs, for ms
+static void run(struct engine *e, int ms, int *xruns, long long *skipped){
+    struct engine_note note;
+    int i;
+
+    for (i=0; i<ms; i++){
+        engine_service(e);
+        while (engine_poll(e, &note)) {
+            if (note.type == NOTE_XRUN) {
+                (*xruns)++;
+            } else if (note.type == NOTE_SKIPPED) {
+                *skipped += note.value;
+            }
+        }
+        usleep(1000);
+    }
+}
+
+int main(int argc, char *argv[]){
+    static struct engine engine;
+    static struct audio audio;
+    static sample_t click[FRAMES_TO_SAMPLES(LOOP_FRAMES)];
+    static sample_t got[FRAMES_TO_SAMPLES(LOOP_FRAMES)];
+    const sample_t *loops[MAX_TRACKS] = { click };
+    char device[64];
+    char report[2048];
+    int seconds = 10;
+    int every = 300;
+    int stall = 20;
+    int cores = 1;
+    int channels = CHANNELS;
+    int xruns = 0;
+    long long skipped = 0;
+    long long t1, t2, f1, f2, drift;
+    int misplaced = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "t:e:s:j:c:")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'e':
+            every = atoi(optarg);
+            break;
+        case 's':
+            stall = atoi(optarg);
+            break;
+        case 'j':
+            cores = atoi(optarg);
+            break;
+        case 'c':
+            channels = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (seconds <= 0 || every <= 0 || stall < 0 || cores < 1) {
+        usage();
+    }
+
+    snprintf(device, sizeof(device), "loop:%d@%d:%d", DELAY_FRAMES, every, stall);
+    click[0] = click[1] = CLICK;
+    if (audio_open(&audio, &audio_null, device, SAMPLE_HZ, PERIOD, channels) < 0 ||
+            engine_init(&engine, 2, 0, audio.rate) < 0 ||
+            engine_start_workers(&engine, cores - 1, 0) < 0) {
+        return 1;
+    }
+    audio_attach(&audio, &engine);
+    //the loopback is exact, whatever a stored calibration says
+    engine.latency = audio.latency;
+    if (engine_restore(&engine, LOOP_FRAMES, loops, NULL) < 0) {
+        fprintf(stderr, "cannot set up the loop\n");
+        return 1;
+    }
+    engine_send(&engine, CMD_MUTE, 1, 1);
+    engine_send(&engine, CMD_RECORD, 1, 1);
+    if (audio_start(&audio) < 0) {
+        fprintf(stderr, "cannot start the null backend\n");
+        return 1;
+    }
+    printf("%s, %d channels, %d s\n", device, channels, seconds);
+
+    run(&engine, SETTLE_MS, &xruns, &skipped);
+    t1 = audio_now();
+    f1 = engine_frame_at(&engine, t1);
+    run(&engine, seconds * 1000, &xruns, &skipped);
+    t2 = audio_now();
+    f2 = engine_frame_at(&engine, t2);
+
+    //the take in progress goes in once it's faded out
+    engine_send(&engine, CMD_RECORD, 1, 0);
+    run(&engine, 2 * LOOP_FRAMES * 1000 / SAMPLE_HZ, &xruns, &skipped);
+    audio_stop(&audio);
+
+    engine_read_track(&engine, 1, got, 0, LOOP_FRAMES);
+    for (i=1; i<LOOP_FRAMES; i++){
+        if (got[FRAMES_TO_SAMPLES(i)]) {
+            misplaced++;
+        }
+    }
+    drift = (f2 - f1) - (t2 - t1) * SAMPLE_HZ / 1000000000LL;
+
+    stats_report(&audio.stats, report, sizeof(report));
+    printf("%s\n", report);
+    printf("xruns %d, %lld frames lost and run through\n", xruns, skipped);
+    printf("clock drift %lld frames (slack %d)\n", drift, CLOCK_SLACK_FRAMES);
+    printf("click on track 1: %d at its frame, %d frames elsewhere\n", got[0], misplaced);
+
+    audio_close(&audio);
+    engine_free(&engine);
+
+    if (llabs(drift) > CLOCK_SLACK_FRAMES || !got[0] || misplaced || (stall && !xruns)) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
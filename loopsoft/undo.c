@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "undo.h"
+
+#define CHUNK_SAMPLES FRAMES_TO_SAMPLES(CHUNK_FRAMES)
+
+void undo_init(struct undo *u){
+    memset(u, 0, sizeof(*u));
+    u->store.fd = -1;
+    atomic_init(&u->nfree, 0);
+    atomic_init(&u->ready, 0);
+}
+
+void undo_free(struct undo *u){
+    int i, j;
+
+    //whatever the layers still hold packed is theirs alone
+    for (i=0; i<UNDO_LAYERS && u->packed_mem; i++){
+        for (j=0; j<u->layers[i].n; j++){
+            free(u->layers[i].packed[j]);
+        }
+    }
+    loopstore_release(&u->store);
+    free(u->chunk_mem);
+    free(u->ptr_mem);
+    free(u->peak_mem);
+    free(u->packed_mem);
+    ring_free(&u->free);
+    ring_free(&u->spare);
+    ring_free(&u->retired);
+    undo_init(u);
+}
+
+int undo_start(struct undo *u, size_t bytes, int longest, int pin){
+    size_t frames;
+    struct layer *l;
+    sample_t *chunk;
+    int err;
+    int i;
+
+    u->nchunks = bytes / (CHUNK_FRAMES * FRAME_BYTES);
+    u->layer_chunks = (longest + CHUNK_FRAMES - 1) / CHUNK_FRAMES;
+    if (!u->nchunks) {
+        return 0;
+    }
+    frames = (size_t)u->nchunks * CHUNK_FRAMES;
+    u->low = u->nchunks / 4 < UNDO_LOW_CHUNKS ? u->nchunks / 4 : UNDO_LOW_CHUNKS;
+
+    if ((err = loopstore_reserve(&u->store, frames, NULL)) < 0 ||
+        (err = loopstore_commit(&u->store, frames)) < 0) {
+        fprintf(stderr, "no room for undo history, overdubs are for good\n");
+        undo_free(u);
+        return err;
+    }
+    if (pin) {
+        loopstore_lock(&u->store, frames);
+    }
+
+    u->chunk_mem = malloc(sizeof(int) * UNDO_LAYERS * u->layer_chunks);
+    u->ptr_mem = malloc(sizeof(sample_t *) * UNDO_LAYERS * u->layer_chunks);
+    u->peak_mem = malloc(sizeof(uint16_t) * UNDO_LAYERS * u->layer_chunks);
+    u->packed_mem = malloc(sizeof(struct pack *) * UNDO_LAYERS * u->layer_chunks);
+    if (!u->chunk_mem || !u->ptr_mem || !u->peak_mem || !u->packed_mem ||
+        ring_init(&u->free, sizeof(sample_t *), u->nchunks) < 0 ||
+        ring_init(&u->spare, sizeof(struct layer *), UNDO_LAYERS) < 0 ||
+        ring_init(&u->retired, sizeof(struct layer *), UNDO_LAYERS) < 0) {
+        undo_free(u);
+        return -ENOMEM;
+    }
+    //touched here so the audio thread doesn't fault them in
+    memset(u->chunk_mem, 0, sizeof(int) * UNDO_LAYERS * u->layer_chunks);
+    memset(u->ptr_mem, 0, sizeof(sample_t *) * UNDO_LAYERS * u->layer_chunks);
+    memset(u->peak_mem, 0, sizeof(uint16_t) * UNDO_LAYERS * u->layer_chunks);
+    memset(u->packed_mem, 0, sizeof(struct pack *) * UNDO_LAYERS * u->layer_chunks);
+
+    for (i=0; i<u->nchunks; i++){
+        chunk = u->store.body + (size_t)i * CHUNK_SAMPLES;
+        ring_push(&u->free, &chunk);
+    }
+    atomic_store_explicit(&u->nfree, u->nchunks, memory_order_relaxed);
+    for (i=0; i<UNDO_LAYERS; i++){
+        l = &u->layers[i];
+        l->chunk = u->chunk_mem + (size_t)i * u->layer_chunks;
+        l->ptr = u->ptr_mem + (size_t)i * u->layer_chunks;
+        l->peak = u->peak_mem + (size_t)i * u->layer_chunks;
+        l->packed = u->packed_mem + (size_t)i * u->layer_chunks;
+        ring_push(&u->spare, &l);
+    }
+    atomic_store_explicit(&u->ready, 1, memory_order_release);
+    return 0;
+}
+
+// only chunks from the pool go back to it. the loop as first recorded
+// lives in the track's own store.
+static int fromPool(struct undo *u, const sample_t *p){
+    return p >= u->store.body && p < u->store.body + (size_t)u->nchunks * CHUNK_SAMPLES;
+}
+
+void undo_service(struct undo *u){
+    struct layer *l;
+    int freed = 0;
+    int i;
+
+    if (!atomic_load_explicit(&u->ready, memory_order_acquire)) {
+        return;
+    }
+    while (ring_pop(&u->retired, &l)) {
+        for (i=0; i<l->n; i++){
+            free(l->packed[i]);
+            l->packed[i] = NULL;
+            if (!l->ptr[i]) {
+                continue;
+            }
+            if (fromPool(u, l->ptr[i])) {
+                freed += ring_push(&u->free, &l->ptr[i]);
+            } else {
+                //a slice of the first recording, which nothing else has
+                loopstore_discard(l->ptr[i], CHUNK_FRAMES);
+            }
+        }
+        l->n = 0;
+        l->older = l->newer = NULL;
+        ring_push(&u->spare, &l);
+    }
+    atomic_fetch_add_explicit(&u->nfree, freed, memory_order_relaxed);
+}
+
+sample_t *undo_take_chunk(struct undo *u){
+    sample_t *chunk;
+
+    if (!ring_pop(&u->free, &chunk)) {
+        return NULL;
+    }
+    atomic_fetch_sub_explicit(&u->nfree, 1, memory_order_relaxed);
+    return chunk;
+}
+
+struct layer *undo_take_layer(struct undo *u){
+    struct layer *l;
+
+    if (!atomic_load_explicit(&u->ready, memory_order_acquire) ||
+        !ring_pop(&u->spare, &l)) {
+        return NULL;
+    }
+    return l;
+}
+
+void undo_retire(struct undo *u, struct layer *l){
+    //there is a slot for every layer, so this can't fail
+    ring_push(&u->retired, &l);
+}
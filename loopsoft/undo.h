@@ -0,0 +1,86 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "ring.h"
+#include "sample.h"
+#include "loopstore.h"
+
+// undo history of overdubs. a track is a table of CHUNK_FRAMES long
+// chunks, and an overdub copies a chunk the first time it writes to it
+// (copy on write) rather than change the one playing. when the take ends
+// its chunks go into the table and the ones they replace are kept as a
+// layer: undo swaps them back in, which leaves what it took out in the
+// layer for redo.
+//
+// chunks come from one pool the size of the memory budget. the audio
+// thread takes free chunks and empty layers off rings and hands back the
+// layers it is done with; the control thread frees their chunks. when the
+// pool runs low the oldest layer of any track goes.
+
+#define CHUNK_FRAMES 4096
+// layers across all tracks
+#define UNDO_LAYERS 128
+#define DEFAULT_UNDO_MB 64
+// free chunks below which the oldest layer is let go, or a quarter of
+// the pool if that is less
+#define UNDO_LOW_CHUNKS 128
+
+struct layer {
+    int track;
+    //order layers were made in, the oldest goes first
+    unsigned seq;
+    //neighbours in the track's history
+    struct layer *older;
+    struct layer *newer;
+    //chunks the take or reset replaced, and what undo or redo swaps in
+    //for each with its peak and packed copy, see tracks.peak and
+    //tracks.packed. NULL is an empty chunk.
+    int n;
+    int *chunk;
+    sample_t **ptr;
+    uint16_t *peak;
+    struct pack **packed;
+    //and the track's length, traded the same way, see tracks.len
+    int len;
+};
+
+struct undo {
+    struct loopstore store;
+    int nchunks;
+    //chunks a layer can hold, enough for the longest track
+    int layer_chunks;
+    struct layer layers[UNDO_LAYERS];
+    int *chunk_mem;
+    sample_t **ptr_mem;
+    uint16_t *peak_mem;
+    struct pack **packed_mem;
+
+    //control -> audio
+    struct spsc_ring free;
+    struct spsc_ring spare;
+    //audio -> control
+    struct spsc_ring retired;
+    atomic_int nfree;
+    int low;
+    //set once the pool is in, until then overdubs are written in place
+    atomic_int ready;
+};
+
+void undo_init(struct undo *u);
+void undo_free(struct undo *u);
+
+// control thread. start sets the pool up for tracks up to longest frames,
+// service gives the chunks of retired layers back, and the pages of any
+// of the first recording to the system. packed chunks are freed.
+int undo_start(struct undo *u, size_t bytes, int longest, int pin);
+void undo_service(struct undo *u);
+
+// audio thread. either take returns NULL when there is none to be had.
+sample_t *undo_take_chunk(struct undo *u);
+struct layer *undo_take_layer(struct undo *u);
+void undo_retire(struct undo *u, struct layer *l);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "unojoy.h"
+
+// 10 bits a byte on the wire
+#define BYTE_NS (10 * 1000000000LL / 38400)
+// UnoJoy's own firmware gives up on a reply after 25 ms
+#define REPLY_TIMEOUT_NS 25000000LL
+// how often to ask a board that hasn't started pushing, it may still be
+// in its bootloader after the port was opened
+#define PUSH_RETRY_NS 1000000000LL
+#define BUTTON_MASK ((1u << UNOJOY_BUTTONS) - 1)
+
+static const unsigned char request[UNOJOY_STATE_BYTES] = { 0, 1, 2 };
+
+static long long now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int unojoy_open(struct unojoy *u, const char *path, int hz){
+    struct termios tio;
+    unsigned char byte = UNOJOY_PUSH;
+
+    memset(u, 0, sizeof(*u));
+    u->hz = hz;
+    u->period = hz > 0 ? 1000000000LL / hz : PUSH_RETRY_NS;
+    if ((u->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+        fprintf(stderr, "cannot open %s (%s)\n", path, strerror(errno));
+        return -errno;
+    }
+    if (tcgetattr(u->fd, &tio) < 0) {
+        fprintf(stderr, "%s is not a serial port (%s)\n", path, strerror(errno));
+        unojoy_close(u);
+        return -ENOTTY;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, UNOJOY_BAUD);
+    cfsetospeed(&tio, UNOJOY_BAUD);
+    tio.c_cflag |= CLOCAL | CREAD;
+    //with O_NONBLOCK, so a read with nothing there is EAGAIN, not EOF
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(u->fd, TCSANOW, &tio) < 0) {
+        fprintf(stderr, "cannot set up %s (%s)\n", path, strerror(errno));
+        unojoy_close(u);
+        return -errno;
+    }
+    tcflush(u->fd, TCIOFLUSH);
+
+    u->next = now();
+    if (!hz) {
+        //asked straight away, and again until it answers
+        if (write(u->fd, &byte, 1) == 1) {
+            u->sent = u->next;
+            u->next += u->period;
+        }
+    }
+    printf("using UnoJoy on %s, %s\n", path, hz ? "polled" : "pushing changes");
+    return 0;
+}
+
+void unojoy_close(struct unojoy *u){
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    u->fd = -1;
+}
+
+long long unojoy_deadline(struct unojoy *u){
+    //a pushing board says when things change
+    if (!u->hz && u->have_state) {
+        return -1;
+    }
+    //a reply on its way holds the next request back, until it's late
+    if (u->hz && u->sent > 0) {
+        return u->sent + REPLY_TIMEOUT_NS > u->next ? u->sent + REPLY_TIMEOUT_NS : u->next;
+    }
+    return u->next;
+}
+
+int unojoy_send(struct unojoy *u, long long when){
+    unsigned char byte = UNOJOY_PUSH;
+    long long deadline = unojoy_deadline(u);
+    ssize_t n;
+
+    if (deadline < 0 || when < deadline) {
+        return 0;
+    }
+    if (u->hz) {
+        //a reply that never came, or came half way, is dropped with
+        //anything still on its way so the next lines up again
+        if (u->sent > 0) {
+            tcflush(u->fd, TCIFLUSH);
+            u->fill = 0;
+        }
+        n = write(u->fd, request, sizeof(request));
+    } else {
+        n = write(u->fd, &byte, 1);
+    }
+    if (n < 0 && errno != EAGAIN) {
+        return -errno;
+    }
+    u->sent = when;
+    //a slow reply shifts the polls rather than bunching them up
+    u->next += u->period;
+    if (u->next < when) {
+        u->next = when + u->period;
+    }
+    return 0;
+}
+
+// what changed since the last state, at when
+static void diff(struct unojoy *u, uint32_t state, long long when, unojoy_fn fn, void *arg){
+    uint32_t changed;
+    int i;
+
+    state &= BUTTON_MASK;
+    changed = state ^ u->state;
+    u->state = state;
+    u->have_state = 1;
+    for (i=0; changed; i++, changed >>= 1){
+        if (changed & 1) {
+            fn(arg, i, (state >> i) & 1, when);
+        }
+    }
+}
+
+static uint32_t buttons(const unsigned char *b){
+    return b[0] | b[1] << 8 | (uint32_t)b[2] << 16;
+}
+
+// poll replies are the three button bytes and nothing else. the state is
+// somewhere between the request and the reply; the middle will do.
+static void takeReply(struct unojoy *u, long long at, unojoy_fn fn, void *arg){
+    if (!u->sent || u->fill < UNOJOY_STATE_BYTES) {
+        //nothing asked for it: stray bytes from before a flush
+        if (!u->sent) {
+            u->fill = 0;
+        }
+        return;
+    }
+    diff(u, buttons(u->buf), u->sent + (at - u->sent) / 2, fn, arg);
+    u->sent = 0;
+    u->fill = 0;
+}
+
+// pushed packets can arrive several to a read. each is stamped from the
+// time its first byte went out, counting back from the last byte read.
+static void takePackets(struct unojoy *u, long long at, unojoy_fn fn, void *arg){
+    int start = 0;
+
+    while (u->fill - start >= UNOJOY_PACKET) {
+        const unsigned char *p = u->buf + start;
+        int after;
+
+        if (p[0] != UNOJOY_SYNC || (p[0] ^ p[1] ^ p[2] ^ p[3]) != p[4]) {
+            //not lined up with the packets, or a byte got lost
+            start++;
+            continue;
+        }
+        after = u->fill - start;
+        diff(u, buttons(p + 1), at - after * BYTE_NS, fn, arg);
+        start += UNOJOY_PACKET;
+    }
+    u->fill -= start;
+    memmove(u->buf, u->buf + start, u->fill);
+}
+
+int unojoy_read(struct unojoy *u, unojoy_fn fn, void *arg){
+    ssize_t n;
+    long long at;
+
+    while ((n = read(u->fd, u->buf + u->fill, sizeof(u->buf) - u->fill)) > 0) {
+        at = now();
+        u->fill += n;
+        if (u->hz) {
+            takeReply(u, at, fn, arg);
+        } else {
+            takePackets(u, at, fn, arg);
+        }
+        //a full buffer of junk starts over
+        if (u->fill == (int)sizeof(u->buf)) {
+            u->fill = 0;
+        }
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        return n ? -errno : -EIO;
+    }
+    return 0;
+}
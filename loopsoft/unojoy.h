@@ -0,0 +1,57 @@
+#ifndef UNOJOY_H
+#define UNOJOY_H
+
+#include <stdint.h>
+
+// an UnoJoy board read straight over its serial port, with the Arduino's
+// usb chip left on the stock serial firmware. buttons are numbered by
+// their bit in dataForController_t: triangle 0, circle 1, square 2,
+// cross 3, l1 4, l2 5, l3 6, r1 7, r2 8, r3 9, select 10, start 11,
+// home 12, dpad left 13, up 14, right 15, down 16.
+//
+// the stock sketch answers each byte index written to it with that byte
+// of the struct. asked for the three button bytes at a steady rate, it
+// gets diffed into edges here. a sketch with UNOJOY_PUSH support can
+// instead be told to send a packet of them whenever they change, which
+// is quicker and quiet while nothing happens:
+//   UNOJOY_SYNC, byte 0, byte 1, byte 2, the xor of those four
+#define UNOJOY_BAUD B38400
+#define UNOJOY_BUTTONS 17
+#define UNOJOY_STATE_BYTES 3
+#define UNOJOY_PUSH 'P'
+#define UNOJOY_SYNC 0xa5
+#define UNOJOY_PACKET 5
+// a request and its reply take about 2.5 ms at 38400 baud
+#define DEFAULT_UNOJOY_HZ 250
+
+// a button went down (1) or up (0) at when, CLOCK_MONOTONIC ns
+typedef void (*unojoy_fn)(void *arg, int button, int value, long long when);
+
+struct unojoy {
+    int fd;
+    //requests a second, 0 for a board that pushes
+    int hz;
+    long long period;
+    //when the next request or push request goes out, and the last did
+    long long next;
+    long long sent;
+    //bytes of the reply or packet so far
+    unsigned char buf[64];
+    int fill;
+    uint32_t state;
+    int have_state;
+};
+
+// hz requests a second, or 0 to switch the sketch to pushing changes
+int unojoy_open(struct unojoy *u, const char *path, int hz);
+void unojoy_close(struct unojoy *u);
+
+// when unojoy_send wants calling next
+long long unojoy_deadline(struct unojoy *u);
+// sends the request that's due, if any
+int unojoy_send(struct unojoy *u, long long now);
+// takes in what the board sent, calling fn for every button that changed.
+// returns a negative errno if the board has gone.
+int unojoy_read(struct unojoy *u, unojoy_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,150 @@
+#include <string.h>
+#include <stdint.h>
+#include "wavfile.h"
+
+#define WAV_HEADER_BYTES 44
+
+static void put16(unsigned char *p, uint16_t v){
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v){
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+}
+
+static uint16_t get16(const unsigned char *p){
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p){
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeHeader(struct wavfile *w){
+    unsigned char h[WAV_HEADER_BYTES];
+    uint32_t data = w->frames * w->channels * sizeof(sample_t);
+
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, 36 + data);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, 1); // PCM
+    put16(h + 22, w->channels);
+    put32(h + 24, w->rate);
+    put32(h + 28, w->rate * w->channels * sizeof(sample_t));
+    put16(h + 32, w->channels * sizeof(sample_t));
+    put16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, data);
+
+    fseek(w->f, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), w->f);
+}
+
+int wav_open_read(struct wavfile *w, const char *path){
+    unsigned char h[12];
+    unsigned char chunk[8];
+    unsigned char fmt[16];
+
+    memset(w, 0, sizeof(*w));
+    if (!(w->f = fopen(path, "rb"))) {
+        perror(path);
+        return -1;
+    }
+
+    if (fread(h, 1, 12, w->f) != 12 ||
+            memcmp(h, "RIFF", 4) != 0 || memcmp(h + 8, "WAVE", 4) != 0) {
+        //no header, take it as raw S16_LE stereo
+        fseek(w->f, 0, SEEK_SET);
+        w->raw = 1;
+        w->channels = CHANNELS;
+        w->frames = -1;
+        return 0;
+    }
+
+    //walk chunks until data, picking up fmt on the way
+    while (fread(chunk, 1, 8, w->f) == 8) {
+        uint32_t len = get32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && len >= sizeof(fmt)) {
+            if (fread(fmt, 1, sizeof(fmt), w->f) != sizeof(fmt)) {
+                break;
+            }
+            if (get16(fmt) != 1 || get16(fmt + 14) != 16) {
+                fprintf(stderr, "%s: only 16 bit PCM is supported\n", path);
+                break;
+            }
+            w->channels = get16(fmt + 2);
+            w->rate = get32(fmt + 4);
+            fseek(w->f, len - sizeof(fmt) + (len & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (w->channels != CHANNELS) {
+                fprintf(stderr, "%s: need %d channels, file has %d\n",
+                    path, CHANNELS, w->channels);
+                break;
+            }
+            w->frames = len / (w->channels * sizeof(sample_t));
+            return 0;
+        } else {
+            fseek(w->f, len + (len & 1), SEEK_CUR);
+        }
+    }
+
+    fprintf(stderr, "%s: not a usable wav file\n", path);
+    fclose(w->f);
+    w->f = NULL;
+    return -1;
+}
+
+int wav_open_write(struct wavfile *w, const char *path, unsigned int rate){
+    size_t len = strlen(path);
+
+    memset(w, 0, sizeof(*w));
+    if (!(w->f = fopen(path, "wb"))) {
+        perror(path);
+        return -1;
+    }
+    w->writing = 1;
+    w->rate = rate;
+    w->channels = CHANNELS;
+    w->raw = len > 4 && strcmp(path + len - 4, ".raw") == 0;
+    if (!w->raw) {
+        //placeholder until the sizes are known
+        writeHeader(w);
+    }
+    return 0;
+}
+
+long wav_read(struct wavfile *w, sample_t *buf, long frames){
+    size_t got;
+
+    if (w->frames >= 0 && frames > w->frames) {
+        frames = w->frames;
+    }
+    got = fread(buf, sizeof(sample_t) * w->channels, frames, w->f);
+    if (w->frames >= 0) {
+        w->frames -= got;
+    }
+    return got;
+}
+
+long wav_write(struct wavfile *w, const sample_t *buf, long frames){
+    size_t put = fwrite(buf, sizeof(sample_t) * w->channels, frames, w->f);
+    w->frames += put;
+    return put;
+}
+
+void wav_close(struct wavfile *w){
+    if (!w->f) {
+        return;
+    }
+    if (w->writing && !w->raw) {
+        writeHeader(w);
+    }
+    fclose(w->f);
+    w->f = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+#include <stdio.h>
+#include "sample.h"
+
+// 16 bit PCM WAV files, or headerless S16_LE interleaved stereo when the
+// file isn't RIFF (reading) or the name ends in .raw (writing)
+struct wavfile {
+    FILE *f;
+    int raw;
+    int writing;
+    unsigned int rate;
+    int channels;
+    //frames left to read, or written so far
+    long frames;
+};
+
+int wav_open_read(struct wavfile *w, const char *path);
+int wav_open_write(struct wavfile *w, const char *path, unsigned int rate);
+// both work in whole frames and return how many were transferred
+long wav_read(struct wavfile *w, sample_t *buf, long frames);
+long wav_write(struct wavfile *w, const sample_t *buf, long frames);
+// fills in the header sizes when writing
+void wav_close(struct wavfile *w);
+
+#endif